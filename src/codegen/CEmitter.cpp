@@ -0,0 +1,798 @@
+#include "CEmitter.h"
+#include <cstdio>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+
+#include "../runtime/Builtins.h"
+#include "../runtime/StackGuard.h"
+
+// everything the generated program needs, pasted verbatim at the top.
+// kv values own their string data and every kv_* call consumes its kv
+// arguments, so the generated code never has to think about freeing.
+static const char* RUNTIME = R"KV(/* generated by kash --emit-c */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+
+enum { KV_UNDEF, KV_INT, KV_DBL, KV_STR };
+
+typedef struct {
+    int tag;
+    int i;
+    double d;
+    char *s;
+    size_t len;
+} kv;
+
+static void kv_fail(const char *msg) {
+    fflush(stdout);
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(1);
+}
+
+static void kv_undef(const char *name) {
+    fflush(stdout);
+    fprintf(stderr, "Error: Undefined variable: %s\n", name);
+    exit(1);
+}
+
+static kv kv_int(int i) { kv v = {KV_INT, i, 0.0, NULL, 0}; return v; }
+static kv kv_dbl(double d) { kv v = {KV_DBL, 0, d, NULL, 0}; return v; }
+
+static kv kv_str(const char *s, size_t len) {
+    kv v = {KV_STR, 0, 0.0, (char *)malloc(len + 1), len};
+    if (!v.s) kv_fail("out of memory");
+    memcpy(v.s, s, len);
+    v.s[len] = '\0';
+    return v;
+}
+
+static void kv_free(kv v) { if (v.tag == KV_STR) free(v.s); }
+
+static kv kv_load(const kv *var, const char *name) {
+    if (var->tag == KV_UNDEF) kv_undef(name);
+    if (var->tag == KV_STR) return kv_str(var->s, var->len);
+    return *var;
+}
+
+static void kv_store(kv *var, kv v) { kv_free(*var); *var = v; }
+
+static int kv_isnum(kv v) { return v.tag == KV_INT || v.tag == KV_DBL; }
+static double kv_num(kv v) { return v.tag == KV_DBL ? v.d : (double)v.i; }
+static int kv_take_int(kv v) { return v.i; }
+
+/* int math wraps like the interpreter does on every target we care about */
+static int kv_iadd(int a, int b) { return (int)((unsigned)a + (unsigned)b); }
+static int kv_isub(int a, int b) { return (int)((unsigned)a - (unsigned)b); }
+static int kv_imul(int a, int b) { return (int)((unsigned)a * (unsigned)b); }
+static int kv_idiv(int a, int b) { if (b == 0) kv_fail("Division by zero"); return a / b; }
+static int kv_imod(int a, int b) { if (b == 0) kv_fail("Modulo by zero"); return a % b; }
+static double kv_ddiv(double a, double b) { if (b == 0.0) kv_fail("Division by zero"); return a / b; }
+
+static int kv_cmp_int(int op, int l, int r) {
+    switch (op) {
+        case 'E': return l == r;
+        case 'N': return l != r;
+        case '>': return l > r;
+        case '<': return l < r;
+        case 'G': return l >= r;
+        default:  return l <= r;
+    }
+}
+
+static int kv_cmp_dbl(int op, double l, double r) {
+    switch (op) {
+        case 'E': return l == r;
+        case 'N': return l != r;
+        case '>': return l > r;
+        case '<': return l < r;
+        case 'G': return l >= r;
+        default:  return l <= r;
+    }
+}
+
+static kv kv_binop(int op, kv l, kv r) {
+    kv res;
+    if (op == '+') {
+        if (l.tag == KV_INT && r.tag == KV_INT) {
+            res = kv_int(kv_iadd(l.i, r.i));
+        } else if (l.tag == KV_STR && r.tag == KV_STR) {
+            res.tag = KV_STR;
+            res.len = l.len + r.len;
+            res.s = (char *)malloc(res.len + 1);
+            if (!res.s) kv_fail("out of memory");
+            memcpy(res.s, l.s, l.len);
+            memcpy(res.s + l.len, r.s, r.len);
+            res.s[res.len] = '\0';
+        } else if (kv_isnum(l) && kv_isnum(r)) {
+            res = kv_dbl(kv_num(l) + kv_num(r));
+        } else {
+            kv_fail("Type error: '+' requires operands of same type or both numeric");
+        }
+    } else if (op == '-' || op == '*' || op == '/' || op == '%') {
+        if (!(kv_isnum(l) && kv_isnum(r))) kv_fail("Arithmetic operators require numbers");
+        if (l.tag == KV_DBL || r.tag == KV_DBL) {
+            double a = kv_num(l), b = kv_num(r);
+            if (op == '%') kv_fail("Modulo not supported for floats");
+            res = kv_dbl(op == '-' ? a - b : op == '*' ? a * b : kv_ddiv(a, b));
+        } else {
+            int a = l.i, b = r.i;
+            res = kv_int(op == '-' ? kv_isub(a, b) : op == '*' ? kv_imul(a, b)
+                       : op == '/' ? kv_idiv(a, b) : kv_imod(a, b));
+        }
+    } else {
+        if (kv_isnum(l) && kv_isnum(r)) {
+            if (l.tag == KV_DBL || r.tag == KV_DBL) res = kv_int(kv_cmp_dbl(op, kv_num(l), kv_num(r)));
+            else res = kv_int(kv_cmp_int(op, l.i, r.i));
+        } else if (l.tag == KV_STR && r.tag == KV_STR) {
+            int same = l.len == r.len && memcmp(l.s, r.s, l.len) == 0;
+            if (op == 'E') res = kv_int(same);
+            else if (op == 'N') res = kv_int(!same);
+            else kv_fail("Only == and != allowed for strings");
+        } else {
+            kv_fail("Type mismatch in comparison");
+        }
+    }
+    kv_free(l);
+    kv_free(r);
+    return res;
+}
+
+static int kv_if_cond(kv v) {
+    if (v.tag == KV_INT) return v.i != 0;
+    if (v.tag == KV_DBL) return v.d != 0.0;
+    kv_fail("If condition must be a number (int or float)");
+    return 0;
+}
+
+static int kv_while_cond(kv v) {
+    if (v.tag != KV_INT) kv_fail("While condition must be an integer");
+    return v.i != 0;
+}
+
+static int kv_for_cond(kv v) {
+    if (v.tag != KV_INT) kv_fail("For condition must be an integer");
+    return v.i != 0;
+}
+
+static void kv_print_int(int i) { printf("%d\n", i); }
+
+/* shortest digits that read back as d, laid out like formatDouble() in
+   runtime/NumberFormat.cpp: plain for 1e-6 <= |d| < 1e21, else scientific */
+static size_t kv_fmt_dbl(char *out, double d) {
+    char sci[40], digits[24];
+    int p, i, k = 0, exp, n;
+    char *o = out;
+    double a = fabs(d);
+
+    if (isnan(d)) return (size_t)sprintf(out, "%s", signbit(d) ? "-nan" : "nan");
+    if (isinf(d)) return (size_t)sprintf(out, "%s", d < 0 ? "-inf" : "inf");
+
+    for (p = 1;; p++) {
+        snprintf(sci, sizeof sci, "%.*e", p - 1, a);
+        if (p >= 17 || strtod(sci, NULL) == a) break;
+    }
+    for (i = 0; sci[i] != 'e'; i++) {
+        if (sci[i] != '.') digits[k++] = sci[i];
+    }
+    exp = atoi(sci + i + 1);
+    n = exp + 1;
+
+    if (signbit(d)) *o++ = '-';
+    if (k <= n && n <= 21) {
+        memcpy(o, digits, (size_t)k); o += k;
+        for (i = k; i < n; i++) *o++ = '0';
+        *o++ = '.'; *o++ = '0';
+    } else if (0 < n && n <= 21) {
+        memcpy(o, digits, (size_t)n); o += n;
+        *o++ = '.';
+        memcpy(o, digits + n, (size_t)(k - n)); o += k - n;
+    } else if (-6 < n && n <= 0) {
+        *o++ = '0'; *o++ = '.';
+        for (i = 0; i < -n; i++) *o++ = '0';
+        memcpy(o, digits, (size_t)k); o += k;
+    } else {
+        *o++ = digits[0];
+        if (k > 1) { *o++ = '.'; memcpy(o, digits + 1, (size_t)(k - 1)); o += k - 1; }
+        o += sprintf(o, "e%c%d", exp < 0 ? '-' : '+', exp < 0 ? -exp : exp);
+    }
+    *o = '\0';
+    return (size_t)(o - out);
+}
+
+static void kv_print_dbl(double d) {
+    char buf[64];
+    fwrite(buf, 1, kv_fmt_dbl(buf, d), stdout);
+    putchar('\n');
+}
+
+static void kv_print(kv v) {
+    if (v.tag == KV_INT) kv_print_int(v.i);
+    else if (v.tag == KV_DBL) kv_print_dbl(v.d);
+    else { fwrite(v.s, 1, v.len, stdout); putchar('\n'); }
+    kv_free(v);
+}
+
+static kv kv_tostring(kv v) {
+    char buf[64];
+    if (v.tag == KV_STR) return v;
+    if (v.tag == KV_INT) return kv_str(buf, (size_t)sprintf(buf, "%d", v.i));
+    return kv_str(buf, kv_fmt_dbl(buf, v.d));
+}
+
+/* same rules as parseNumberPrefix(): leading space and '+', stop at the
+   first character that cannot continue the number, no hex */
+static kv kv_tonum(kv v) {
+    const char *p;
+    char *end;
+    double dv;
+    if (kv_isnum(v)) return v;
+    p = v.s;
+    while (*p == ' ' || (*p >= '\t' && *p <= '\r')) p++;
+    if (*p == '+' && p[1] != '-') p++;
+    errno = 0;
+    if ((p[0] == '0' || ((p[0] == '-') && p[1] == '0')) && (p[p[0] == '-' ? 2 : 1] | 0x20) == 'x') {
+        dv = p[0] == '-' ? -0.0 : 0.0;
+        end = (char *)p + 1;
+    } else {
+        dv = strtod(p, &end);
+    }
+    if (end == p || *p == '+' || (errno == ERANGE && (isinf(dv) || dv == 0.0))) {
+        char *msg = (char *)malloc(v.len + 64);
+        if (!msg) kv_fail("out of memory");
+        sprintf(msg, "toNum: cannot convert \"%s\" to number", v.s);
+        kv_fail(msg);
+    }
+    kv_free(v);
+    if (dv == floor(dv) && dv >= -2147483648.0 && dv <= 2147483647.0) return kv_int((int)dv);
+    return kv_dbl(dv);
+}
+
+/* mirrors std::getline plus the interpreter's retry on a leftover newline */
+static kv kv_readline(int *good) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n = getline(&line, &cap, stdin);
+    kv v;
+    if (n < 0) { free(line); *good = 0; return kv_str("", 0); }
+    if (n > 0 && line[n - 1] == '\n') { n--; *good = 1; } else { *good = 0; }
+    v = kv_str(line, (size_t)n);
+    free(line);
+    return v;
+}
+
+static kv kv_input(void) {
+    int good;
+    kv v = kv_readline(&good);
+    if (v.len == 0 && good) { kv_free(v); v = kv_readline(&good); }
+    return v;
+}
+
+)KV";
+
+// quote raw bytes as a C string literal
+static std::string cString(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 32 || c >= 127 || c == '?') {
+                    char buf[8];
+                    std::snprintf(buf, sizeof buf, "\\%03o", c);
+                    out += buf;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out + "\"";
+}
+
+static std::string intLiteral(int v) {
+    if (v == -2147483647 - 1) return "(-2147483647 - 1)";
+    if (v < 0) return "(" + std::to_string(v) + ")";
+    return std::to_string(v);
+}
+
+static std::string doubleLiteral(double v) {
+    char buf[64];
+    std::snprintf(buf, sizeof buf, "%.17g", v);
+    std::string s = buf;
+    if (s.find_first_of(".eEn") == std::string::npos) s += ".0";
+    if (v < 0) s = "(" + s + ")";
+    return s;
+}
+
+// op codes understood by kv_binop / kv_cmp_*
+static char opCode(TokenTypes op) {
+    switch (op) {
+        case TokenTypes::PLUS:          return '+';
+        case TokenTypes::MINUS:         return '-';
+        case TokenTypes::ASTERISK:      return '*';
+        case TokenTypes::SLASH:         return '/';
+        case TokenTypes::MODULUS:       return '%';
+        case TokenTypes::EQUAL_EQUAL:   return 'E';
+        case TokenTypes::NOT_EQUAL:     return 'N';
+        case TokenTypes::GREATER:       return '>';
+        case TokenTypes::LESSER:        return '<';
+        case TokenTypes::GREATER_EQUAL: return 'G';
+        case TokenTypes::LESSER_EQUAL:  return 'L';
+        default: throw std::runtime_error("emit-c: unknown binary operator");
+    }
+}
+
+static const char* cCompare(TokenTypes op) {
+    switch (op) {
+        case TokenTypes::EQUAL_EQUAL:   return "==";
+        case TokenTypes::NOT_EQUAL:     return "!=";
+        case TokenTypes::GREATER:       return ">";
+        case TokenTypes::LESSER:        return "<";
+        case TokenTypes::GREATER_EQUAL: return ">=";
+        default:                        return "<=";
+    }
+}
+
+static bool isComparison(TokenTypes op) {
+    return op == TokenTypes::EQUAL_EQUAL || op == TokenTypes::NOT_EQUAL ||
+           op == TokenTypes::GREATER || op == TokenTypes::LESSER ||
+           op == TokenTypes::GREATER_EQUAL || op == TokenTypes::LESSER_EQUAL;
+}
+
+// every variable name read anywhere inside an expression
+static void collectReads(const Expr* expr, std::set<std::string>& out) {
+    if (auto var = dynamic_cast<const VariableExpr*>(expr)) {
+        out.insert(var->n);
+    } else if (auto bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        collectReads(bin->left.get(), out);
+        collectReads(bin->right.get(), out);
+    } else if (auto call = dynamic_cast<const CallExpr*>(expr)) {
+        for (const auto& arg : call->arguments) collectReads(arg.get(), out);
+    }
+}
+
+static void collectReads(const Stmt* stmt, std::set<std::string>& out) {
+    if (auto assign = dynamic_cast<const AssignStmt*>(stmt)) {
+        collectReads(assign->expression.get(), out);
+    } else if (auto print = dynamic_cast<const PrintStmt*>(stmt)) {
+        collectReads(print->expression.get(), out);
+    } else if (auto block = dynamic_cast<const BlockStmt*>(stmt)) {
+        for (const auto& s : block->statements) collectReads(s.get(), out);
+    } else if (auto ifStmt = dynamic_cast<const IfStmt*>(stmt)) {
+        collectReads(ifStmt->condition.get(), out);
+        for (const auto& s : ifStmt->thenBody) collectReads(s.get(), out);
+        for (const auto& s : ifStmt->elseBody) collectReads(s.get(), out);
+    } else if (auto whileStmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        collectReads(whileStmt->condition.get(), out);
+        for (const auto& s : whileStmt->body) collectReads(s.get(), out);
+    } else if (auto forStmt = dynamic_cast<const ForStmt*>(stmt)) {
+        collectReads(forStmt->init.get(), out);
+        collectReads(forStmt->condition.get(), out);
+        collectReads(forStmt->update.get(), out);
+        for (const auto& s : forStmt->body) collectReads(s.get(), out);
+    }
+}
+
+// ===== type inference =====
+
+CEmitter::CType CEmitter::join(CType a, CType b) {
+    if (a == CType::NONE) return b;
+    if (b == CType::NONE) return a;
+    if (a == b) return a;
+    return CType::DYN;
+}
+
+bool CEmitter::isNative(CType t) {
+    return t == CType::INT || t == CType::DOUBLE;
+}
+
+CEmitter::CType CEmitter::varType(const std::string& name) const {
+    auto it = vars.find(name);
+    return it == vars.end() ? CType::NONE : it->second;
+}
+
+// static type of an expression given the current variable types.
+// anything that would fail at runtime is DYN so it goes through kv_binop
+// and reports the interpreter's error message
+CEmitter::CType CEmitter::exprType(const Expr* expr) const {
+    if (stackLow()) throw std::runtime_error("emit-c: expression nested too deeply");
+    if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
+        if (std::holds_alternative<int>(lit->val)) return CType::INT;
+        if (std::holds_alternative<double>(lit->val)) return CType::DOUBLE;
+        return CType::STR;
+    }
+
+    if (dynamic_cast<const StringExpr*>(expr)) return CType::STR;
+
+    if (auto var = dynamic_cast<const VariableExpr*>(expr)) return varType(var->n);
+
+    if (auto bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        CType l = exprType(bin->left.get());
+        CType r = exprType(bin->right.get());
+        if (l == CType::NONE || r == CType::NONE) return CType::NONE;
+        if (l == CType::DYN || r == CType::DYN) return CType::DYN;
+
+        bool numeric = isNative(l) && isNative(r);
+        bool bothInt = l == CType::INT && r == CType::INT;
+
+        if (isComparison(bin->op)) {
+            if (numeric) return CType::INT;
+            if (l == CType::STR && r == CType::STR &&
+                (bin->op == TokenTypes::EQUAL_EQUAL || bin->op == TokenTypes::NOT_EQUAL)) {
+                return CType::INT;
+            }
+            return CType::DYN;
+        }
+        if (bin->op == TokenTypes::PLUS && l == CType::STR && r == CType::STR) return CType::STR;
+        if (bin->op == TokenTypes::MODULUS) return bothInt ? CType::INT : CType::DYN;
+        if (!numeric) return CType::DYN;
+        return bothInt ? CType::INT : CType::DOUBLE;
+    }
+
+    if (auto call = dynamic_cast<const CallExpr*>(expr)) {
+        std::vector<CType> args;
+        for (const auto& a : call->arguments) args.push_back(exprType(a.get()));
+        BuiltinId id = static_cast<BuiltinId>(call->builtin);
+        if (id == BuiltinId::TO_STRING || id == BuiltinId::INPUT) return CType::STR;
+        if (id == BuiltinId::TO_NUM) {
+            CType arg = args[0];
+            if (arg == CType::NONE) return CType::NONE;
+            return isNative(arg) ? arg : CType::DYN;
+        }
+        return CType::DYN;
+    }
+
+    throw std::runtime_error("emit-c: unsupported expression");
+}
+
+// one pass over the program, true if any variable's type widened
+bool CEmitter::inferStmts(const std::vector<std::unique_ptr<Stmt>>& stmts) {
+    bool changed = false;
+
+    auto widen = [&](const std::string& name, CType t) {
+        CType old = varType(name);
+        CType now = join(old, t);
+        if (now != old) {
+            vars[name] = now;
+            changed = true;
+        }
+    };
+
+    for (const auto& stmt : stmts) {
+        const Stmt* s = stmt.get();
+        if (auto assign = dynamic_cast<const AssignStmt*>(s)) {
+            widen(assign->name, exprType(assign->expression.get()));
+        } else if (auto input = dynamic_cast<const InputStmt*>(s)) {
+            widen(input->name, CType::STR);
+        } else if (auto block = dynamic_cast<const BlockStmt*>(s)) {
+            changed |= inferStmts(block->statements);
+        } else if (auto ifStmt = dynamic_cast<const IfStmt*>(s)) {
+            changed |= inferStmts(ifStmt->thenBody);
+            changed |= inferStmts(ifStmt->elseBody);
+        } else if (auto whileStmt = dynamic_cast<const WhileStmt*>(s)) {
+            changed |= inferStmts(whileStmt->body);
+        } else if (auto forStmt = dynamic_cast<const ForStmt*>(s)) {
+            auto init = static_cast<const AssignStmt*>(forStmt->init.get());
+            auto update = static_cast<const AssignStmt*>(forStmt->update.get());
+            widen(init->name, exprType(init->expression.get()));
+            changed |= inferStmts(forStmt->body);
+            widen(update->name, exprType(update->expression.get()));
+        }
+    }
+    return changed;
+}
+
+// a native variable is safe to read without a flag only if a top-level
+// assignment happens before anything reads it
+void CEmitter::findUnsafeReads(const std::vector<std::unique_ptr<Stmt>>& program) {
+    std::set<std::string> assigned;
+
+    auto check = [&](const Stmt* s) {
+        std::set<std::string> reads;
+        collectReads(s, reads);
+        for (const auto& name : reads) {
+            if (!assigned.count(name) && isNative(varType(name))) needsDefFlag.insert(name);
+        }
+    };
+
+    for (const auto& stmt : program) {
+        // a for initializer runs before the rest of the loop reads anything
+        if (auto forStmt = dynamic_cast<const ForStmt*>(stmt.get())) {
+            check(forStmt->init.get());
+            assigned.insert(static_cast<const AssignStmt*>(forStmt->init.get())->name);
+        }
+        check(stmt.get());
+
+        if (auto assign = dynamic_cast<const AssignStmt*>(stmt.get())) assigned.insert(assign->name);
+        if (auto input = dynamic_cast<const InputStmt*>(stmt.get())) assigned.insert(input->name);
+    }
+}
+
+// ===== code generation =====
+
+std::string CEmitter::temp() {
+    return "t" + std::to_string(tempCount++);
+}
+
+void CEmitter::line(const std::string& code) {
+    body << std::string(indent * 4, ' ') << code << "\n";
+}
+
+std::string CEmitter::toKv(const Operand& op) {
+    if (op.type == CType::INT) return "kv_int(" + op.code + ")";
+    if (op.type == CType::DOUBLE) return "kv_dbl(" + op.code + ")";
+    return op.code;
+}
+
+std::string CEmitter::toDouble(const Operand& op) {
+    if (op.type == CType::INT) return "(double)" + op.code;
+    return op.code;
+}
+
+CEmitter::Operand CEmitter::genExpr(const Expr* expr) {
+    if (stackLow()) throw std::runtime_error("emit-c: expression nested too deeply");
+    if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
+        return std::visit([&](auto&& v) -> Operand {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, int>) {
+                return { intLiteral(v), CType::INT };
+            } else if constexpr (std::is_same_v<T, double>) {
+                return { doubleLiteral(v), CType::DOUBLE };
+            } else {
+                std::string t = temp();
+                line("kv " + t + " = kv_str(" + cString(v) + ", " + std::to_string(v.size()) + ");");
+                return { t, CType::STR };
+            }
+        }, lit->val);
+    }
+
+    if (auto s = dynamic_cast<const StringExpr*>(expr)) {
+        std::string t = temp();
+        line("kv " + t + " = kv_str(" + cString(s->val) + ", " + std::to_string(s->val.size()) + ");");
+        return { t, CType::STR };
+    }
+
+    if (auto var = dynamic_cast<const VariableExpr*>(expr)) {
+        CType t = varType(var->n);
+        if (isNative(t)) {
+            if (needsDefFlag.count(var->n)) {
+                line("if (!d_" + var->n + ") kv_undef(\"" + var->n + "\");");
+            }
+            return { "v_" + var->n, t };
+        }
+        std::string tmp = temp();
+        line("kv " + tmp + " = kv_load(&v_" + var->n + ", \"" + var->n + "\");");
+        return { tmp, t };
+    }
+
+    if (auto bin = dynamic_cast<const BinaryExpr*>(expr)) return genBinary(bin);
+    if (auto call = dynamic_cast<const CallExpr*>(expr)) return genCall(call);
+
+    throw std::runtime_error("emit-c: unsupported expression");
+}
+
+CEmitter::Operand CEmitter::genBinary(const BinaryExpr* bin) {
+    Operand l = genExpr(bin->left.get());
+    Operand r = genExpr(bin->right.get());
+    CType result = exprType(bin);
+    std::string t = temp();
+
+    if (isNative(result) && isNative(l.type) && isNative(r.type)) {
+        if (isComparison(bin->op)) {
+            if (l.type == CType::INT && r.type == CType::INT) {
+                line("int " + t + " = " + l.code + " " + cCompare(bin->op) + " " + r.code + ";");
+            } else {
+                line("int " + t + " = " + toDouble(l) + " " + cCompare(bin->op) + " " + toDouble(r) + ";");
+            }
+            return { t, CType::INT };
+        }
+
+        if (result == CType::INT) {
+            const char* fn = "kv_imod";
+            switch (bin->op) {
+                case TokenTypes::PLUS:     fn = "kv_iadd"; break;
+                case TokenTypes::MINUS:    fn = "kv_isub"; break;
+                case TokenTypes::ASTERISK: fn = "kv_imul"; break;
+                case TokenTypes::SLASH:    fn = "kv_idiv"; break;
+                default: break;
+            }
+            line("int " + t + " = " + fn + "(" + l.code + ", " + r.code + ");");
+            return { t, CType::INT };
+        }
+
+        std::string a = toDouble(l), b = toDouble(r);
+        if (bin->op == TokenTypes::SLASH) {
+            line("double " + t + " = kv_ddiv(" + a + ", " + b + ");");
+        } else {
+            const char* op = bin->op == TokenTypes::PLUS ? " + " : bin->op == TokenTypes::MINUS ? " - " : " * ";
+            line("double " + t + " = " + a + op + b + ";");
+        }
+        return { t, CType::DOUBLE };
+    }
+
+    std::string call = std::string("kv_binop('") + opCode(bin->op) + "', " + toKv(l) + ", " + toKv(r) + ")";
+    if (result == CType::INT) {
+        line("int " + t + " = kv_take_int(" + call + ");");
+        return { t, CType::INT };
+    }
+    line("kv " + t + " = " + call + ";");
+    return { t, result };
+}
+
+CEmitter::Operand CEmitter::genCall(const CallExpr* call) {
+    // the file, string and registered builtins have no C runtime
+    // counterpart; the parser already checked the argument count
+    BuiltinId id = static_cast<BuiltinId>(call->builtin);
+    if (id != BuiltinId::TO_STRING && id != BuiltinId::TO_NUM && id != BuiltinId::INPUT) {
+        throw std::runtime_error("emit-c: unsupported function: " + call->callee);
+    }
+
+    std::vector<Operand> args;
+    for (const auto& a : call->arguments) args.push_back(genExpr(a.get()));
+    std::string t = temp();
+
+    if (id == BuiltinId::INPUT) {
+        if (!args.empty() && !isNative(args[0].type)) line("kv_free(" + args[0].code + ");");
+        line("kv " + t + " = kv_input();");
+        return { t, CType::STR };
+    }
+    Operand arg = args[0];
+
+    if (id == BuiltinId::TO_STRING) {
+        line("kv " + t + " = kv_tostring(" + toKv(arg) + ");");
+        return { t, CType::STR };
+    }
+
+    if (isNative(arg.type)) return arg;
+    line("kv " + t + " = kv_tonum(" + arg.code + ");");
+    return { t, CType::DYN };
+}
+
+void CEmitter::genStmts(const std::vector<std::unique_ptr<Stmt>>& stmts) {
+    for (const auto& s : stmts) genStmt(s.get());
+}
+
+void CEmitter::genStmt(const Stmt* stmt) {
+    if (auto block = dynamic_cast<const BlockStmt*>(stmt)) {
+        line("{");
+        indent++;
+        genStmts(block->statements);
+        indent--;
+        line("}");
+        return;
+    }
+
+    if (dynamic_cast<const BreakStmt*>(stmt)) {
+        line("break;");
+        return;
+    }
+
+    if (auto ifStmt = dynamic_cast<const IfStmt*>(stmt)) {
+        line("{");
+        indent++;
+        Operand c = genExpr(ifStmt->condition.get());
+        if (c.type == CType::INT) line("if (" + c.code + ") {");
+        else if (c.type == CType::DOUBLE) line("if (" + c.code + " != 0.0) {");
+        else line("if (kv_if_cond(" + c.code + ")) {");
+        indent++;
+        genStmts(ifStmt->thenBody);
+        indent--;
+        line("} else {");
+        indent++;
+        genStmts(ifStmt->elseBody);
+        indent--;
+        line("}");
+        indent--;
+        line("}");
+        return;
+    }
+
+    if (auto whileStmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        line("for (;;) {");
+        indent++;
+        Operand c = genExpr(whileStmt->condition.get());
+        if (c.type == CType::INT) line("if (!" + c.code + ") break;");
+        else if (c.type == CType::DOUBLE) line("kv_fail(\"While condition must be an integer\");");
+        else line("if (!kv_while_cond(" + c.code + ")) break;");
+        genStmts(whileStmt->body);
+        indent--;
+        line("}");
+        return;
+    }
+
+    if (auto forStmt = dynamic_cast<const ForStmt*>(stmt)) {
+        genStmt(forStmt->init.get());
+        line("for (;;) {");
+        indent++;
+        Operand c = genExpr(forStmt->condition.get());
+        if (c.type == CType::INT) line("if (!" + c.code + ") break;");
+        else if (c.type == CType::DOUBLE) line("kv_fail(\"For condition must be an integer\");");
+        else line("if (!kv_for_cond(" + c.code + ")) break;");
+        genStmts(forStmt->body);
+        genStmt(forStmt->update.get());
+        indent--;
+        line("}");
+        return;
+    }
+
+    if (auto print = dynamic_cast<const PrintStmt*>(stmt)) {
+        Operand v = genExpr(print->expression.get());
+        if (v.type == CType::INT) line("kv_print_int(" + v.code + ");");
+        else if (v.type == CType::DOUBLE) line("kv_print_dbl(" + v.code + ");");
+        else line("kv_print(" + v.code + ");");
+        return;
+    }
+
+    if (auto input = dynamic_cast<const InputStmt*>(stmt)) {
+        line("kv_store(&v_" + input->name + ", kv_input());");
+        return;
+    }
+
+    if (auto assign = dynamic_cast<const AssignStmt*>(stmt)) {
+        Operand v = genExpr(assign->expression.get());
+        CType t = varType(assign->name);
+        if (isNative(t)) {
+            if (v.type != t) throw std::runtime_error("emit-c: type inference mismatch for " + assign->name);
+            line("v_" + assign->name + " = " + v.code + ";");
+            if (needsDefFlag.count(assign->name)) line("d_" + assign->name + " = 1;");
+        } else {
+            line("kv_store(&v_" + assign->name + ", " + toKv(v) + ");");
+        }
+        return;
+    }
+
+    throw std::runtime_error("emit-c: unsupported statement");
+}
+
+std::string CEmitter::emit(const std::vector<std::unique_ptr<Stmt>>& program) {
+    vars.clear();
+    needsDefFlag.clear();
+    body.str("");
+    indent = 1;
+    tempCount = 0;
+
+    // widen variable types until nothing changes, then anything that never
+    // got a type (only ever read, or only assigned from itself) is dynamic
+    while (inferStmts(program)) {}
+
+    std::set<std::string> names;
+    for (const auto& s : program) collectReads(s.get(), names);
+    for (const auto& v : vars) names.insert(v.first);
+    for (const auto& name : names) {
+        if (varType(name) == CType::NONE) vars[name] = CType::DYN;
+    }
+    while (inferStmts(program)) {}
+
+    findUnsafeReads(program);
+    genStmts(program);
+
+    std::ostringstream out;
+    out << RUNTIME;
+    out << "int main(void) {\n";
+    for (const auto& name : names) {
+        CType t = varType(name);
+        if (t == CType::INT) out << "    int v_" << name << " = 0;\n";
+        else if (t == CType::DOUBLE) out << "    double v_" << name << " = 0.0;\n";
+        else out << "    kv v_" << name << " = {KV_UNDEF, 0, 0.0, NULL, 0};\n";
+        if (needsDefFlag.count(name)) out << "    int d_" << name << " = 0;\n";
+    }
+    out << body.str();
+    out << "    return 0;\n";
+    out << "}\n";
+    return out.str();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../parser/AST.h"
+
+// Translates a parsed program into one self-contained C file.
+// Variables that only ever hold ints (or only doubles) become plain C
+// locals, everything else goes through the small kv runtime that is
+// pasted at the top of the output.
+class CEmitter {
+public:
+    std::string emit(const std::vector<std::unique_ptr<Stmt>>& program);
+
+private:
+    // NONE = not known yet, DYN = needs a runtime tag
+    enum class CType { NONE, INT, DOUBLE, STR, DYN };
+
+    struct Operand {
+        std::string code;
+        CType type;
+    };
+
+    std::unordered_map<std::string, CType> vars;
+    std::set<std::string> needsDefFlag; // native vars that may be read before assignment
+
+    std::ostringstream body;
+    int indent = 1;
+    int tempCount = 0;
+
+    // ===== type inference =====
+    static CType join(CType a, CType b);
+    static bool isNative(CType t);
+    CType varType(const std::string& name) const;
+    CType exprType(const Expr* expr) const;
+    bool inferStmts(const std::vector<std::unique_ptr<Stmt>>& stmts);
+    void findUnsafeReads(const std::vector<std::unique_ptr<Stmt>>& program);
+
+    // ===== code generation =====
+    std::string temp();
+    void line(const std::string& code);
+
+    Operand genExpr(const Expr* expr);
+    Operand genBinary(const BinaryExpr* bin);
+    Operand genCall(const CallExpr* call);
+    std::string toKv(const Operand& op);
+    std::string toDouble(const Operand& op);
+
+    void genStmt(const Stmt* stmt);
+    void genStmts(const std::vector<std::unique_ptr<Stmt>>& stmts);
+};
@@ -0,0 +1,227 @@
+#pragma once
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+#include "../lexer/Token.h"
+
+// What every binary operator does, written down once. binaryRule() says
+// which rule an operator follows for each pair of operand types; the
+// interpreter builds a table from it with one function per
+// (operator, left type, right type), so running an operator is one
+// indirect call, and the type pass reads it to know what an expression
+// can give. arithmetic() and comparison() are the number rules, shared by
+// that table and by the unboxed int / double paths.
+
+// Value alternatives, in the variant's order {see AST.h}
+enum : size_t { VALUE_INT = 0, VALUE_DOUBLE = 1, VALUE_STRING = 2, VALUE_KINDS = 3 };
+
+// one table row per token type, most of them "not an operator"
+static const size_t TOKEN_KINDS = static_cast<size_t>(TokenTypes::END_OF_FILE) + 1;
+
+enum class BinaryRule {
+    INT_MATH,        // arithmetic<int>
+    DOUBLE_MATH,     // arithmetic<double>, ints promoted
+    INT_COMPARE,     // comparison<int>
+    DOUBLE_COMPARE,  // comparison<double>, ints promoted
+    CONCAT,          // string + string
+    STRING_EQUALITY, // string == / != string
+    // the rest throw binaryError(rule)
+    PLUS_MISMATCH,
+    NOT_NUMBERS,
+    STRING_ORDER,
+    COMPARE_MISMATCH,
+    NOT_AN_OPERATOR
+};
+
+constexpr bool isArithmeticOp(TokenTypes op) {
+    return op == TokenTypes::PLUS || op == TokenTypes::MINUS ||
+           op == TokenTypes::ASTERISK || op == TokenTypes::SLASH ||
+           op == TokenTypes::MODULUS;
+}
+
+constexpr bool isComparisonOp(TokenTypes op) {
+    return op == TokenTypes::EQUAL_EQUAL || op == TokenTypes::NOT_EQUAL ||
+           op == TokenTypes::GREATER || op == TokenTypes::LESSER ||
+           op == TokenTypes::GREATER_EQUAL || op == TokenTypes::LESSER_EQUAL;
+}
+
+constexpr BinaryRule binaryRule(TokenTypes op, size_t left, size_t right) {
+    bool numbers = left != VALUE_STRING && right != VALUE_STRING;
+    bool strings = left == VALUE_STRING && right == VALUE_STRING;
+    bool doubles = left == VALUE_DOUBLE || right == VALUE_DOUBLE;
+
+    if (op == TokenTypes::PLUS && strings) return BinaryRule::CONCAT;
+    if (isArithmeticOp(op)) {
+        if (!numbers) return op == TokenTypes::PLUS ? BinaryRule::PLUS_MISMATCH : BinaryRule::NOT_NUMBERS;
+        return doubles ? BinaryRule::DOUBLE_MATH : BinaryRule::INT_MATH;
+    }
+    if (isComparisonOp(op)) {
+        if (numbers) return doubles ? BinaryRule::DOUBLE_COMPARE : BinaryRule::INT_COMPARE;
+        if (!strings) return BinaryRule::COMPARE_MISMATCH;
+        bool equality = op == TokenTypes::EQUAL_EQUAL || op == TokenTypes::NOT_EQUAL;
+        return equality ? BinaryRule::STRING_EQUALITY : BinaryRule::STRING_ORDER;
+    }
+    return BinaryRule::NOT_AN_OPERATOR;
+}
+
+constexpr const char* binaryError(BinaryRule rule) {
+    switch (rule) {
+        case BinaryRule::PLUS_MISMATCH:    return "Type error: '+' requires operands of same type or both numeric";
+        case BinaryRule::NOT_NUMBERS:      return "Arithmetic operators require numbers";
+        case BinaryRule::STRING_ORDER:     return "Only == and != allowed for strings";
+        case BinaryRule::COMPARE_MISMATCH: return "Type mismatch in comparison";
+        default:                           return "Unknown binary operator";
+    }
+}
+
+// + - * / % on two ints or two doubles; ints divide towards zero
+template <typename T>
+constexpr T arithmetic(TokenTypes op, T l, T r) {
+    switch (op) {
+        case TokenTypes::PLUS:     return l + r;
+        case TokenTypes::MINUS:    return l - r;
+        case TokenTypes::ASTERISK: return l * r;
+        case TokenTypes::SLASH:
+            if (r == T(0)) throw std::runtime_error("Division by zero");
+            return l / r;
+        case TokenTypes::MODULUS:
+            if constexpr (std::is_same_v<T, double>) {
+                throw std::runtime_error("Modulo not supported for floats");
+            } else {
+                if (r == 0) throw std::runtime_error("Modulo by zero");
+                return l % r;
+            }
+        default: break;
+    }
+    throw std::runtime_error("Unknown binary operator");
+}
+
+// the comparisons give 1 or 0, there is no boolean type
+template <typename T>
+constexpr int comparison(TokenTypes op, T l, T r) {
+    switch (op) {
+        case TokenTypes::EQUAL_EQUAL:   return l == r;
+        case TokenTypes::NOT_EQUAL:     return l != r;
+        case TokenTypes::GREATER:       return l >  r;
+        case TokenTypes::LESSER:        return l <  r;
+        case TokenTypes::GREATER_EQUAL: return l >= r;
+        case TokenTypes::LESSER_EQUAL:  return l <= r;
+        default: break;
+    }
+    throw std::runtime_error("Unknown binary operator");
+}
+
+// either of the two, for the unboxed int path where both kinds meet
+template <typename T>
+constexpr int numericOp(TokenTypes op, T l, T r) {
+    if (isComparisonOp(op)) return comparison(op, l, r);
+    return static_cast<int>(arithmetic(op, l, r));
+}
+
+// ===== checked while compiling =====
+// Every (token, left type, right type) cell against the behaviour the
+// hand-written operator code had before the table, written out by hand
+// rather than worked out like binaryRule() does.
+
+namespace expected {
+
+using R = BinaryRule;
+constexpr R IM = R::INT_MATH, DM = R::DOUBLE_MATH, IC = R::INT_COMPARE, DC = R::DOUBLE_COMPARE,
+            CAT = R::CONCAT, SEQ = R::STRING_EQUALITY, PM = R::PLUS_MISMATCH,
+            NN = R::NOT_NUMBERS, SO = R::STRING_ORDER, CM = R::COMPARE_MISMATCH;
+
+struct Row {
+    TokenTypes op;
+    R cells[VALUE_KINDS * VALUE_KINDS]; // left type * VALUE_KINDS + right type
+};
+
+// ints promote to doubles, only + joins strings and there is no implicit
+// toString, strings only compare for equality, numbers never equal strings,
+// % on doubles passes the type check and throws inside arithmetic
+//                                      int,int  int,dbl  int,str  dbl,int  dbl,dbl  dbl,str  str,int  str,dbl  str,str
+constexpr Row ROWS[] = {
+    { TokenTypes::PLUS,          {      IM,      DM,      PM,      DM,      DM,      PM,      PM,      PM,      CAT } },
+    { TokenTypes::MINUS,         {      IM,      DM,      NN,      DM,      DM,      NN,      NN,      NN,      NN  } },
+    { TokenTypes::ASTERISK,      {      IM,      DM,      NN,      DM,      DM,      NN,      NN,      NN,      NN  } },
+    { TokenTypes::SLASH,         {      IM,      DM,      NN,      DM,      DM,      NN,      NN,      NN,      NN  } },
+    { TokenTypes::MODULUS,       {      IM,      DM,      NN,      DM,      DM,      NN,      NN,      NN,      NN  } },
+    { TokenTypes::EQUAL_EQUAL,   {      IC,      DC,      CM,      DC,      DC,      CM,      CM,      CM,      SEQ } },
+    { TokenTypes::NOT_EQUAL,     {      IC,      DC,      CM,      DC,      DC,      CM,      CM,      CM,      SEQ } },
+    { TokenTypes::GREATER,       {      IC,      DC,      CM,      DC,      DC,      CM,      CM,      CM,      SO  } },
+    { TokenTypes::LESSER,        {      IC,      DC,      CM,      DC,      DC,      CM,      CM,      CM,      SO  } },
+    { TokenTypes::GREATER_EQUAL, {      IC,      DC,      CM,      DC,      DC,      CM,      CM,      CM,      SO  } },
+    { TokenTypes::LESSER_EQUAL,  {      IC,      DC,      CM,      DC,      DC,      CM,      CM,      CM,      SO  } },
+};
+
+// every other token is not an operator, whatever the operands
+constexpr R rule(TokenTypes op, size_t left, size_t right) {
+    for (const Row& row : ROWS) {
+        if (row.op == op) return row.cells[left * VALUE_KINDS + right];
+    }
+    return R::NOT_AN_OPERATOR;
+}
+
+constexpr bool matches(TokenTypes op) {
+    for (size_t l = 0; l < VALUE_KINDS; l++) {
+        for (size_t r = 0; r < VALUE_KINDS; r++) {
+            if (binaryRule(op, l, r) != rule(op, l, r)) return false;
+        }
+    }
+    return true;
+}
+
+constexpr bool allTokensMatch() {
+    for (size_t t = 0; t < TOKEN_KINDS; t++) {
+        if (!matches(static_cast<TokenTypes>(t))) return false;
+    }
+    return true;
+}
+
+constexpr bool sameText(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+} // namespace expected
+
+// one per operator so a failure names it; the last one covers every token
+static_assert(expected::matches(TokenTypes::PLUS), "+ differs from the expected rules");
+static_assert(expected::matches(TokenTypes::MINUS), "- differs from the expected rules");
+static_assert(expected::matches(TokenTypes::ASTERISK), "* differs from the expected rules");
+static_assert(expected::matches(TokenTypes::SLASH), "/ differs from the expected rules");
+static_assert(expected::matches(TokenTypes::MODULUS), "% differs from the expected rules");
+static_assert(expected::matches(TokenTypes::EQUAL_EQUAL), "== differs from the expected rules");
+static_assert(expected::matches(TokenTypes::NOT_EQUAL), "!= differs from the expected rules");
+static_assert(expected::matches(TokenTypes::GREATER), "> differs from the expected rules");
+static_assert(expected::matches(TokenTypes::LESSER), "< differs from the expected rules");
+static_assert(expected::matches(TokenTypes::GREATER_EQUAL), ">= differs from the expected rules");
+static_assert(expected::matches(TokenTypes::LESSER_EQUAL), "<= differs from the expected rules");
+static_assert(expected::allTokensMatch(), "a token differs from the expected rules");
+
+// the messages scripts see
+static_assert(expected::sameText(binaryError(BinaryRule::PLUS_MISMATCH),
+                                 "Type error: '+' requires operands of same type or both numeric"), "+ message");
+static_assert(expected::sameText(binaryError(BinaryRule::NOT_NUMBERS), "Arithmetic operators require numbers"), "arithmetic message");
+static_assert(expected::sameText(binaryError(BinaryRule::STRING_ORDER), "Only == and != allowed for strings"), "string order message");
+static_assert(expected::sameText(binaryError(BinaryRule::COMPARE_MISMATCH), "Type mismatch in comparison"), "comparison message");
+static_assert(expected::sameText(binaryError(BinaryRule::NOT_AN_OPERATOR), "Unknown binary operator"), "operator message");
+
+// the number rules, every operator once for each type
+static_assert(arithmetic<int>(TokenTypes::PLUS, 7, 2) == 9 && arithmetic<double>(TokenTypes::PLUS, 7.5, 2.0) == 9.5, "+");
+static_assert(arithmetic<int>(TokenTypes::MINUS, 2, 7) == -5 && arithmetic<double>(TokenTypes::MINUS, 2.0, 7.5) == -5.5, "-");
+static_assert(arithmetic<int>(TokenTypes::ASTERISK, 6, 7) == 42 && arithmetic<double>(TokenTypes::ASTERISK, 1.5, 3.0) == 4.5, "*");
+static_assert(arithmetic<int>(TokenTypes::SLASH, -7, 2) == -3, "int division truncates");
+static_assert(arithmetic<double>(TokenTypes::SLASH, 7.0, 2.0) == 3.5, "double division");
+static_assert(arithmetic<int>(TokenTypes::MODULUS, -7, 2) == -1, "remainder takes the left sign");
+static_assert(comparison<int>(TokenTypes::EQUAL_EQUAL, 2, 2) == 1 && comparison<double>(TokenTypes::EQUAL_EQUAL, 2.0, 2.5) == 0, "==");
+static_assert(comparison<int>(TokenTypes::NOT_EQUAL, 2, 2) == 0 && comparison<double>(TokenTypes::NOT_EQUAL, 2.0, 2.5) == 1, "!=");
+static_assert(comparison<int>(TokenTypes::GREATER, 3, 2) == 1 && comparison<double>(TokenTypes::GREATER, 2.0, 2.0) == 0, ">");
+static_assert(comparison<int>(TokenTypes::LESSER, 3, 2) == 0 && comparison<double>(TokenTypes::LESSER, 2.5, 2.0) == 0, "<");
+static_assert(comparison<int>(TokenTypes::GREATER_EQUAL, 2, 2) == 1 && comparison<double>(TokenTypes::GREATER_EQUAL, 1.5, 2.0) == 0, ">=");
+static_assert(comparison<int>(TokenTypes::LESSER_EQUAL, 2, 2) == 1 && comparison<double>(TokenTypes::LESSER_EQUAL, 2.5, 2.0) == 0, "<=");
+static_assert(numericOp<int>(TokenTypes::ASTERISK, 6, 7) == 42 && numericOp<int>(TokenTypes::LESSER, 6, 7) == 1,
+              "numericOp does both");
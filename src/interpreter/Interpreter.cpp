@@ -1,364 +1,1275 @@
-#include "Interpreter.h"
-#include <iostream>
-#include <type_traits>
-#include <stdexcept>
-#include <sstream>    
-#include <cmath>  
-
-struct BreakSignal {};
-
-void Interpreter::interpret(const std::vector<std::unique_ptr<Stmt>>& program) {
-    try {
-        for (const auto& stmt : program) {
-            execute(stmt.get());
-        }
-    } catch (BreakSignal&) {
-        throw std::runtime_error("break used outside of a loop");
-    }
-}
-
-static bool isIntValue(const Value& v) {
-    return std::holds_alternative<int>(v);
-}
-static bool isDoubleValue(const Value& v) {
-    return std::holds_alternative<double>(v);
-}
-static bool isStringValue(const Value& v) {
-    return std::holds_alternative<std::string>(v);
-}
-
-static double toDouble(const Value& v) {
-    if (std::holds_alternative<double>(v)) return std::get<double>(v);
-    if (std::holds_alternative<int>(v)) return static_cast<double>(std::get<int>(v));
-    throw std::runtime_error("Value is not numeric");
-}
-
-static int toIntChecked(const Value& v) {
-    if (std::holds_alternative<int>(v)) return std::get<int>(v);
-    if (std::holds_alternative<double>(v)) return static_cast<int>(std::get<double>(v));
-    throw std::runtime_error("Value is not numeric");
-}
-
-void Interpreter::execute(const Stmt* stmt) {
-
-
-    // block systems
-    if (auto block = dynamic_cast<const BlockStmt*>(stmt)) {
-        for (const auto& s : block->statements) {
-            execute(s.get());
-        }
-        return;
-    }
-   //break statement
-    if (dynamic_cast<const BreakStmt*>(stmt)) {
-    throw BreakSignal{};
-    return;
-}
-
-
-    // if (condition)
-    if (auto ifStmt = dynamic_cast<const IfStmt*>(stmt)) {
-        Value condVal = evaluate(ifStmt->condition.get());
-
-        bool condTrue = false;
-        if (isIntValue(condVal)) {
-            condTrue = (std::get<int>(condVal) != 0);
-        } else if (isDoubleValue(condVal)) {
-            condTrue = (std::get<double>(condVal) != 0.0);
-        } else {
-            throw std::runtime_error("If condition must be a number (int or float)");
-        }
-
-        if (condTrue) {
-            for (const auto& s : ifStmt->thenBody) {
-                execute(s.get());
-            }
-        } else {
-            for (const auto& s : ifStmt->elseBody) {
-                execute(s.get());
-            }
-        }
-        return;
-    }
-
-    // while (condition) 
-    if (auto whileStmt = dynamic_cast<const WhileStmt*>(stmt)) {
-        while (true) {
-            Value condVal = evaluate(whileStmt->condition.get());
-
-            if (!std::holds_alternative<int>(condVal)) {
-                throw std::runtime_error("While condition must be an integer");
-            }
-
-            if (std::get<int>(condVal) == 0) break;
-
-            try {
-                for (const auto& s : whileStmt->body) {
-                    execute(s.get());
-                }
-            } catch (BreakSignal&) {
-                break;
-            }
-    }
-    return;
-}
-
-
-    // out(expression) to print things to the terminl;
-    if (auto printStmt = dynamic_cast<const PrintStmt*>(stmt)) {
-        Value val = evaluate(printStmt->expression.get());
-
-        std::visit([](auto&& arg) {
-    using T = std::decay_t<decltype(arg)>;
-
-    if constexpr (std::is_same_v<T, double>) {
-        if (arg == static_cast<long long>(arg)) {
-            std::cout << arg << ".0";
-        } else {
-            std::cout << arg;
-        }
-    } else {
-        std::cout << arg;
-    }}, val);
-
-
-        std::cout << std::endl;
-        return;
-    }
-
-    // in(identifier) this is for inputting
-    if (auto inputStmt = dynamic_cast<const InputStmt*>(stmt)) {
-        std::string input;
-        std::getline(std::cin, input);
-
-        // handle leftover newline
-        if (input.empty() && std::cin.good()) {
-            std::getline(std::cin, input);
-        }
-        env[inputStmt->name] = input;
-        return;
-    }
-
-    // assignment
-    if (auto assignStmt = dynamic_cast<const AssignStmt*>(stmt)) {
-        Value val = evaluate(assignStmt->expression.get());
-        env[assignStmt->name] = val;
-        return;
-    }
-
-    throw std::runtime_error("Unknown statement type");
-}
-
-Value Interpreter::evaluate(const Expr* expr) {
-     if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
-        return lit->val;
-    }
-
-    if (auto s = dynamic_cast<const StringExpr*>(expr)) {
-        return s->val;
-    }
-
-
-    // Variable managements
-    if (auto var = dynamic_cast<const VariableExpr*>(expr)) {
-        if (env.count(var->n) == 0) {
-            throw std::runtime_error("Undefined variable: " + var->n);
-        }
-        return env[var->n];
-    }
-
-    // Binary expression [handls all binary operations]
-    if (auto bin = dynamic_cast<const BinaryExpr*>(expr)) {
-        Value left = evaluate(bin->left.get());
-        Value right = evaluate(bin->right.get());
-
-        // PLUS: int+int OR string+string OR numeric promotion to double
-        if (bin->op == TokenTypes::PLUS) {
-            // both ints
-            if (isIntValue(left) && isIntValue(right)) {
-                return std::get<int>(left) + std::get<int>(right);
-            }
-
-            // both strings
-            if (isStringValue(left) && isStringValue(right)) {
-                return std::get<std::string>(left) + std::get<std::string>(right);
-            }
-
-            // numeric promotion: if both numeric but one is double -> double result
-            if ((isIntValue(left) || isDoubleValue(left)) &&
-                (isIntValue(right) || isDoubleValue(right))) {
-
-                if (isDoubleValue(left) || isDoubleValue(right)) {
-                    double l = toDouble(left);
-                    double r = toDouble(right);
-                    return l + r;
-                } else { // both int handled earlier, but keep safe
-                    return std::get<int>(left) + std::get<int>(right);
-                }
-            }
-
-            throw std::runtime_error("Type error: '+' requires operands of same type or both numeric");
-        }
-
-        // Arithmetic operations (-, *, /, %)
-        if (bin->op == TokenTypes::MINUS ||
-            bin->op == TokenTypes::ASTERISK ||
-            bin->op == TokenTypes::SLASH ||
-            bin->op == TokenTypes::MODULUS) {
-
-            // checking for vlidity
-            if (!((isIntValue(left) || isDoubleValue(left)) &&
-                  (isIntValue(right) || isDoubleValue(right)))) {
-                throw std::runtime_error("Arithmetic operators require numbers");
-            }
-
-            // if either is double --> do double math
-            if (isDoubleValue(left) || isDoubleValue(right)) {
-                double l = toDouble(left);
-                double r = toDouble(right);
-
-                switch (bin->op) {
-                    case TokenTypes::MINUS:    return l - r;
-                    case TokenTypes::ASTERISK: return l * r;
-                    case TokenTypes::SLASH:
-                        if (r == 0.0) throw std::runtime_error("Division by zero");
-                        return l / r;
-                    case TokenTypes::MODULUS:
-                        throw std::runtime_error("Modulo not supported for floats");
-                    default: break;
-                }
-            } else {
-                // both ints -> integer arithmetic
-                int l = std::get<int>(left);
-                int r = std::get<int>(right);
-
-                switch (bin->op) {
-                    case TokenTypes::MINUS:    return l - r;
-                    case TokenTypes::ASTERISK: return l * r;
-                    case TokenTypes::SLASH:
-                        if (r == 0) throw std::runtime_error("Division by zero");
-                        return l / r; // integer division
-                    case TokenTypes::MODULUS:
-                        if (r == 0) throw std::runtime_error("Modulo by zero");
-                        return l % r;
-                    default: break;
-                }
-            }
-        }
-
-        // Comparisons (return 1 or 0) --> boolean is still not integrated
-    
-        if (bin->op == TokenTypes::EQUAL_EQUAL ||
-            bin->op == TokenTypes::NOT_EQUAL ||
-            bin->op == TokenTypes::GREATER ||
-            bin->op == TokenTypes::LESSER ||
-            bin->op == TokenTypes::GREATER_EQUAL ||
-            bin->op == TokenTypes::LESSER_EQUAL) {
-
-            // Numeric comparisons (ints or doubles)
-            if ((isIntValue(left) || isDoubleValue(left)) &&
-                (isIntValue(right) || isDoubleValue(right))) {
-
-                // force double to be higherarche
-                if (isDoubleValue(left) || isDoubleValue(right)) {
-                    double l = toDouble(left);
-                    double r = toDouble(right);
-
-                    switch (bin->op) {
-                        case TokenTypes::EQUAL_EQUAL:   return (l == r) ? 1 : 0;
-                        case TokenTypes::NOT_EQUAL:     return (l != r) ? 1 : 0;
-                        case TokenTypes::GREATER:       return (l >  r) ? 1 : 0;
-                        case TokenTypes::LESSER:        return (l <  r) ? 1 : 0;
-                        case TokenTypes::GREATER_EQUAL: return (l >= r) ? 1 : 0;
-                        case TokenTypes::LESSER_EQUAL:  return (l <= r) ? 1 : 0;
-                        default: break;
-                    }
-                } else {
-                    int l = std::get<int>(left);
-                    int r = std::get<int>(right);
-
-                    switch (bin->op) {
-                        case TokenTypes::EQUAL_EQUAL:   return (l == r) ? 1 : 0;
-                        case TokenTypes::NOT_EQUAL:     return (l != r) ? 1 : 0;
-                        case TokenTypes::GREATER:       return (l >  r) ? 1 : 0;
-                        case TokenTypes::LESSER:        return (l <  r) ? 1 : 0;
-                        case TokenTypes::GREATER_EQUAL: return (l >= r) ? 1 : 0;
-                        case TokenTypes::LESSER_EQUAL:  return (l <= r) ? 1 : 0;
-                        default: break;
-                    }
-                }
-            }
-
-            // string equality checking things
-            if (isStringValue(left) && isStringValue(right)) {
-                const std::string& l = std::get<std::string>(left);
-                const std::string& r = std::get<std::string>(right);
-
-                if (bin->op == TokenTypes::EQUAL_EQUAL) {
-                    return (l == r) ? 1 : 0;
-                }
-                if (bin->op == TokenTypes::NOT_EQUAL) {
-                    return (l != r) ? 1 : 0;
-                }
-
-                throw std::runtime_error("Only == and != allowed for strings");
-            }
-
-            throw std::runtime_error("Type mismatch in comparison");
-        }
-
-        throw std::runtime_error("Unknown binary operator");
-    }
-
-    if (auto call = dynamic_cast<const CallExpr*>(expr)) {
-        Value arg = evaluate(call->argument.get());
-
-        // toString(expr)
-        if (call->callee == "toString") {
-            if (isIntValue(arg)) {
-                return std::to_string(std::get<int>(arg));
-            }
-            if (isDoubleValue(arg)) {
-                return std::to_string(std::get<double>(arg));
-            }
-            if (isStringValue(arg)) {
-                return arg;
-            }
-            throw std::runtime_error("toString: unsupported type");
-        }
-
-        // toNum(expr) -> try to parse as double, return int if whole number
-        if (call->callee == "toNum") {
-            if (isIntValue(arg) || isDoubleValue(arg)) {
-                return arg;
-            }
-            if (isStringValue(arg)) {
-                const std::string& s = std::get<std::string>(arg);
-                try {
-                    double dv = std::stod(s);
-                    double iv = std::floor(dv);
-                    if (dv == iv) {
-                        return static_cast<int>(iv);
-                    } else {
-                        return dv;
-                    }
-                } catch (...) {
-                    throw std::runtime_error("toNum: cannot convert \"" + s + "\" to number");
-                }
-            }
-            throw std::runtime_error("toNum: unsupported type");
-        }
-
-        // input() as expression
-        if (call->callee == "input") {
-            std::string s;
-            std::getline(std::cin, s);
-            if (s.empty() && std::cin.good()) std::getline(std::cin, s);
-            return s;
-        }
-
-        throw std::runtime_error("Unknown function: " + call->callee);
-    }
-
-    throw std::runtime_error("Unknown expression type");
-}
+#include "Interpreter.h"
+#include <iostream>
+#include <type_traits>
+#include <stdexcept>
+#include <sstream>    
+#include <cmath>  
+#include <algorithm>
+#include <climits>
+#include <array>
+#include <utility>
+
+#include "BinaryOps.h"
+#include "../optimizer/Superinstructions.h"
+#include "../parser/Parser.h"
+#include "../runtime/Builtins.h"
+#include "../runtime/FileIO.h"
+#include "../runtime/NumberFormat.h"
+#include "../runtime/Snapshot.h"
+#include "../runtime/StackGuard.h"
+#include "../runtime/StringOps.h"
+
+struct BreakSignal {};
+
+// how many steps may pass between two clock reads
+static const long long CHECK_INTERVAL = 4096;
+
+// the parser caps how deep a tree can be, but not every thread has the
+// stack for that many levels {see runtime/StackGuard.h}
+static void checkStack() {
+    if (stackLow()) throw std::runtime_error("Expression nested too deeply for the stack");
+}
+
+void Interpreter::interpret(const std::vector<std::unique_ptr<Stmt>>& program, size_t from) {
+    startBudgets();
+    try {
+        for (size_t i = from; i < program.size(); i++) {
+            topStmt = program[i].get();
+            topIndex = i;
+            execute(topStmt);
+        }
+    } catch (BreakSignal&) {
+        throw std::runtime_error("break used outside of a loop");
+    }
+    // the program is over when its last task is
+    tasks.finish();
+    files.flushAll();
+}
+
+static bool isIntValue(const Value& v) {
+    return std::holds_alternative<int>(v);
+}
+static bool isDoubleValue(const Value& v) {
+    return std::holds_alternative<double>(v);
+}
+static bool isStringValue(const Value& v) {
+    return std::holds_alternative<std::string>(v);
+}
+
+static size_t stringBytes(const Value& v) {
+    if (auto str = std::get_if<std::string>(&v)) return str->size();
+    return 0;
+}
+
+// could evaluating this read a line or close a file; no recursion, the
+// tree can be as deep as the parser allows
+static bool hasCall(const Expr* expr) {
+    if (dynamic_cast<const CallExpr*>(expr)) return true;
+    if (!dynamic_cast<const BinaryExpr*>(expr) && !dynamic_cast<const TypedBinaryExpr*>(expr)) return false;
+
+    std::vector<const Expr*> pending{expr};
+    while (!pending.empty()) {
+        const Expr* e = pending.back();
+        pending.pop_back();
+        if (dynamic_cast<const CallExpr*>(e)) return true;
+        if (auto bin = dynamic_cast<const BinaryExpr*>(e)) {
+            pending.push_back(bin->left.get());
+            pending.push_back(bin->right.get());
+        } else if (auto typed = dynamic_cast<const TypedBinaryExpr*>(e)) {
+            pending.push_back(typed->left.get());
+            pending.push_back(typed->right.get());
+        }
+    }
+    return false;
+}
+
+static int toIntChecked(const Value& v) {
+    if (std::holds_alternative<int>(v)) return std::get<int>(v);
+    if (std::holds_alternative<double>(v)) return static_cast<int>(std::get<double>(v));
+    throw std::runtime_error("Value is not numeric");
+}
+
+void Interpreter::useSlots(const TypeReport& types) {
+    intSlots.assign(types.intSlots, 0);
+    doubleSlots.assign(types.doubleSlots, 0.0);
+    slotVars.clear();
+    for (const auto& v : types.vars) {
+        if (v.slotted) slotVars.push_back(v);
+    }
+}
+
+void Interpreter::useStreams(std::istream& input, std::ostream& output) {
+    in = &input;
+    out = &output;
+}
+
+// everything one run leaves behind; the containers keep their memory
+void Interpreter::reset() {
+    tasks.reset();
+    env.clear();
+    heapBytes = 0;
+    files.reset();
+    splitCursor.source = nullptr;
+    record.number = 0;
+    record.split = false;
+    source = nullptr;
+    topStmt = nullptr;
+    topIndex = 0;
+}
+
+// ===== snapshots =====
+
+// x = snapshot(path): the program and every variable, so a later run can
+// go on from the next statement. Loops and ifs cannot be resumed in the
+// middle, so it has to be a whole top-level statement.
+void Interpreter::takeSnapshot(const CallExpr* call, const std::string& path) {
+    std::string target;
+    if (auto assign = dynamic_cast<const AssignStmt*>(topStmt)) {
+        if (assign->expression.get() == call) target = assign->name;
+    } else if (auto slotAssign = dynamic_cast<const SlotAssignStmt*>(topStmt)) {
+        if (slotAssign->expression.get() == call) target = slotAssign->name;
+    }
+    if (target.empty()) {
+        throw std::runtime_error("snapshot: only works as `x = snapshot(path);` outside loops and ifs");
+    }
+    if (!source) throw std::runtime_error("snapshot: the program text is not available");
+    if (files.openCount() != 0) throw std::runtime_error("snapshot: close open files first");
+    if (tasks.live() != 0) throw std::runtime_error("snapshot: spawned tasks are still running");
+    files.flushAll();
+
+    Snapshot snap;
+    snap.source = *source;
+    snap.resumeAt = topIndex + 1;
+    for (const auto& v : env) {
+        if (v.first != target) snap.vars.emplace_back(v.first, v.second);
+    }
+    for (const auto& v : slotVars) {
+        if (v.name == target) continue;
+        if (v.kind == NumKind::INT) snap.vars.emplace_back(v.name, intSlots[v.slot]);
+        else snap.vars.emplace_back(v.name, doubleSlots[v.slot]);
+    }
+    // the run that picks up from the file sees 1
+    snap.vars.emplace_back(target, 1);
+
+    writeSnapshot(path, snap);
+}
+
+void Interpreter::restore(const Snapshot& snap) {
+    std::unordered_map<std::string, const TypedVar*> slotted;
+    for (const auto& v : slotVars) slotted[v.name] = &v;
+
+    for (const auto& v : snap.vars) {
+        auto it = slotted.find(v.first);
+        if (it == slotted.end()) {
+            store(v.first, v.second);
+            continue;
+        }
+        const TypedVar* slot = it->second;
+        if (slot->kind == NumKind::INT && isIntValue(v.second)) {
+            intSlots[slot->slot] = std::get<int>(v.second);
+        } else if (slot->kind == NumKind::DOUBLE && isDoubleValue(v.second)) {
+            doubleSlots[slot->slot] = std::get<double>(v.second);
+        } else {
+            throw std::runtime_error("snapshot does not match the program: " + v.first);
+        }
+    }
+}
+
+// ===== execution budgets =====
+
+void Interpreter::startBudgets() {
+    stepsUsed = 0;
+    iterations = 0;
+    budget = budgetGranted = 0;
+    // main rejects longer ones, but Limits can come from elsewhere
+    long long ms = std::min(limits.timeoutMs, MAX_TIMEOUT_MS);
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    refillBudget();
+}
+
+// called on every loop back-edge, weight is the number of statements the
+// iteration ran; the common path is a single subtract and compare
+void Interpreter::chargeLoop(size_t weight) {
+    iterations++;
+    budget -= static_cast<long long>(weight);
+    if (budget <= 0) refillBudget();
+}
+
+void Interpreter::refillBudget() {
+    stepsUsed += static_cast<unsigned long long>(budgetGranted - budget);
+
+    if (limits.maxSteps != 0 && stepsUsed > limits.maxSteps) {
+        throw LimitExceeded(LimitKind::STEPS,
+            "step limit of " + std::to_string(limits.maxSteps) + " exceeded");
+    }
+    if (limits.timeoutMs != 0 && std::chrono::steady_clock::now() >= deadline) {
+        throw LimitExceeded(LimitKind::TIME,
+            "time limit of " + std::to_string(limits.timeoutMs) + " ms exceeded");
+    }
+
+    long long grant = CHECK_INTERVAL;
+    if (limits.maxSteps != 0) {
+        // one past what is left, so running out lands exactly on the limit
+        unsigned long long left = limits.maxSteps - stepsUsed + 1;
+        if (left < static_cast<unsigned long long>(grant)) grant = static_cast<long long>(left);
+    }
+    budget = budgetGranted = grant;
+}
+
+// refuse to create `bytes` more string data if it would go over the cap
+void Interpreter::chargeHeap(size_t bytes) const {
+    if (limits.maxHeapBytes == 0) return;
+    if (bytes > limits.maxHeapBytes || heapBytes > limits.maxHeapBytes - bytes) {
+        throw LimitExceeded(LimitKind::MEMORY,
+            "memory limit of " + std::to_string(limits.maxHeapBytes) + " bytes exceeded");
+    }
+}
+
+// every write to env goes through here so string bytes stay accounted
+void Interpreter::store(const std::string &name, Value val) {
+    if (limits.maxHeapBytes == 0) {
+        Value& slot = env[name];
+        slot = std::move(val);
+        wrote(slot);
+        return;
+    }
+
+    auto it = env.find(name);
+    size_t oldBytes = (it == env.end()) ? 0 : stringBytes(it->second);
+    size_t newBytes = stringBytes(val);
+
+    heapBytes -= oldBytes;
+    try {
+        chargeHeap(newBytes);
+    } catch (...) {
+        heapBytes += oldBytes;
+        throw;
+    }
+    heapBytes += newBytes;
+
+    if (it == env.end()) {
+        env.emplace(name, std::move(val));
+    } else {
+        it->second = std::move(val);
+        wrote(it->second);
+    }
+}
+
+// fused `a < b` condition; returns false (and leaves result alone) when an
+// operand is missing or not an int so the caller takes the generic path
+bool Interpreter::compareInts(const CompareVarsExpr* cmp, bool& result) {
+    auto l = env.find(cmp->left);
+    if (l == env.end()) return false;
+    const int* lv = std::get_if<int>(&l->second);
+    if (!lv) return false;
+
+    int r = cmp->rightConst;
+    if (!cmp->right.empty()) {
+        auto it = env.find(cmp->right);
+        if (it == env.end()) return false;
+        const int* rv = std::get_if<int>(&it->second);
+        if (!rv) return false;
+        r = *rv;
+    }
+
+    switch (cmp->op) {
+        case TokenTypes::EQUAL_EQUAL:   result = *lv == r; break;
+        case TokenTypes::NOT_EQUAL:     result = *lv != r; break;
+        case TokenTypes::GREATER:       result = *lv >  r; break;
+        case TokenTypes::LESSER:        result = *lv <  r; break;
+        case TokenTypes::GREATER_EQUAL: result = *lv >= r; break;
+        case TokenTypes::LESSER_EQUAL:  result = *lv <= r; break;
+        default: return false;
+    }
+    return true;
+}
+
+// s = s + expr on a string: append to the stored string instead of
+// building a new one. false when the statement does not have that shape.
+bool Interpreter::appendInPlace(const AssignStmt* assign) {
+    auto bin = dynamic_cast<const BinaryExpr*>(assign->expression.get());
+    if (!bin || bin->op != TokenTypes::PLUS) return false;
+    auto var = dynamic_cast<const VariableExpr*>(bin->left.get());
+    if (!var || var->n != assign->name) return false;
+
+    auto it = env.find(var->n);
+    if (it == env.end() || !isStringValue(it->second)) return false;
+
+    // right side runs once. Another task may add variables while it waits
+    // on a channel, which can move iterators but not references, and may
+    // store something else in this one
+    Value& stored = it->second;
+    Value scratch;
+    const Value& right = evaluate(bin->right.get(), scratch);
+    if (!isStringValue(right) || !isStringValue(stored)) {
+        store(assign->name, binaryOp(bin->op, stored, right)); // or the usual type error
+        return true;
+    }
+
+    std::string& l = std::get<std::string>(stored);
+    const std::string& r = std::get<std::string>(right);
+    chargeHeap(l.size() + r.size());
+    if (limits.maxHeapBytes != 0) heapBytes += r.size();
+    l += r;
+    wrote(stored);
+    return true;
+}
+
+void Interpreter::execute(const Stmt* stmt) {
+    if (profileShapes) countShape(stmt);
+    if (position) position->current.store(stmt, std::memory_order_relaxed);
+
+    // variable kept unboxed by the type pass
+    if (auto slotAssign = dynamic_cast<const SlotAssignStmt*>(stmt)) {
+        if (slotAssign->kind == NumKind::INT) {
+            intSlots[slotAssign->slot] = evalInt(slotAssign->expression.get());
+        } else {
+            doubleSlots[slotAssign->slot] = evalDouble(slotAssign->expression.get());
+        }
+        return;
+    }
+
+    // ===== fused statements =====
+
+    // x = x + k
+    if (auto inc = dynamic_cast<const IncrementStmt*>(stmt)) {
+        auto it = env.find(inc->name);
+        if (it != env.end()) {
+            if (int* v = std::get_if<int>(&it->second)) {
+                *v = *v + inc->delta;
+                return;
+            }
+        }
+        execute(inc->original.get());
+        return;
+    }
+
+    // x = y
+    if (auto copy = dynamic_cast<const CopyStmt*>(stmt)) {
+        auto src = env.find(copy->src);
+        if (src == env.end()) {
+            throw std::runtime_error("Undefined variable: " + copy->src);
+        }
+        // references into env survive a rehash, iterators do not
+        const Value& val = src->second;
+        if (limits.maxHeapBytes == 0) {
+            Value& dst = env[copy->dst];
+            dst = val;
+            wrote(dst);
+        } else {
+            store(copy->dst, val);
+        }
+        return;
+    }
+
+    // block systems
+    if (auto block = dynamic_cast<const BlockStmt*>(stmt)) {
+        for (const auto& s : block->statements) {
+            execute(s.get());
+        }
+        return;
+    }
+
+    if (auto lazy = dynamic_cast<const LazyBlockStmt*>(stmt)) {
+        for (const auto& s : lazyBody(lazy)) execute(s.get());
+        return;
+    }
+   //break statement
+    if (dynamic_cast<const BreakStmt*>(stmt)) {
+    throw BreakSignal{};
+    return;
+}
+
+
+    // if (condition)
+    if (auto ifStmt = dynamic_cast<const IfStmt*>(stmt)) {
+        bool condTrue = false;
+        auto typed = dynamic_cast<const TypedBinaryExpr*>(ifStmt->condition.get());
+        auto fused = dynamic_cast<const CompareVarsExpr*>(ifStmt->condition.get());
+
+        if (typed) {
+            condTrue = typed->result == NumKind::INT ? evalInt(typed) != 0 : evalDouble(typed) != 0.0;
+        } else if (!fused || !compareInts(fused, condTrue)) {
+            Value scratch;
+            const Value& condVal = evaluate(ifStmt->condition.get(), scratch);
+
+            if (isIntValue(condVal)) {
+                condTrue = (std::get<int>(condVal) != 0);
+            } else if (isDoubleValue(condVal)) {
+                condTrue = (std::get<double>(condVal) != 0.0);
+            } else {
+                throw std::runtime_error("If condition must be a number (int or float)");
+            }
+        }
+
+        if (position) position->enter(ifStmt);
+        if (condTrue) {
+            for (const auto& s : ifStmt->thenBody) {
+                execute(s.get());
+            }
+        } else {
+            for (const auto& s : ifStmt->elseBody) {
+                execute(s.get());
+            }
+        }
+        if (position) position->leave();
+        return;
+    }
+
+    // while (condition) 
+    if (auto whileStmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        auto typed = dynamic_cast<const TypedBinaryExpr*>(whileStmt->condition.get());
+        auto fused = dynamic_cast<const CompareVarsExpr*>(whileStmt->condition.get());
+        // a double condition still has to fail the generic check below
+        if (typed && typed->result != NumKind::INT) typed = nullptr;
+
+        size_t outer = 0;
+        if (position) {
+            outer = position->depth.load(std::memory_order_relaxed);
+            position->enter(whileStmt);
+        }
+
+        while (true) {
+            bool condTrue = false;
+            if (position) position->current.store(whileStmt, std::memory_order_relaxed);
+
+            if (typed) {
+                condTrue = evalInt(typed) != 0;
+            } else if (!fused || !compareInts(fused, condTrue)) {
+                Value scratch;
+                const Value& condVal = evaluate(whileStmt->condition.get(), scratch);
+
+                if (!std::holds_alternative<int>(condVal)) {
+                    throw std::runtime_error("While condition must be an integer");
+                }
+                condTrue = std::get<int>(condVal) != 0;
+            }
+
+            if (!condTrue) break;
+
+            try {
+                for (const auto& s : whileStmt->body) {
+                    execute(s.get());
+                }
+            } catch (BreakSignal&) {
+                break;
+            }
+
+            // back-edge: charge the condition plus the body
+            chargeLoop(whileStmt->body.size() + 1);
+    }
+    // also drops any ifs a break jumped out of
+    if (position) position->unwindTo(outer);
+    return;
+}
+
+
+    // for (init; condition; update)
+    if (auto counted = dynamic_cast<const CountedForStmt*>(stmt)) {
+        runCountedFor(counted);
+        return;
+    }
+    if (auto forStmt = dynamic_cast<const ForStmt*>(stmt)) {
+        execute(forStmt->init.get());
+        runFor(forStmt, forStmt);
+        return;
+    }
+
+    // --each-line: the program body once per input line
+    if (auto each = dynamic_cast<const EachLineStmt*>(stmt)) {
+        runRecords(each);
+        return;
+    }
+
+    // out(expression) to print things to the terminl;
+    if (auto printStmt = dynamic_cast<const PrintStmt*>(stmt)) {
+        Value scratch;
+        const Value& val = evaluate(printStmt->expression.get(), scratch);
+
+        std::visit([this](auto&& arg) {
+    using T = std::decay_t<decltype(arg)>;
+
+    if constexpr (std::is_same_v<T, double>) {
+        *out << formatDouble(arg);
+    } else if constexpr (std::is_same_v<T, int>) {
+        *out << formatInt(arg);
+    } else {
+        *out << arg;
+    }}, val);
+
+
+        // no flush: reading input and exiting flush, and --each-line
+        // output would otherwise be one write per line
+        *out << '\n';
+        return;
+    }
+
+    // in(identifier) this is for inputting
+    if (auto inputStmt = dynamic_cast<const InputStmt*>(stmt)) {
+        if (recordMode) throw std::runtime_error("in: standard input holds the records with --each-line");
+        std::string input;
+        readInput(input);
+        store(inputStmt->name, std::move(input));
+        return;
+    }
+
+    // spawn { ... }: the body starts once this task waits for something
+    if (auto spawn = dynamic_cast<const SpawnStmt*>(stmt)) {
+        tasks.spawn([this, spawn]() {
+            for (const auto& s : spawn->body) {
+                execute(s.get());
+            }
+        }, spawn);
+        return;
+    }
+
+    // assignment
+    if (auto assignStmt = dynamic_cast<const AssignStmt*>(stmt)) {
+        if (appendInPlace(assignStmt)) return;
+
+        Value scratch;
+        const Value& val = evaluate(assignStmt->expression.get(), scratch);
+        // temporaries are moved in, borrowed values copied once (into the
+        // existing string's buffer when it is big enough)
+        if (&val == &scratch) store(assignStmt->name, std::move(scratch));
+        else if (limits.maxHeapBytes == 0) {
+            Value& dst = env[assignStmt->name];
+            dst = val;
+            wrote(dst);
+        } else {
+            store(assignStmt->name, val);
+        }
+        return;
+    }
+
+    throw std::runtime_error("Unknown statement type");
+}
+
+// Borrowing evaluation: literals and variables come back as references to
+// the stored Value, so reading a string copies nothing. Computed results
+// are built in `scratch`, which the caller owns and may move from.
+// Never returns a reference to one of its own locals.
+const Value& Interpreter::evaluate(const Expr* expr, Value& scratch) {
+    if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
+        return lit->val;
+    }
+
+    if (auto s = dynamic_cast<const StringExpr*>(expr)) {
+        return s->value;
+    }
+
+    // fused condition used outside an if/while fast path
+    if (auto cmp = dynamic_cast<const CompareVarsExpr*>(expr)) {
+        return evaluate(cmp->original.get(), scratch);
+    }
+
+    // Variable managements
+    if (auto var = dynamic_cast<const VariableExpr*>(expr)) {
+        auto it = env.find(var->n);
+        if (it == env.end()) {
+            throw std::runtime_error("Undefined variable: " + var->n);
+        }
+        return it->second;
+    }
+
+    // Binary expression [handls all binary operations]
+    if (auto bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        checkStack();
+        Value leftScratch, rightScratch;
+        unsigned long long epoch = fileEpoch;
+        const Value* leftPtr = &evaluate(bin->left.get(), leftScratch);
+        // readLine(h) + readLine(h): keep the first line before the second overwrites it
+        if (epoch != fileEpoch && leftPtr != &leftScratch && hasCall(bin->right.get())) {
+            leftScratch = *leftPtr;
+            leftPtr = &leftScratch;
+        }
+        const Value& left = *leftPtr;
+        const Value& right = evaluate(bin->right.get(), rightScratch);
+
+        // "a" + b + c: the left side is already a temporary, grow it in place
+        if (bin->op == TokenTypes::PLUS && &left == &leftScratch &&
+            isStringValue(left) && isStringValue(right)) {
+            std::string& l = std::get<std::string>(leftScratch);
+            const std::string& r = std::get<std::string>(right);
+            chargeHeap(l.size() + r.size());
+            l += r;
+            return scratch = std::move(leftScratch);
+        }
+
+        return scratch = binaryOp(bin->op, left, right);
+    }
+
+    if (auto call = dynamic_cast<const CallExpr*>(expr)) {
+        checkStack();
+        return callBuiltin(call, scratch);
+    }
+
+    if (auto rec = dynamic_cast<const RecordExpr*>(expr)) {
+        return recordValue(rec, scratch);
+    }
+
+    // unboxed variable or operator, see TypeInference.h; only reached
+    // where a typed expression meets generic code (out(i), toString(x))
+    if (auto slot = dynamic_cast<const SlotExpr*>(expr)) {
+        if (slot->kind == NumKind::INT) return scratch = intSlots[slot->slot];
+        return scratch = doubleSlots[slot->slot];
+    }
+    if (auto typed = dynamic_cast<const TypedBinaryExpr*>(expr)) {
+        if (typed->result == NumKind::INT) return scratch = evalInt(typed);
+        return scratch = evalDouble(typed);
+    }
+
+    throw std::runtime_error("Unknown expression type");
+}
+
+// ===== for loops =====
+
+// everything after the initializer; `self` is the statement the profiler
+// sees, the CountedForStmt when it gave up on its fast path
+void Interpreter::runFor(const ForStmt* loop, const Stmt* self) {
+    auto typed = dynamic_cast<const TypedBinaryExpr*>(loop->condition.get());
+    if (typed && typed->result != NumKind::INT) typed = nullptr;
+
+    size_t outer = 0;
+    if (position) {
+        outer = position->depth.load(std::memory_order_relaxed);
+        position->enter(self);
+    }
+
+    while (true) {
+        if (position) position->current.store(self, std::memory_order_relaxed);
+
+        if (typed) {
+            if (evalInt(typed) == 0) break;
+        } else {
+            Value scratch;
+            const Value& condVal = evaluate(loop->condition.get(), scratch);
+            if (!std::holds_alternative<int>(condVal)) {
+                throw std::runtime_error("For condition must be an integer");
+            }
+            if (std::get<int>(condVal) == 0) break;
+        }
+
+        try {
+            for (const auto& s : loop->body) {
+                execute(s.get());
+            }
+        } catch (BreakSignal&) {
+            break;
+        }
+
+        // back-edge: condition, update and body
+        chargeLoop(loop->body.size() + 2);
+        execute(loop->update.get());
+    }
+    if (position) position->unwindTo(outer);
+}
+
+static bool compareCounter(TokenTypes op, int i, int bound) {
+    switch (op) {
+        case TokenTypes::LESSER:        return i < bound;
+        case TokenTypes::LESSER_EQUAL:  return i <= bound;
+        case TokenTypes::GREATER:       return i > bound;
+        case TokenTypes::GREATER_EQUAL: return i >= bound;
+        case TokenTypes::EQUAL_EQUAL:   return i == bound;
+        default:                        return i != bound;
+    }
+}
+
+// the loop variable is stepped through a pointer to its int, no lookups
+// and no Values; the body cannot assign it, so the pointer stays good.
+// Anything that is not an int hands over to runFor at the same point.
+void Interpreter::runCountedFor(const CountedForStmt* counted) {
+    const ForStmt* loop = counted->original.get();
+    execute(loop->init.get());
+
+    int* counter = nullptr;
+    if (counted->slotted) {
+        counter = &intSlots[counted->slot];
+    } else {
+        counter = std::get_if<int>(&env.find(counted->var)->second);
+    }
+
+    // the bound has no calls, so evaluating it once more in runFor is harmless
+    Value scratch;
+    const Value* boundVal = &evaluate(counted->bound, scratch);
+    if (!counter || !isIntValue(*boundVal)) {
+        runFor(loop, counted);
+        return;
+    }
+    int bound = std::get<int>(*boundVal);
+
+    size_t outer = 0;
+    if (position) {
+        outer = position->depth.load(std::memory_order_relaxed);
+        position->enter(counted);
+    }
+
+    size_t weight = loop->body.size() + 2;
+    while (true) {
+        if (position) position->current.store(counted, std::memory_order_relaxed);
+
+        if (!counted->invariantBound) {
+            Value again;
+            boundVal = &evaluate(counted->bound, again);
+            if (!isIntValue(*boundVal)) {
+                if (position) position->unwindTo(outer);
+                runFor(loop, counted);
+                return;
+            }
+            bound = std::get<int>(*boundVal);
+        }
+        if (!compareCounter(counted->cmp, *counter, bound)) break;
+
+        try {
+            for (const auto& s : loop->body) {
+                execute(s.get());
+            }
+        } catch (BreakSignal&) {
+            break;
+        }
+
+        chargeLoop(weight);
+        // wraps like the generic i + k does in practice, without the UB
+        *counter = static_cast<int>(static_cast<unsigned>(*counter) + static_cast<unsigned>(counted->step));
+    }
+    if (position) position->unwindTo(outer);
+}
+
+// ===== --lazy-parse =====
+
+// parsed the first time the body runs; a syntax error in it is reported
+// then, and the next run tries again
+const std::vector<std::unique_ptr<Stmt>>& Interpreter::lazyBody(const LazyBlockStmt* lazy) {
+    std::call_once(lazy->parsed, [&]() {
+        Parser parser(*lazy->tokens, true);
+        lazy->body = parser.parseSkipped(*lazy);
+        if (fuseLazy) fuseSuperinstructions(lazy->body);
+    });
+    return lazy->body;
+}
+
+// ===== --each-line records =====
+
+void Interpreter::useRecords(const std::string& separator) {
+    recordMode = true;
+    fieldSeparator = separator;
+}
+
+// the body runs once per line of standard input; every other variable
+// keeps its value from one line to the next, like in awk
+void Interpreter::runRecords(const EachLineStmt* each) {
+    RecordReader input(0);
+    const char* text = nullptr;
+    size_t length = 0;
+
+    size_t outer = 0;
+    if (position) {
+        outer = position->depth.load(std::memory_order_relaxed);
+        position->enter(each);
+    }
+
+    // `line` and the fields are copied straight into their variables'
+    // strings instead of through execute() and recordValue; the pointers
+    // are taken at the first record (nothing is defined before it) and
+    // stay good because env never drops a variable
+    struct Bind { Value* dst; const RecordExpr* rec; };
+    std::vector<Bind> direct;
+    std::vector<const Stmt*> other;
+    bool bound = false;
+
+    size_t weight = each->bind.size() + each->body.size();
+    while (input.next(text, length)) {
+        if (position) position->current.store(each, std::memory_order_relaxed);
+
+        chargeHeap(length);
+        std::string& line = std::get<std::string>(record.line);
+        line.assign(text, length);
+        record.number = static_cast<int>(static_cast<unsigned>(record.number) + 1u);
+        record.split = false;
+
+        if (!bound) {
+            for (const auto& s : each->bind) {
+                auto assign = dynamic_cast<const AssignStmt*>(s.get());
+                auto rec = assign ? dynamic_cast<const RecordExpr*>(assign->expression.get()) : nullptr;
+                if (rec && limits.maxHeapBytes == 0 &&
+                    (rec->kind == RecordExpr::LINE || rec->kind == RecordExpr::FIELD)) {
+                    direct.push_back({ &env[assign->name], rec });
+                } else {
+                    other.push_back(s.get());
+                }
+            }
+            bound = true;
+        }
+
+        for (const Bind& b : direct) {
+            auto str = std::get_if<std::string>(b.dst);
+            if (!str) str = &b.dst->emplace<std::string>();
+            if (b.rec->kind == RecordExpr::LINE) {
+                str->assign(line);
+            } else {
+                if (!record.split) splitRecord();
+                size_t i = static_cast<size_t>(b.rec->field);
+                if (i > record.fields.size()) str->clear();
+                else str->assign(line, record.fields[i - 1].first, record.fields[i - 1].second);
+            }
+            wrote(*b.dst);
+        }
+        for (const Stmt* s : other) execute(s);
+        for (const auto& s : each->body) execute(s.get());
+        chargeLoop(weight);
+    }
+    if (position) position->unwindTo(outer);
+}
+
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// field bounds of the current line, once per line and only when asked
+void Interpreter::splitRecord() {
+    const std::string& line = std::get<std::string>(record.line);
+    auto& fields = record.fields;
+    fields.clear();
+    record.split = true;
+    if (line.empty()) return;
+
+    if (fieldSeparator.empty()) {
+        // runs of spaces and tabs, the ends ignored
+        size_t i = 0, n = line.size();
+        while (true) {
+            while (i < n && isBlank(line[i])) i++;
+            if (i == n) break;
+            size_t start = i;
+            while (i < n && !isBlank(line[i])) i++;
+            fields.emplace_back(start, i - start);
+        }
+        return;
+    }
+
+    size_t start = 0;
+    while (true) {
+        size_t at = findBytes(line, fieldSeparator, start);
+        if (at == NOT_FOUND) break;
+        fields.emplace_back(start, at - start);
+        start = at + fieldSeparator.size();
+    }
+    fields.emplace_back(start, line.size() - start);
+}
+
+// line and fields come back borrowed; the bind statements copy them into
+// the variables' existing buffers
+const Value& Interpreter::recordValue(const RecordExpr* rec, Value& scratch) {
+    switch (rec->kind) {
+    case RecordExpr::LINE:
+        return record.line;
+    case RecordExpr::NUMBER:
+        return scratch = record.number;
+    case RecordExpr::FIELD_COUNT:
+        if (!record.split) splitRecord();
+        return scratch = indexValue(record.fields.size());
+    default:
+        break;
+    }
+
+    if (!record.split) splitRecord();
+    size_t i = static_cast<size_t>(rec->field);
+    if (i > record.fields.size()) return noField;
+    if (record.fieldValues.size() < i) record.fieldValues.resize(i, std::string());
+
+    Value& v = record.fieldValues[i - 1];
+    const auto& f = record.fields[i - 1];
+    std::get<std::string>(v).assign(std::get<std::string>(record.line), f.first, f.second);
+    return v;
+}
+
+// ===== standard input =====
+
+// one line for in() and input(). While other tasks are around they run
+// until the line is there, instead of the whole thread waiting for it.
+void Interpreter::readInput(std::string& line) {
+    auto waitForLine = [this]() {
+        if (in == &std::cin && tasks.live() != 0) tasks.waitReadable(0, *in->rdbuf());
+    };
+    waitForLine();
+    std::getline(*in, line);
+
+    // handle leftover newline
+    if (line.empty() && in->good()) {
+        waitForLine();
+        std::getline(*in, line);
+    }
+}
+
+// ===== builtin functions =====
+
+static int handleArg(const std::string& fn, const Value& v) {
+    if (!isIntValue(v)) throw std::runtime_error(fn + ": expected a file handle");
+    return std::get<int>(v);
+}
+
+static int channelArg(const std::string& fn, const Value& v) {
+    if (!isIntValue(v)) throw std::runtime_error(fn + ": expected a channel");
+    return std::get<int>(v);
+}
+
+// the call was bound to its builtin and its argument count checked by the
+// parser {see runtime/Builtins.h}
+const Value& Interpreter::callBuiltin(const CallExpr* call, Value& scratch) {
+    size_t count = call->arguments.size();
+
+    Value argScratch[MAX_BUILTIN_ARGS];
+    const Value* args[MAX_BUILTIN_ARGS] = { nullptr, nullptr, nullptr };
+    for (size_t i = 0; i < count; i++) {
+        unsigned long long epoch = fileEpoch;
+        args[i] = &evaluate(call->arguments[i].get(), argScratch[i]);
+        // a line borrowed from a reader the next argument may advance
+        if (i + 1 < count && epoch != fileEpoch && args[i] != &argScratch[i] &&
+            hasCall(call->arguments[i + 1].get())) {
+            argScratch[i] = *args[i];
+            args[i] = &argScratch[i];
+        }
+    }
+
+    // input() and registered functions may take none
+    const Value& arg = count ? *args[0] : scratch;
+    bool argIsTemp = &arg == &argScratch[0];
+    const std::string& fn = call->callee;
+
+    switch (static_cast<BuiltinId>(call->builtin)) {
+    // input() as expression
+    case BuiltinId::INPUT: {
+        if (recordMode) throw std::runtime_error("input: standard input holds the records with --each-line");
+        std::string s;
+        readInput(s);
+        return scratch = std::move(s);
+    }
+
+    // toString(expr)
+    case BuiltinId::TO_STRING:
+        if (isIntValue(arg)) {
+            return scratch = formatInt(std::get<int>(arg));
+        }
+        if (isDoubleValue(arg)) {
+            return scratch = formatDouble(std::get<double>(arg));
+        }
+        if (argIsTemp) return scratch = std::move(argScratch[0]);
+        return arg;
+
+    // toNum(expr) -> try to parse as double, return int if whole number
+    case BuiltinId::TO_NUM:
+        if (isStringValue(arg)) return scratch = parseNumber(std::get<std::string>(arg));
+        if (argIsTemp) return scratch = std::move(argScratch[0]);
+        return arg;
+
+    // ===== strings =====
+    // searches are in StringOps; results that are pieces of a temporary
+    // argument are cut out of it in place instead of copied
+
+    case BuiltinId::SPLIT: {
+        const std::string& s = stringArg(fn, arg);
+        const std::string& sep = stringArg(fn, *args[1]);
+        if (sep.empty()) throw std::runtime_error("split: empty separator");
+        int piece = indexArg(fn, *args[2]);
+        const Value* stored = nullptr;
+        if (!argIsTemp && dynamic_cast<const VariableExpr*>(call->arguments[0].get())) stored = &arg;
+        return splitPiece(s, sep, piece, stored, scratch);
+    }
+
+    case BuiltinId::REPLACE:
+        if (limits.maxHeapBytes != 0) {
+            const std::string& s = stringArg(fn, arg);
+            const std::string& from = stringArg(fn, *args[1]);
+            const std::string& to = stringArg(fn, *args[2]);
+            if (!from.empty()) {
+                size_t n = countBytes(s, from);
+                chargeHeap(s.size() - n * from.size() + n * to.size());
+            }
+        }
+        return scratch = builtinAt(call->builtin).native(args, count);
+
+    case BuiltinId::SUBSTR:
+    case BuiltinId::TRIM: {
+        const std::string& s = stringArg(fn, arg);
+        size_t start = 0, length = 0;
+        if (call->builtin == static_cast<int>(BuiltinId::TRIM)) {
+            trimBounds(s, start, length);
+        } else {
+            substrBounds(s, args, count, start, length);
+        }
+
+        if (start == 0 && length == s.size()) {
+            if (argIsTemp) return scratch = std::move(argScratch[0]);
+            return arg;
+        }
+        if (argIsTemp) {
+            std::string& t = std::get<std::string>(argScratch[0]);
+            t.erase(start + length);
+            t.erase(0, start);
+            return scratch = std::move(argScratch[0]);
+        }
+        chargeHeap(length);
+        return scratch = std::string(s, start, length);
+    }
+
+    // ===== files =====
+
+    // readLine(h) hands out the reader's own buffer; it is copied only
+    // when the script stores it (see FileIO.h)
+    case BuiltinId::READ_LINE: {
+        LineReader& reader = files.reader(handleArg(fn, arg));
+        chargeHeap(reader.nextLength());
+        fileEpoch++;
+        return reader.next();
+    }
+
+    case BuiltinId::HAS_LINE:
+        return scratch = files.reader(handleArg(fn, arg)).hasLine() ? 1 : 0;
+
+    case BuiltinId::OPEN_FILE:
+        return scratch = files.open(stringArg(fn, arg));
+
+    case BuiltinId::CLOSE_FILE:
+        files.close(handleArg(fn, arg));
+        fileEpoch++;
+        return scratch = 0;
+
+    case BuiltinId::READ_FILE: {
+        auto file = files.map(stringArg(fn, arg));
+        chargeHeap(file->size());
+        return scratch = std::string(file->data(), file->size());
+    }
+
+    case BuiltinId::SNAPSHOT:
+        takeSnapshot(call, stringArg(fn, arg));
+        return scratch = 0;
+
+    // ===== channels =====
+    // send, receive and hasValue may run other tasks before they return
+
+    case BuiltinId::CHAN:
+        if (!isIntValue(arg)) throw std::runtime_error("chan: expected an int");
+        return scratch = tasks.makeChannel(std::get<int>(arg));
+
+    case BuiltinId::SEND:
+        if (args[1] == &argScratch[1]) tasks.send(channelArg(fn, arg), std::move(argScratch[1]));
+        else tasks.send(channelArg(fn, arg), *args[1]);
+        return scratch = 0;
+
+    case BuiltinId::RECEIVE: {
+        Value v = tasks.receive(channelArg(fn, arg));
+        chargeHeap(stringBytes(v));
+        return scratch = std::move(v);
+    }
+
+    case BuiltinId::HAS_VALUE:
+        return scratch = tasks.hasValue(channelArg(fn, arg)) ? 1 : 0;
+
+    case BuiltinId::CLOSE_CHAN:
+        tasks.close(channelArg(fn, arg));
+        return scratch = 0;
+
+    // writeFile(path, text) replaces the file, appendFile adds to it;
+    // both return the number of bytes written
+    case BuiltinId::WRITE_FILE:
+    case BuiltinId::APPEND_FILE: {
+        const std::string& path = stringArg(fn, arg);
+        const std::string& text = stringArg(fn, *args[1]);
+        files.write(path, text, call->builtin == static_cast<int>(BuiltinId::APPEND_FILE));
+        return scratch = static_cast<int>(std::min<size_t>(text.size(), INT_MAX));
+    }
+
+    // len, find, contains, count and registered functions: nothing to
+    // borrow or cut in place
+    default:
+        return scratch = builtinAt(call->builtin).native(args, count);
+    }
+}
+
+// piece `piece` (from 0) of s cut at every sep. For a variable the
+// position of the last piece asked for is kept, so a loop over all
+// pieces scans the string about twice instead of once per piece.
+const Value& Interpreter::splitPiece(const std::string& s, const std::string& sep, int piece,
+                                     const Value* stored, Value& scratch) {
+    SplitCursor& c = splitCursor;
+    int at = 0;
+    size_t offset = 0;
+    if (stored && c.source == stored && c.piece <= piece && c.sep == sep) {
+        at = c.piece;
+        offset = c.offset;
+    }
+
+    seekPiece(s, sep, piece, at, offset);
+
+    if (stored) {
+        c.source = stored;
+        c.sep = sep;
+        c.piece = piece;
+        c.offset = offset;
+    }
+
+    size_t end = findBytes(s, sep, offset);
+    size_t length = (end == NOT_FOUND ? s.size() : end) - offset;
+    chargeHeap(length);
+    return scratch = std::string(s, offset, length);
+}
+
+// ===== unboxed evaluation =====
+// Only reached for expressions the type pass proved to be exactly an int
+// (or a double), so there are no tag checks on the way; errors that do not
+// depend on types (division by zero) match binaryOp.
+
+int Interpreter::evalInt(const Expr* expr) {
+    if (auto typed = dynamic_cast<const TypedBinaryExpr*>(expr)) {
+        checkStack();
+        TokenTypes op = typed->op;
+
+        if (typed->operands == NumKind::DOUBLE) {
+            // only comparisons turn doubles into an int
+            double l = evalAsDouble(typed->leftKind, typed->left.get());
+            double r = evalAsDouble(typed->rightKind, typed->right.get());
+            return comparison(op, l, r);
+        }
+
+        int l = evalInt(typed->left.get());
+        int r = evalInt(typed->right.get());
+        return numericOp(op, l, r);
+    }
+
+    if (auto slot = dynamic_cast<const SlotExpr*>(expr)) {
+        return intSlots[slot->slot];
+    }
+    if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
+        return std::get<int>(lit->val);
+    }
+
+    // boxed variable or call that is known to give an int here
+    Value scratch;
+    return std::get<int>(evaluate(expr, scratch));
+}
+
+double Interpreter::evalDouble(const Expr* expr) {
+    if (auto typed = dynamic_cast<const TypedBinaryExpr*>(expr)) {
+        checkStack();
+        double l = evalAsDouble(typed->leftKind, typed->left.get());
+        double r = evalAsDouble(typed->rightKind, typed->right.get());
+        return arithmetic(typed->op, l, r);
+    }
+
+    if (auto slot = dynamic_cast<const SlotExpr*>(expr)) {
+        return doubleSlots[slot->slot];
+    }
+    if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
+        return std::get<double>(lit->val);
+    }
+
+    Value scratch;
+    return std::get<double>(evaluate(expr, scratch));
+}
+
+// int operands of a double operator are promoted like binaryOp does
+double Interpreter::evalAsDouble(NumKind kind, const Expr* expr) {
+    if (kind == NumKind::INT) return static_cast<double>(evalInt(expr));
+    return evalDouble(expr);
+}
+
+// ===== binary operators {see BinaryOps.h} =====
+
+// builds the function for each (operator, left type, right type) from
+// binaryRule; a friend so '+' on strings can charge the heap
+struct BinaryTable {
+    using Fn = Value (*)(const Interpreter& self, const Value& left, const Value& right);
+
+    template <size_t K>
+    static double promoted(const Value& v) {
+        if constexpr (K == VALUE_INT) return static_cast<double>(std::get<int>(v));
+        else return std::get<double>(v);
+    }
+
+    template <TokenTypes Op, size_t L, size_t R>
+    static Value entry(const Interpreter& self, const Value& left, const Value& right) {
+        constexpr BinaryRule rule = binaryRule(Op, L, R);
+        if constexpr (rule == BinaryRule::INT_MATH) {
+            return arithmetic(Op, std::get<int>(left), std::get<int>(right));
+        } else if constexpr (rule == BinaryRule::DOUBLE_MATH) {
+            return arithmetic(Op, promoted<L>(left), promoted<R>(right));
+        } else if constexpr (rule == BinaryRule::INT_COMPARE) {
+            return comparison(Op, std::get<int>(left), std::get<int>(right));
+        } else if constexpr (rule == BinaryRule::DOUBLE_COMPARE) {
+            return comparison(Op, promoted<L>(left), promoted<R>(right));
+        } else if constexpr (rule == BinaryRule::CONCAT) {
+            const std::string& l = std::get<std::string>(left);
+            const std::string& r = std::get<std::string>(right);
+            self.chargeHeap(l.size() + r.size());
+            return l + r;
+        } else if constexpr (rule == BinaryRule::STRING_EQUALITY) {
+            bool same = std::get<std::string>(left) == std::get<std::string>(right);
+            return (same == (Op == TokenTypes::EQUAL_EQUAL)) ? 1 : 0;
+        } else {
+            (void)self; (void)left; (void)right;
+            throw std::runtime_error(binaryError(rule));
+        }
+    }
+
+    // entry I is operator I / 9, left type (I / 3) % 3, right type I % 3
+    template <size_t... I>
+    static constexpr std::array<Fn, sizeof...(I)> make(std::index_sequence<I...>) {
+        return {{ &entry<static_cast<TokenTypes>(I / (VALUE_KINDS * VALUE_KINDS)),
+                         (I / VALUE_KINDS) % VALUE_KINDS, I % VALUE_KINDS>... }};
+    }
+};
+
+static constexpr std::array<BinaryTable::Fn, TOKEN_KINDS * VALUE_KINDS * VALUE_KINDS> BINARY_TABLE =
+    BinaryTable::make(std::make_index_sequence<TOKEN_KINDS * VALUE_KINDS * VALUE_KINDS>());
+
+// all binary operators on two already evaluated operands
+Value Interpreter::binaryOp(TokenTypes op, const Value& left, const Value& right) {
+    size_t l = left.index(), r = right.index();
+    // only a value emptied by an exception mid-assignment has no type
+    if (l >= VALUE_KINDS || r >= VALUE_KINDS) throw std::bad_variant_access();
+    size_t at = (static_cast<size_t>(op) * VALUE_KINDS + l) * VALUE_KINDS + r;
+    return BINARY_TABLE[at](*this, left, right);
+}
+
+// ===== statement shape profile =====
+
+void Interpreter::countShape(const Stmt* stmt) {
+    stmtHits[stmt]++;
+    if (lastStmt) pairHits[{ lastStmt, stmt }]++;
+    lastStmt = stmt;
+}
+
+// prints the `top` most executed statement shapes and consecutive pairs
+void Interpreter::dumpShapeProfile(std::ostream& os, size_t top) const {
+    std::unordered_map<const Stmt*, std::string> shapes;
+    auto shapeOf = [&](const Stmt* s) -> const std::string& {
+        auto it = shapes.find(s);
+        if (it == shapes.end()) it = shapes.emplace(s, stmtShape(s)).first;
+        return it->second;
+    };
+
+    auto print = [&](const char* title, const std::map<std::string, unsigned long long>& counts) {
+        std::vector<std::pair<unsigned long long, std::string>> sorted;
+        for (const auto& c : counts) sorted.push_back({ c.second, c.first });
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+
+        os << "== " << title << " ==\n";
+        for (size_t i = 0; i < sorted.size() && i < top; i++) {
+            os << std::string(12 - std::min<size_t>(12, std::to_string(sorted[i].first).size()), ' ')
+               << sorted[i].first << "  " << sorted[i].second << "\n";
+        }
+    };
+
+    std::map<std::string, unsigned long long> single;
+    for (const auto& h : stmtHits) single[shapeOf(h.first)] += h.second;
+
+    std::map<std::string, unsigned long long> pairs;
+    for (const auto& h : pairHits) {
+        pairs[shapeOf(h.first.first) + "  ;  " + shapeOf(h.first.second)] += h.second;
+    }
+
+    print("statement shapes", single);
+    print("consecutive statements", pairs);
+}
@@ -1,22 +1,184 @@
-#pragma once
-#include <string>
-#include <vector>
-#include <unordered_map>
-#include <memory>
-#include <variant>
-
-#include "../parser/AST.h"
-
-class Interpreter {
-public:
-    void interpret(const std::vector<std::unique_ptr<Stmt>>& program);
-
-private:
-    // env now stores Value[which is dynamic] instead of int or double
-    std::unordered_map<std::string, Value> env;
-
-    void execute(const Stmt* stmt);
-
-    // evaluate now returns Value
-    Value evaluate(const Expr* expr);
-};
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <variant>
+#include <chrono>
+#include <map>
+#include <iostream>
+
+#include "../optimizer/TypeInference.h"
+#include "../parser/AST.h"
+#include "../runtime/FileIO.h"
+#include "../runtime/Limits.h"
+#include "../runtime/SampleProfiler.h"
+#include "../runtime/Snapshot.h"
+#include "../runtime/Tasks.h"
+
+class Interpreter {
+public:
+    Interpreter() = default;
+    explicit Interpreter(const Limits &limits) : limits(limits) {}
+
+    // runs the top-level statements from `from` on
+    void interpret(const std::vector<std::unique_ptr<Stmt>>& program, size_t from = 0);
+
+    // --profile-shapes: count executed statement shapes to pick fused forms
+    void enableShapeProfile() { profileShapes = true; }
+    void dumpShapeProfile(std::ostream& os, size_t top) const;
+
+    // --sample-profile: keep `pos` up to date for the signal handler
+    void publishPosition(ExecPosition* pos) {
+        position = pos;
+        tasks.publishPosition(pos);
+    }
+
+    // storage for variables the type pass moved out of env
+    void useSlots(const TypeReport& types);
+
+    // --each-line: read standard input as records for EachLineStmt;
+    // fields are cut at `separator`, or at runs of blanks when it is empty
+    void useRecords(const std::string& separator);
+
+    // --lazy-parse: fuse bodies as they are parsed, like the rest was
+    void fuseLazyBodies(bool fuse) { fuseLazy = fuse; }
+
+    // ===== snapshots {see runtime/Snapshot.h} =====
+    // the program text snapshot() saves, owned by the caller
+    void keepSource(const std::string* text) { source = text; }
+    // --restore: variables of a snapshot, before interpret(program, snap.resumeAt)
+    void restore(const Snapshot& snap);
+
+    // ===== --serve {see server/Server.h} =====
+    // where in() / input() read and out() writes, std::cin and std::cout
+    // unless changed; both are owned by the caller
+    void useStreams(std::istream& input, std::ostream& output);
+    // forget the variables, files, tasks and budgets of the last run so the next
+    // program starts clean without building a new interpreter
+    void reset();
+
+    // loop back-edges taken so far, for --alloc-stats
+    unsigned long long loopIterations() const { return iterations; }
+
+private:
+    // env now stores Value[which is dynamic] instead of int or double
+    std::unordered_map<std::string, Value> env;
+
+    std::istream* in = &std::cin;
+    std::ostream* out = &std::cout;
+
+    void execute(const Stmt* stmt);
+
+    // evaluate returns a borrowed Value: a reference into env / the AST,
+    // or into scratch when the result had to be computed
+    const Value& evaluate(const Expr* expr, Value& scratch);
+    Value binaryOp(TokenTypes op, const Value& left, const Value& right);
+    friend struct BinaryTable; // builds binaryOp's table, see Interpreter.cpp
+    const Value& callBuiltin(const CallExpr* call, Value& scratch);
+    bool appendInPlace(const AssignStmt* assign);
+
+    // ===== unboxed numbers {see optimizer/TypeInference.h} =====
+    std::vector<int> intSlots;
+    std::vector<double> doubleSlots;
+    std::vector<TypedVar> slotVars; // which variable lives in which slot
+
+    int evalInt(const Expr* expr);
+    double evalDouble(const Expr* expr);
+    double evalAsDouble(NumKind kind, const Expr* expr);
+
+    bool compareInts(const CompareVarsExpr* cmp, bool& result);
+
+    void runFor(const ForStmt* loop, const Stmt* self);
+    void runCountedFor(const CountedForStmt* counted);
+
+    // ===== shape profile =====
+    bool profileShapes = false;
+    const Stmt* lastStmt = nullptr;
+    std::unordered_map<const Stmt*, unsigned long long> stmtHits;
+    std::map<std::pair<const Stmt*, const Stmt*>, unsigned long long> pairHits;
+
+    void countShape(const Stmt* stmt);
+
+    // ===== files {see runtime/FileIO.h} =====
+    FileTable files;
+    // bumped by readLine and closeFile, which change what an earlier
+    // borrowed line refers to
+    unsigned long long fileEpoch = 0;
+
+    // ===== spawn and channels {see runtime/Tasks.h} =====
+    TaskScheduler tasks;
+
+    // in() and input(): the next line, letting other tasks run while it is not there
+    void readInput(std::string& line);
+
+    // ===== strings {see runtime/StringOps.h} =====
+    // where split(s, sep, i) on a variable stopped, so asking for piece
+    // i + 1 continues there instead of rescanning from the start
+    struct SplitCursor {
+        const Value* source = nullptr; // the variable, null when nothing is cached
+        std::string sep;
+        int piece = 0;     // index of the piece that starts at offset
+        size_t offset = 0;
+    };
+    SplitCursor splitCursor;
+
+    const Value& splitPiece(const std::string& s, const std::string& sep, int piece,
+                            const Value* stored, Value& scratch);
+
+    // every overwrite of a variable goes past here
+    void wrote(const Value& v) {
+        if (&v == splitCursor.source) splitCursor.source = nullptr;
+    }
+
+    // ===== --lazy-parse =====
+    bool fuseLazy = false;
+    const std::vector<std::unique_ptr<Stmt>>& lazyBody(const LazyBlockStmt* lazy);
+
+    // ===== --each-line records =====
+    bool recordMode = false;
+    std::string fieldSeparator;
+    struct Record {
+        Value line = std::string();
+        int number = 0; // NR
+        bool split = false; // fields below are for this line
+        std::vector<std::pair<size_t, size_t>> fields; // start and length in line
+        std::vector<Value> fieldValues; // buffers for f1 f2 ..., reused
+    };
+    Record record;
+    Value noField = std::string(); // f5 on a line with four fields
+
+    void runRecords(const EachLineStmt* each);
+    const Value& recordValue(const RecordExpr* rec, Value& scratch);
+    void splitRecord();
+
+    // ===== snapshots =====
+    const std::string* source = nullptr;
+    // the top-level statement running now and its index
+    const Stmt* topStmt = nullptr;
+    size_t topIndex = 0;
+
+    void takeSnapshot(const CallExpr* call, const std::string& path);
+
+    // where a sampling profiler looks, null when nobody is sampling
+    ExecPosition* position = nullptr;
+
+    // ===== execution budgets =====
+    Limits limits;
+
+    // steps left before the next slow check; loops only decrement this
+    long long budget = 0;
+    long long budgetGranted = 0;
+    unsigned long long stepsUsed = 0;
+    unsigned long long iterations = 0;
+    std::chrono::steady_clock::time_point deadline;
+
+    // bytes of string data currently stored in env
+    size_t heapBytes = 0;
+
+    void startBudgets();
+    void chargeLoop(size_t weight);
+    void refillBudget();
+    void chargeHeap(size_t bytes) const;
+    void store(const std::string &name, Value val);
+};
@@ -1,209 +1,388 @@
-#include "Lexer.h"
-#include <cctype>
-
-using namespace std;
-
-Lexer::Lexer(const std::string &s): s(s), position(0) {}
-
-// peep current character without consuming
-char Lexer::peek() const {
-    if (isAtEnd()) return '\0';
-    return s[position];
-}
-
-// consume and return current character
-char Lexer::advance() {
-    if (isAtEnd()) return '\0';
-    char toRet = s[position];
-    position++;
-    return toRet;
-}
-
-bool Lexer::isAtEnd() const {
-    return position >= s.length();
-}
-
-void Lexer::skipSpace() {
-    while (!isAtEnd() && std::isspace(static_cast<unsigned char>(peek()))) {
-        advance();
-    }
-}
-
-Token Lexer::makeNumber() {
-    std::string val;
-    bool hasDot = false;
-
-    while (!isAtEnd()) {
-        char c = peek();
-
-        if (std::isdigit(static_cast<unsigned char>(c))) {
-            val += advance();
-        }
-        else if (c == '.' && !hasDot) {
-            hasDot = true;
-            val += advance();
-        }
-        else {
-            break;
-        }
-    }
-
-    if (hasDot)
-        return { TokenTypes::FLOAT, val };
-    else
-        return { TokenTypes::NUMBER, val };
-}
-
-Token Lexer::makeIdentifier() {
-    std::string val;
-    while (!isAtEnd() && (std::isalnum(static_cast<unsigned char>(peek())) || peek() == '_')) {
-        val += advance();
-    }
-
-    //different Token types accoring to their values {assignment}
-    if (val == "out")  return { TokenTypes::OUT, val };
-    if (val == "in")   return { TokenTypes::IN,  val };
-    if (val == "if")   return { TokenTypes::IF,  val };     
-    if (val == "else") return { TokenTypes::ELSE, val };   
-    if (val == "while") return { TokenTypes::WHILE, val };
-    if (val == "break") return {TokenTypes::BREAK, val};
-
-    return { TokenTypes::IDENTIFIER, val };
-}
-
-void Lexer::commenting(){
-    advance();
-    while(!isAtEnd() && peek() != '#' && peek() != '\n'){
-        advance();
-    }
-
-    if (!isAtEnd() && peek() == '#') {
-        advance();
-    }
-
-
-}
-
-Token Lexer::makeString() {
-    advance(); // skip opening quote
-    std::string val;
-    while (!isAtEnd() && peek() != '"') {
-        val += advance();
-    }
-
-    if (!isAtEnd() && peek() == '"') {
-        advance();
-    }
-
-    return { TokenTypes::STRING, val };
-}
-
-
-std::vector<Token> Lexer::tokenize() {
-    std::vector<Token> t;
-
-    while (!isAtEnd()) {
-        skipSpace();
-        if (isAtEnd()) break;
-
-        char c = peek();
-
-        if (std::isdigit(static_cast<unsigned char>(c))) {
-            t.push_back(makeNumber());
-        }
-        else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
-            t.push_back(makeIdentifier());
-        }
-        else {
-            switch (c) {
-                case '(':
-                    advance();
-                    t.push_back({ TokenTypes::PAREN_L, "(" });
-                    break;
-                case ')':
-                    advance();
-                    t.push_back({ TokenTypes::PAREN_R, ")" });
-                    break;
-                case ';':
-                    advance();
-                    t.push_back({ TokenTypes::SEMICOLON, ";" });
-                    break;
-                case '+':
-                    advance();
-                    t.push_back({ TokenTypes::PLUS, "+" });
-                    break;
-                case '-':
-                    advance();
-                    t.push_back({ TokenTypes::MINUS, "-" });
-                    break;
-                case '*':
-                    advance();
-                    t.push_back({ TokenTypes::ASTERISK, "*" });
-                    break;
-                case '/':
-                    advance();
-                    t.push_back({ TokenTypes::SLASH, "/" });
-                    break;
-                case '%':
-                    advance();
-                    t.push_back({ TokenTypes::MODULUS, "%" });
-                    break;
-                case '"':
-                    t.push_back(makeString());
-                    break;
-                case '#':
-                    commenting();
-                    break;
-                case '=':
-                    advance();
-                    if (!isAtEnd() &&peek() == '='){//comparision sign checked
-                        t.push_back( {TokenTypes::EQUAL_EQUAL, "=="});
-                        advance();
-                    }else{
-                    t.push_back({ TokenTypes::EQUALS, "=" });}
-                    break;
-                case '{':
-                    advance();
-                    t.push_back({ TokenTypes::CURLY_L, "{" });
-                    break;
-
-                case '}':
-                    advance();
-                    t.push_back({ TokenTypes::CURLY_R, "}" });
-                    break;
-
-                case '!':
-                    advance();
-                    if(!isAtEnd() && peek() == '='){//comparision sign checked
-                        t.push_back({ TokenTypes::NOT_EQUAL, "!=" });
-                        advance();
-                    }else{
-                        //urinary operator later
-                    }
-                    break;
-                case '<':
-                    advance();
-                    if(!isAtEnd() && peek() == '='){
-                        advance(); 
-                        t.push_back({ TokenTypes::LESSER_EQUAL, "<=" });
-                    }else{ t.push_back({ TokenTypes::LESSER, "<" });}
-                    break;
-
-                case '>':
-                    advance();
-                    if(!isAtEnd() && peek() == '='){
-                        advance(); 
-                        t.push_back({ TokenTypes::GREATER_EQUAL, ">=" });
-                    }else{ t.push_back({ TokenTypes::GREATER, ">" });}
-                    break;
-                default:
-                    // unknown char: give error
-                    advance();
-                    break;
-            }
-        }
-    }
-
-    t.push_back({ TokenTypes::END_OF_FILE, "" });
-    return t;
-}
+#include "Lexer.h"
+#include <array>
+#include <thread>
+
+#include "../runtime/Simd.h"
+
+using namespace std;
+
+Lexer::Lexer(const std::string &s): s(s), position(0) {}
+
+// peep current character without consuming
+char Lexer::peek() const {
+    if (isAtEnd()) return '\0';
+    return s[position];
+}
+
+// consume and return current character
+char Lexer::advance() {
+    if (isAtEnd()) return '\0';
+    char toRet = s[position];
+    position++;
+    return toRet;
+}
+
+bool Lexer::isAtEnd() const {
+    return position >= s.length();
+}
+
+// ===== bulk scanning =====
+// byte classes for the C locale, so the hot loops never call <cctype>
+enum : unsigned char { SPACE = 1, DIGIT = 2, ALPHA = 4 };
+
+static const std::array<unsigned char, 256> CLASS = [] {
+    std::array<unsigned char, 256> table{};
+    for (int c = '0'; c <= '9'; c++) table[c] = DIGIT;
+    for (int c = 'a'; c <= 'z'; c++) table[c] = ALPHA;
+    for (int c = 'A'; c <= 'Z'; c++) table[c] = ALPHA;
+    table['_'] = ALPHA;
+    table[' '] = SPACE;
+    for (int c = '\t'; c <= '\r'; c++) table[c] = SPACE;
+    return table;
+}();
+
+static bool is(char c, unsigned char cls) {
+    return (CLASS[static_cast<unsigned char>(c)] & cls) != 0;
+}
+
+// first position at or after pos that is not whitespace
+static size_t scanSpace(const char* data, size_t pos, size_t n) {
+#if KASH_SIMD
+    while (pos + Vec::width <= n) {
+        Vec c = Vec::load(data + pos);
+        uint32_t space = ((c == Vec::splat(' ')) | c.inRange('\t', '\r')).mask();
+        uint32_t other = ~space & VEC_ALL;
+        if (other) return pos + lowestBit(other);
+        pos += Vec::width;
+    }
+#endif
+    while (pos < n && is(data[pos], SPACE)) pos++;
+    return pos;
+}
+
+// first position at or after pos that cannot continue an identifier
+static size_t scanIdentifier(const char* data, size_t pos, size_t n) {
+#if KASH_SIMD
+    while (pos + Vec::width <= n) {
+        Vec c = Vec::load(data + pos);
+        Vec lower = c | Vec::splat(0x20);
+        uint32_t ident = (lower.inRange('a', 'z') | c.inRange('0', '9') | (c == Vec::splat('_'))).mask();
+        uint32_t other = ~ident & VEC_ALL;
+        if (other) return pos + lowestBit(other);
+        pos += Vec::width;
+    }
+#endif
+    while (pos < n && is(data[pos], ALPHA | DIGIT)) pos++;
+    return pos;
+}
+
+// first position at or after pos holding a or b, n if there is none
+static size_t scanUntil(const char* data, size_t pos, size_t n, char a, char b) {
+#if KASH_SIMD
+    Vec va = Vec::splat(a), vb = Vec::splat(b);
+    while (pos + Vec::width <= n) {
+        Vec c = Vec::load(data + pos);
+        uint32_t hit = ((c == va) | (c == vb)).mask();
+        if (hit) return pos + lowestBit(hit);
+        pos += Vec::width;
+    }
+#endif
+    while (pos < n && data[pos] != a && data[pos] != b) pos++;
+    return pos;
+}
+
+// how many bytes in [pos, n) equal c
+static inline size_t countByte(const char* data, size_t pos, size_t n, char c) {
+    size_t count = 0;
+#if KASH_SIMD
+    Vec vc = Vec::splat(c);
+    while (pos + Vec::width <= n) {
+        count += static_cast<size_t>(__builtin_popcount((Vec::load(data + pos) == vc).mask()));
+        pos += Vec::width;
+    }
+#endif
+    for (; pos < n; pos++) count += data[pos] == c;
+    return count;
+}
+
+void Lexer::skipSpace() {
+    position = scanSpace(s.data(), position, s.size());
+}
+
+Token Lexer::makeNumber() {
+    size_t start = position;
+    bool hasDot = false;
+
+    while (!isAtEnd()) {
+        char c = s[position];
+
+        if (is(c, DIGIT)) {
+            position++;
+        }
+        else if (c == '.' && !hasDot) {
+            hasDot = true;
+            position++;
+        }
+        else {
+            break;
+        }
+    }
+
+    std::string val = s.substr(start, position - start);
+    if (hasDot)
+        return { TokenTypes::FLOAT, std::move(val) };
+    else
+        return { TokenTypes::NUMBER, std::move(val) };
+}
+
+Token Lexer::makeIdentifier() {
+    size_t start = position;
+    position = scanIdentifier(s.data(), position, s.size());
+    std::string val = s.substr(start, position - start);
+
+    //different Token types accoring to their values {assignment}
+    if (val == "out")  return { TokenTypes::OUT, val };
+    if (val == "in")   return { TokenTypes::IN,  val };
+    if (val == "if")   return { TokenTypes::IF,  val };     
+    if (val == "else") return { TokenTypes::ELSE, val };   
+    if (val == "while") return { TokenTypes::WHILE, val };
+    if (val == "for") return { TokenTypes::FOR, val };
+    if (val == "break") return {TokenTypes::BREAK, val};
+    if (val == "spawn") return { TokenTypes::SPAWN, val };
+
+    return { TokenTypes::IDENTIFIER, std::move(val) };
+}
+
+// # comment # or # comment to end of line
+void Lexer::commenting(){
+    advance();
+    position = scanUntil(s.data(), position, s.size(), '#', '\n');
+
+    if (!isAtEnd() && peek() == '#') {
+        advance();
+    }
+}
+
+Token Lexer::makeString() {
+    advance(); // skip opening quote
+    size_t start = position;
+    position = scanUntil(s.data(), position, s.size(), '"', '"');
+    std::string val = s.substr(start, position - start);
+
+    if (!isAtEnd() && peek() == '"') {
+        advance();
+    }
+
+    return { TokenTypes::STRING, std::move(val) };
+}
+
+
+std::vector<Token> Lexer::tokenize() {
+    std::vector<Token> t;
+
+    // newlines are counted in the gap between one token and the next
+    int line = 1;
+    size_t counted = position;
+
+    while (!isAtEnd()) {
+        skipSpace();
+        if (isAtEnd()) break;
+
+        line += static_cast<int>(countByte(s.data(), counted, position, '\n'));
+        counted = position;
+        size_t before = t.size();
+
+        char c = peek();
+
+        if (is(c, DIGIT)) {
+            t.push_back(makeNumber());
+        }
+        else if (is(c, ALPHA)) {
+            t.push_back(makeIdentifier());
+        }
+        else {
+            switch (c) {
+                case '(':
+                    advance();
+                    t.push_back({ TokenTypes::PAREN_L, "(" });
+                    break;
+                case ')':
+                    advance();
+                    t.push_back({ TokenTypes::PAREN_R, ")" });
+                    break;
+                case ';':
+                    advance();
+                    t.push_back({ TokenTypes::SEMICOLON, ";" });
+                    break;
+                case ',':
+                    advance();
+                    t.push_back({ TokenTypes::COMMA, "," });
+                    break;
+                case '+':
+                    advance();
+                    t.push_back({ TokenTypes::PLUS, "+" });
+                    break;
+                case '-':
+                    advance();
+                    t.push_back({ TokenTypes::MINUS, "-" });
+                    break;
+                case '*':
+                    advance();
+                    t.push_back({ TokenTypes::ASTERISK, "*" });
+                    break;
+                case '/':
+                    advance();
+                    t.push_back({ TokenTypes::SLASH, "/" });
+                    break;
+                case '%':
+                    advance();
+                    t.push_back({ TokenTypes::MODULUS, "%" });
+                    break;
+                case '"':
+                    t.push_back(makeString());
+                    break;
+                case '#':
+                    commenting();
+                    break;
+                case '=':
+                    advance();
+                    if (!isAtEnd() &&peek() == '='){//comparision sign checked
+                        t.push_back( {TokenTypes::EQUAL_EQUAL, "=="});
+                        advance();
+                    }else{
+                    t.push_back({ TokenTypes::EQUALS, "=" });}
+                    break;
+                case '{':
+                    advance();
+                    t.push_back({ TokenTypes::CURLY_L, "{" });
+                    break;
+
+                case '}':
+                    advance();
+                    t.push_back({ TokenTypes::CURLY_R, "}" });
+                    break;
+
+                case '!':
+                    advance();
+                    if(!isAtEnd() && peek() == '='){//comparision sign checked
+                        t.push_back({ TokenTypes::NOT_EQUAL, "!=" });
+                        advance();
+                    }else{
+                        //urinary operator later
+                    }
+                    break;
+                case '<':
+                    advance();
+                    if(!isAtEnd() && peek() == '='){
+                        advance(); 
+                        t.push_back({ TokenTypes::LESSER_EQUAL, "<=" });
+                    }else{ t.push_back({ TokenTypes::LESSER, "<" });}
+                    break;
+
+                case '>':
+                    advance();
+                    if(!isAtEnd() && peek() == '='){
+                        advance(); 
+                        t.push_back({ TokenTypes::GREATER_EQUAL, ">=" });
+                    }else{ t.push_back({ TokenTypes::GREATER, ">" });}
+                    break;
+                default:
+                    // unknown char: give error
+                    advance();
+                    break;
+            }
+        }
+
+        if (t.size() != before) t.back().line = line;
+    }
+
+    line += static_cast<int>(countByte(s.data(), counted, s.size(), '\n'));
+    t.push_back({ TokenTypes::END_OF_FILE, "", line });
+    return t;
+}
+
+
+// ===== parallel lexing =====
+
+// Offsets just past a ';' or '}' where a fresh lexer would produce exactly
+// the tokens the sequential one does, about one every `chunk` bytes. Only
+// strings and comments carry state across characters, so the pre-scan
+// jumps from quote/hash to quote/hash and looks for a boundary only once it
+// has passed the next target offset.
+static std::vector<size_t> findSplits(const std::string& s, size_t chunk) {
+    std::vector<size_t> splits;
+    const char* data = s.data();
+    size_t n = s.size();
+    size_t pos = 0;
+    size_t target = chunk;
+
+    while (pos < n) {
+        size_t special = scanUntil(data, pos, n, '"', '#');
+
+        // boundaries can only sit in the plain code before `special`
+        while (target < special) {
+            size_t from = target > pos ? target : pos;
+            size_t end = scanUntil(data, from, special, ';', '}');
+            if (end >= special) break;
+
+            splits.push_back(end + 1);
+            target = end + 1 + chunk;
+        }
+
+        if (special >= n) break;
+
+        if (data[special] == '"') {
+            size_t close = scanUntil(data, special + 1, n, '"', '"');
+            pos = close + 1;
+        } else {
+            size_t end = scanUntil(data, special + 1, n, '#', '\n');
+            pos = (end < n && data[end] == '#') ? end + 1 : end;
+        }
+    }
+    return splits;
+}
+
+std::vector<Token> Lexer::tokenizeParallel(unsigned threads) {
+    if (threads < 2) return tokenize();
+
+    std::vector<size_t> bounds = findSplits(s, s.size() / threads + 1);
+    if (bounds.empty()) return tokenize();
+
+    bounds.insert(bounds.begin(), position);
+    bounds.push_back(s.size());
+
+    size_t parts = bounds.size() - 1;
+    std::vector<std::vector<Token>> pieces(parts);
+    std::vector<int> lines(parts); // newlines inside each piece
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < parts; i++) {
+        workers.emplace_back([&, i]() {
+            Lexer part(s.substr(bounds[i], bounds[i + 1] - bounds[i]));
+            pieces[i] = part.tokenize();
+            lines[i] = pieces[i].back().line - 1;
+            pieces[i].pop_back(); // END_OF_FILE
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    size_t total = 1;
+    for (const auto& p : pieces) total += p.size();
+
+    // every piece counted lines from 1, shift them by the lines before it
+    std::vector<Token> t;
+    t.reserve(total);
+    int base = 0;
+    for (size_t i = 0; i < parts; i++) {
+        for (auto& tok : pieces[i]) {
+            tok.line += base;
+            t.push_back(std::move(tok));
+        }
+        std::vector<Token>().swap(pieces[i]);
+        base += lines[i];
+    }
+    t.push_back({ TokenTypes::END_OF_FILE, "", base + 1 });
+
+    position = s.size();
+    return t;
+}
@@ -1,44 +1,48 @@
-
-#pragma once
-#include <string>
-
-//contains all the keywords and operators {will add to this later on for development}
-enum class TokenTypes{
-    OUT,
-    IN,
-    IDENTIFIER,
-    NUMBER,
-    BREAK,
-    STRING,
-    FLOAT,
-    WHILE,
-    IF,
-    ELSE,
-    PAREN_L,
-    PAREN_R,
-    CURLY_L,
-    CURLY_R,
-
-    GREATER,
-    LESSER,
-    GREATER_EQUAL,
-    LESSER_EQUAL,
-    EQUALS,
-    EQUAL_EQUAL,
-    NOT_EQUAL,
-
-    SEMICOLON,
-    PLUS,
-    MINUS,
-    ASTERISK,
-    SLASH,
-    MODULUS,
-    COMMENT,
-
-    END_OF_FILE
-};
-
-struct Token{
-    TokenTypes t;
-    std::string value;
+
+#pragma once
+#include <string>
+
+//contains all the keywords and operators {will add to this later on for development}
+enum class TokenTypes{
+    OUT,
+    IN,
+    IDENTIFIER,
+    NUMBER,
+    BREAK,
+    STRING,
+    FLOAT,
+    WHILE,
+    FOR,
+    IF,
+    ELSE,
+    SPAWN,
+    PAREN_L,
+    PAREN_R,
+    CURLY_L,
+    CURLY_R,
+
+    GREATER,
+    LESSER,
+    GREATER_EQUAL,
+    LESSER_EQUAL,
+    EQUALS,
+    EQUAL_EQUAL,
+    NOT_EQUAL,
+
+    SEMICOLON,
+    COMMA,
+    PLUS,
+    MINUS,
+    ASTERISK,
+    SLASH,
+    MODULUS,
+    COMMENT,
+
+    END_OF_FILE
+};
+
+struct Token{
+    TokenTypes t;
+    std::string value;
+    int line = 1; // where the token starts, counted from 1
 };
\ No newline at end of file
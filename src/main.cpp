@@ -1,34 +1,412 @@
-#include <iostream>
-#include <fstream>
-#include <sstream>
-
-#include "lexer/Lexer.h"
-#include "parser/Parser.h"
-#include "interpreter/Interpreter.h"
-
-int main() {
-    // Open source file
-    std::ifstream file("examples/test.myc");
-    if (!file) {
-        std::cerr << "Error: could not open examples/test.myc\n";
-        return 1;
-    }
-
-    // Read entire file into a string
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-
-    // ===== Lexing =====
-    Lexer lexer(buffer.str());
-    auto tokens = lexer.tokenize();
-
-    // ===== Parsing =====
-    Parser parser(tokens);
-    auto program = parser.parse();
-
-    // ===== Interpreting =====
-    Interpreter interpreter;
-    interpreter.interpret(program);
-
-    return 0;
-}
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+#include "lexer/Lexer.h"
+#include "parser/Parser.h"
+#include "interpreter/Interpreter.h"
+#include "codegen/CEmitter.h"
+#include "optimizer/IrPasses.h"
+#include "optimizer/SsaIR.h"
+#include "optimizer/Superinstructions.h"
+#include "optimizer/TypeInference.h"
+#include "runtime/AllocCounter.h"
+#include "runtime/SampleProfiler.h"
+#include "runtime/Snapshot.h"
+#include "server/Client.h"
+#include "server/Server.h"
+
+static void usage() {
+    std::cerr << "usage: kash [options] [file.myc]\n"
+              << "  --max-steps=N     stop after about N executed statements\n"
+              << "  --timeout-ms=N    stop after N milliseconds of wall-clock time\n"
+              << "  --max-heap=N      stop when string values would exceed N bytes\n"
+              << "  --emit-c          print the program as a C file instead of running it\n"
+              << "  --no-fuse         run without fused superinstructions\n"
+              << "  --no-types        run without unboxing variables of a known type\n"
+              << "  --dump-types      print what type inference proved instead of running\n"
+              << "  --no-strength     run without folding constants and cheaper operators\n"
+              << "  --no-licm         run without moving loop-invariant expressions out of loops\n"
+              << "  --no-cse          run without reusing expressions computed before\n"
+              << "  --no-dce          run without dropping dead stores and dead code\n"
+              << "  --dump-ir         print the SSA IR after those passes instead of running\n"
+              << "  --profile-shapes  report the most executed statement shapes on stderr\n"
+              << "  --parse-only      lex and parse, then report throughput on stderr\n"
+              << "  --lazy-parse      skip over large if / while bodies until they first run\n"
+              << "  --validate        with --lazy-parse: still report syntax errors before running\n"
+              << "  --lex-threads=N   threads for lexing large files (default: all cores)\n"
+              << "  --alloc-stats     report heap allocations made while running on stderr\n"
+              << "  --sample-profile=HZ  sample the running statement HZ times per CPU second and\n"
+              << "                    print collapsed stacks for flamegraph tools on stderr\n"
+              << "  --sample-out=FILE write the collapsed stacks to FILE instead\n"
+              << "  --restore=FILE    go on from where snapshot() saved FILE, without a script\n"
+              << "  --each-line       run the program once per line of standard input, with the\n"
+              << "                    line in `line`, its number in NR and fields in f1 f2 ... NF\n"
+              << "  --fs=SEP          cut fields at SEP instead of at runs of spaces and tabs\n"
+              << "  --serve=SOCK      keep running and take scripts on the Unix socket SOCK;\n"
+              << "                    the limits and the --no-* options apply to every request\n"
+              << "  --workers=N       scripts run at once by --serve (default: one per core)\n"
+              << "  --connect=SOCK    run the script on a --serve server, with standard input\n"
+              << "  --requests=N      with --connect: send it N times and print latency and\n"
+              << "                    requests/sec on stderr instead of the output\n"
+              << "  --connections=N   with --requests: N connections at once (default 4)\n";
+}
+
+// value of a --name=N option, rejects anything that is not a plain number
+static unsigned long long numericOption(const std::string& arg, size_t prefixLen) {
+    std::string num = arg.substr(prefixLen);
+    if (num.empty() || num.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::runtime_error("Invalid value in option " + arg);
+    }
+    try {
+        return std::stoull(num);
+    } catch (const std::out_of_range&) {
+        throw std::runtime_error("Value too large in option " + arg);
+    }
+}
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t PARALLEL_LEX_BYTES = 4 * 1024 * 1024;
+
+// --parse-only: how fast the front end chews through the input
+static void reportThroughput(size_t bytes, size_t tokens, size_t statements,
+                             Clock::time_point started, Clock::time_point lexed, Clock::time_point parsed) {
+    auto seconds = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double>(b - a).count();
+    };
+    double mb = bytes / (1024.0 * 1024.0);
+    double lexS = seconds(started, lexed);
+    double parseS = seconds(lexed, parsed);
+
+    std::cerr << "input:  " << bytes << " bytes, " << tokens << " tokens, "
+              << statements << " top-level statements\n";
+    std::cerr << "lex:    " << lexS * 1000 << " ms  " << mb / lexS << " MB/s  "
+              << tokens / lexS << " tokens/s\n";
+    std::cerr << "parse:  " << parseS * 1000 << " ms  " << mb / parseS << " MB/s  "
+              << tokens / parseS << " tokens/s\n";
+}
+
+// --sample-profile output, one "frame;frame;frame count" line per stack
+static void writeSamples(const SampleProfiler& sampler, const std::string& path, const std::string& out) {
+    std::string root = path.substr(path.find_last_of('/') + 1);
+    if (out.empty()) {
+        std::cout.flush();
+        sampler.writeCollapsed(std::cerr, root);
+    } else {
+        std::ofstream file(out);
+        if (!file) throw std::runtime_error("could not open " + out);
+        sampler.writeCollapsed(file, root);
+    }
+    if (sampler.dropped() != 0) {
+        std::cerr << "sample-profile: buffer full, " << sampler.dropped() << " samples dropped\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // out() does not flush per line and nothing uses C stdio
+    std::ios::sync_with_stdio(false);
+
+    std::string path = "examples/test.myc";
+    Limits limits;
+    bool emitC = false;
+    bool fuse = true;
+    bool specialize = true;
+    bool dumpTypes = false;
+    IrOptions ir;
+    bool dumpIr = false;
+    bool profileShapes = false;
+    bool parseOnly = false;
+    bool lazyParse = false;
+    bool validate = false;
+    bool allocStats = false;
+    unsigned sampleHz = 0;
+    std::string sampleOut;
+    std::string restorePath;
+    bool eachLine = false;
+    std::string fieldSeparator;
+    unsigned lexThreads = std::thread::hardware_concurrency();
+    std::string servePath;
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    std::string connectPath;
+    LoadOptions load;
+    bool loadTest = false;
+
+    // ===== Options =====
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+
+            if (arg.rfind("--max-steps=", 0) == 0) {
+                limits.maxSteps = numericOption(arg, 12);
+            } else if (arg.rfind("--timeout-ms=", 0) == 0) {
+                unsigned long long ms = numericOption(arg, 13);
+                if (ms > static_cast<unsigned long long>(MAX_TIMEOUT_MS)) {
+                    throw std::runtime_error("--timeout-ms can be at most " + std::to_string(MAX_TIMEOUT_MS));
+                }
+                limits.timeoutMs = static_cast<long long>(ms);
+            } else if (arg.rfind("--max-heap=", 0) == 0) {
+                limits.maxHeapBytes = static_cast<size_t>(numericOption(arg, 11));
+            } else if (arg.rfind("--sample-profile=", 0) == 0) {
+                sampleHz = static_cast<unsigned>(numericOption(arg, 17));
+                if (sampleHz == 0) throw std::runtime_error("sample rate must be at least 1 Hz");
+            } else if (arg.rfind("--sample-out=", 0) == 0) {
+                sampleOut = arg.substr(13);
+            } else if (arg.rfind("--restore=", 0) == 0) {
+                restorePath = arg.substr(10);
+            } else if (arg.rfind("--fs=", 0) == 0) {
+                fieldSeparator = arg.substr(5);
+                if (fieldSeparator.empty()) throw std::runtime_error("--fs needs a separator");
+            } else if (arg.rfind("--serve=", 0) == 0) {
+                servePath = arg.substr(8);
+            } else if (arg.rfind("--workers=", 0) == 0) {
+                workers = static_cast<unsigned>(numericOption(arg, 10));
+            } else if (arg.rfind("--connect=", 0) == 0) {
+                connectPath = arg.substr(10);
+            } else if (arg.rfind("--requests=", 0) == 0) {
+                load.requests = numericOption(arg, 11);
+                loadTest = true;
+            } else if (arg.rfind("--connections=", 0) == 0) {
+                load.connections = static_cast<unsigned>(numericOption(arg, 14));
+            } else if (arg.rfind("--lex-threads=", 0) == 0) {
+                lexThreads = static_cast<unsigned>(numericOption(arg, 14));
+            } else if (arg == "--emit-c") {
+                emitC = true;
+            } else if (arg == "--each-line") {
+                eachLine = true;
+            } else if (arg == "--no-fuse") {
+                fuse = false;
+            } else if (arg == "--no-types") {
+                specialize = false;
+            } else if (arg == "--dump-types") {
+                dumpTypes = true;
+            } else if (arg == "--no-strength") {
+                ir.strength = false;
+            } else if (arg == "--no-licm") {
+                ir.licm = false;
+            } else if (arg == "--no-cse") {
+                ir.cse = false;
+            } else if (arg == "--no-dce") {
+                ir.dce = false;
+            } else if (arg == "--dump-ir") {
+                dumpIr = true;
+                ir.dump = true;
+            } else if (arg == "--profile-shapes") {
+                profileShapes = true;
+            } else if (arg == "--parse-only") {
+                parseOnly = true;
+            } else if (arg == "--lazy-parse") {
+                lazyParse = true;
+            } else if (arg == "--validate") {
+                validate = true;
+            } else if (arg == "--alloc-stats") {
+                allocStats = true;
+            } else if (arg == "--help" || arg == "-h") {
+                usage();
+                return 0;
+            } else if (arg.rfind("--", 0) == 0) {
+                std::cerr << "Error: unknown option " << arg << "\n";
+                usage();
+                return 2;
+            } else {
+                path = arg;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+
+    // ===== Server =====
+    if (!servePath.empty()) {
+        try {
+            if (eachLine) throw std::runtime_error("--each-line does not work with --serve");
+            ServeOptions options;
+            options.socketPath = servePath;
+            options.workers = workers;
+            options.limits = limits;
+            options.fuse = fuse;
+            options.specialize = specialize;
+            options.ir = ir;
+            return serve(options);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Open source file
+    std::string source;
+    if (restorePath.empty()) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Error: could not open " << path << "\n";
+            return 1;
+        }
+
+        // Read entire file into a string
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        source = buffer.str();
+    }
+
+    // ===== Client =====
+    // the server runs the script; standard input goes along unless it is a terminal
+    if (!connectPath.empty()) {
+        try {
+            std::string input;
+            if (!isatty(0)) {
+                std::stringstream buffer;
+                buffer << std::cin.rdbuf();
+                input = buffer.str();
+            }
+            if (!loadTest) return runRemote(connectPath, source, input);
+            load.socketPath = connectPath;
+            return runLoad(load, source, input);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        // the program comes from the snapshot, the variables go in below
+        Snapshot snap;
+        if (!restorePath.empty()) {
+            snap = readSnapshot(restorePath);
+            source = std::move(snap.source);
+            path = restorePath;
+        }
+        auto started = std::chrono::steady_clock::now();
+
+        // ===== Lexing =====
+        // below a few MB spinning up threads costs more than it saves
+        Lexer lexer(source);
+        auto tokens = source.size() >= PARALLEL_LEX_BYTES ? lexer.tokenizeParallel(lexThreads)
+                                                          : lexer.tokenize();
+        auto lexed = std::chrono::steady_clock::now();
+
+        // ===== Parsing =====
+        // lazily parsed bodies keep pointing into tokens until they run
+        Parser parser(tokens, lazyParse);
+        auto program = parser.parse();
+        parser.arrangePhases(program, eachLine);
+        if (lazyParse && validate) {
+            Parser full(tokens);
+            full.parse();
+        }
+        auto parsed = std::chrono::steady_clock::now();
+
+        if (parseOnly) {
+            reportThroughput(source.size(), tokens.size(), program.size(), started, lexed, parsed);
+            return 0;
+        }
+
+        // ===== Ahead-of-time C output =====
+        if (emitC) {
+            if (eachLine) throw std::runtime_error("--each-line does not work with --emit-c");
+            if (lazyParse) throw std::runtime_error("--lazy-parse does not work with --emit-c");
+            CEmitter emitter;
+            std::cout << emitter.emit(program);
+            return 0;
+        }
+
+        // ===== SSA passes =====
+        // they rewrite the tree as the parser left it; the profile wants it as written
+        IrReport irReport;
+        if (!profileShapes || dumpIr) {
+            irReport = optimizeIr(program, ir);
+        }
+        if (dumpIr) {
+            printIr(lowerToIr(program), std::cout);
+            printIrReport(irReport, std::cout);
+            return 0;
+        }
+
+        // ===== Type specialization =====
+        // runs before fusion, fused nodes only match what is still boxed
+        TypeReport types;
+        if ((specialize && !profileShapes) || dumpTypes) {
+            types = specializeTypes(program);
+        }
+        if (dumpTypes) {
+            printTypeReport(types, std::cout);
+            return 0;
+        }
+
+        // ===== Superinstructions =====
+        // the profile looks at the program as written, so it runs unfused
+        if (fuse && !profileShapes) {
+            fuseSuperinstructions(program);
+        }
+
+        // ===== Interpreting =====
+        Interpreter interpreter(limits);
+        if (profileShapes) interpreter.enableShapeProfile();
+        interpreter.fuseLazyBodies(fuse && !profileShapes);
+        if (eachLine) interpreter.useRecords(fieldSeparator);
+        interpreter.useSlots(types);
+        interpreter.keepSource(&source);
+        if (!restorePath.empty()) {
+            if (snap.resumeAt > program.size()) {
+                throw std::runtime_error("snapshot does not match the program: " + restorePath);
+            }
+            interpreter.restore(snap);
+        }
+
+        ExecPosition position;
+        std::unique_ptr<SampleProfiler> sampler;
+        if (sampleHz != 0) {
+            sampler = std::make_unique<SampleProfiler>(position, sampleHz);
+            interpreter.publishPosition(&position);
+        }
+
+        // profiles are written even when the script fails
+        auto writeProfiles = [&]() {
+            std::cout.flush();
+            if (profileShapes) interpreter.dumpShapeProfile(std::cerr, 20);
+            if (sampler) {
+                sampler->stop();
+                writeSamples(*sampler, path, sampleOut);
+            }
+        };
+
+        unsigned long long allocsBefore = allocationCount();
+        try {
+            if (sampler) sampler->start();
+            interpreter.interpret(program, snap.resumeAt);
+        } catch (...) {
+            writeProfiles();
+            throw;
+        }
+        writeProfiles();
+
+        if (allocStats) {
+            std::cout.flush();
+            unsigned long long allocs = allocationCount() - allocsBefore;
+            unsigned long long loops = interpreter.loopIterations();
+            std::cerr << "allocations: " << allocs << "\n";
+            std::cerr << "loop iterations: " << loops << "\n";
+            if (loops != 0) {
+                std::cerr << "allocations per iteration: "
+                          << static_cast<double>(allocs) / static_cast<double>(loops) << "\n";
+            }
+        }
+    } catch (const LimitExceeded& e) {
+        // distinct exit code so a supervisor can tell budget kills from script bugs
+        std::cout.flush();
+        std::cerr << "Limit exceeded: " << e.what() << "\n";
+        return 3;
+    } catch (const std::exception& e) {
+        std::cout.flush();
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
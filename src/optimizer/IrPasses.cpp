@@ -0,0 +1,637 @@
+#include "IrPasses.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+
+#include "SsaIR.h"
+#include "TypeInference.h"
+#include "../interpreter/BinaryOps.h"
+#include "../runtime/Builtins.h"
+#include "../runtime/NumberFormat.h"
+
+// ===== what a pass may touch =====
+
+static bool isNumber(unsigned types) {
+    return types == TYPE_INT || types == TYPE_DOUBLE;
+}
+
+// the number a value always is, when it is a constant one
+static bool numberOf(const IrProgram& ir, int value, double& out) {
+    int c = constantOf(ir, value);
+    if (c < 0) return false;
+    const Value& v = *ir.instrs[c].constant;
+    if (auto i = std::get_if<int>(&v)) {
+        out = *i;
+        return true;
+    }
+    if (auto d = std::get_if<double>(&v)) {
+        out = *d;
+        return true;
+    }
+    return false;
+}
+
+static bool binaryCanThrow(const IrProgram& ir, const IrInstr& in) {
+    static const std::pair<unsigned, size_t> KINDS[] = {
+        { TYPE_INT, VALUE_INT }, { TYPE_DOUBLE, VALUE_DOUBLE }, { TYPE_STRING, VALUE_STRING }
+    };
+    unsigned left = ir.instrs[in.args[0]].types;
+    unsigned right = ir.instrs[in.args[1]].types;
+    if (!(left & ~TYPE_UNSET) || !(right & ~TYPE_UNSET)) return true;
+
+    bool divides = in.binop == TokenTypes::SLASH || in.binop == TokenTypes::MODULUS;
+    for (const auto& l : KINDS) {
+        if (!(left & l.first)) continue;
+        for (const auto& r : KINDS) {
+            if (!(right & r.first)) continue;
+            switch (binaryRule(in.binop, l.second, r.second)) {
+                case BinaryRule::INT_MATH:
+                case BinaryRule::DOUBLE_MATH: {
+                    if (!divides) break;
+                    if (in.binop == TokenTypes::MODULUS && (l.second == VALUE_DOUBLE || r.second == VALUE_DOUBLE)) return true;
+                    // only a constant divisor is known not to be 0 (or -1 under INT_MIN)
+                    double d;
+                    if (!numberOf(ir, in.args[1], d) || d == 0 || d == -1) return true;
+                    break;
+                }
+                case BinaryRule::INT_COMPARE:
+                case BinaryRule::DOUBLE_COMPARE:
+                case BinaryRule::CONCAT:
+                case BinaryRule::STRING_EQUALITY:
+                    break;
+                default:
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+// true unless the instruction surely runs without an error
+static bool canThrow(const IrProgram& ir, const IrInstr& in) {
+    for (int a : in.args) {
+        if (ir.instrs[a].types & TYPE_UNSET) return true;
+    }
+    switch (in.op) {
+        case IrOp::CONST:
+        case IrOp::UNDEF:
+        case IrOp::PHI:
+        case IrOp::SET:
+        case IrOp::RECORD:
+            return false;
+        case IrOp::BINARY:
+            return binaryCanThrow(ir, in);
+        case IrOp::CALL: {
+            // the two builtins that take anything they are given
+            auto id = static_cast<BuiltinId>(in.builtin);
+            if (id == BuiltinId::LEN) return ir.instrs[in.args[0]].types != TYPE_STRING;
+            return id != BuiltinId::TO_STRING;
+        }
+        default:
+            return true; // input, output and whatever the IR does not look into
+    }
+}
+
+// the instruction and the expressions under it
+static bool safeTree(const IrProgram& ir, int id) {
+    const IrInstr& in = ir.instrs[id];
+    if (canThrow(ir, in)) return false;
+    for (int a : in.args) {
+        if (ir.instrs[a].parent == id && !safeTree(ir, a)) return false;
+    }
+    return true;
+}
+
+// worth keeping in a temporary: a number, so the type pass can slot the
+// temporary, worked out without an error
+static bool movable(const IrProgram& ir, const IrInstr& in) {
+    if (!in.site || !isNumber(in.types)) return false;
+    if (in.op == IrOp::BINARY) return !canThrow(ir, in);
+    return in.op == IrOp::CALL && static_cast<BuiltinId>(in.builtin) == BuiltinId::LEN && !canThrow(ir, in);
+}
+
+// ===== value numbers =====
+// movable expressions on the same operands get the same number; operands
+// are copies looked through, constants by value, or the number of the
+// expression under them
+
+static int root(const IrProgram& ir, int value) {
+    while (ir.instrs[value].op == IrOp::SET) value = ir.instrs[value].args[0];
+    return value;
+}
+
+static std::vector<long> valueNumbers(const IrProgram& ir) {
+    std::vector<long> numbers(ir.instrs.size(), -1);
+    std::unordered_map<std::string, long> byKey;
+
+    auto operand = [&](int a) {
+        int r = root(ir, a);
+        if (numbers[r] >= 0) return "#" + std::to_string(numbers[r]);
+        int c = constantOf(ir, a);
+        if (c >= 0) {
+            const Value& v = *ir.instrs[c].constant;
+            if (auto i = std::get_if<int>(&v)) return "i" + std::to_string(*i);
+            if (auto d = std::get_if<double>(&v)) return "d" + formatDouble(*d);
+        }
+        return "%" + std::to_string(r);
+    };
+
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        const IrInstr& in = ir.instrs[i];
+        if (in.removed || !movable(ir, in)) continue;
+        std::vector<std::string> ops;
+        for (int a : in.args) ops.push_back(operand(a));
+        bool commutes = in.op == IrOp::BINARY &&
+                        (in.binop == TokenTypes::PLUS || in.binop == TokenTypes::ASTERISK ||
+                         in.binop == TokenTypes::EQUAL_EQUAL || in.binop == TokenTypes::NOT_EQUAL);
+        if (commutes) std::sort(ops.begin(), ops.end());
+
+        std::string key = in.op == IrOp::BINARY ? std::to_string(static_cast<int>(in.binop)) : "len";
+        for (const auto& o : ops) key += " " + o;
+        auto it = byKey.emplace(key, static_cast<long>(byKey.size())).first;
+        numbers[i] = it->second;
+    }
+    return numbers;
+}
+
+// ===== tree edits =====
+// statements to put in front of others and statements to drop, done per
+// list once a pass has decided, so the anchors stay valid until then
+
+struct ListEdits {
+    std::unordered_map<const Stmt*, std::vector<std::unique_ptr<Stmt>>> before;
+    std::unordered_set<const Stmt*> dropped;
+};
+
+class TreeEdits {
+public:
+    void insertBefore(const IrAnchor& at, std::unique_ptr<Stmt> s) {
+        lists[at.list].before[at.stmt].push_back(std::move(s));
+    }
+
+    void drop(const IrAnchor& at) {
+        lists[at.list].dropped.insert(at.stmt);
+    }
+
+    void apply() {
+        for (auto& entry : lists) {
+            std::vector<std::unique_ptr<Stmt>>& list = *entry.first;
+            ListEdits& edits = entry.second;
+            std::vector<std::unique_ptr<Stmt>> out;
+            out.reserve(list.size());
+            for (auto& s : list) {
+                auto b = edits.before.find(s.get());
+                if (b != edits.before.end()) {
+                    for (auto& added : b->second) out.push_back(std::move(added));
+                }
+                if (!edits.dropped.count(s.get())) out.push_back(std::move(s));
+            }
+            list = std::move(out);
+        }
+        lists.clear();
+    }
+
+private:
+    std::unordered_map<std::vector<std::unique_ptr<Stmt>>*, ListEdits> lists;
+};
+
+// the passes share one counter so no two temporaries get the same name
+class Temps {
+public:
+    std::string next() { return "%t" + std::to_string(++count); }
+
+    // computes the expression at `site` into a new temporary before `at`
+    // and reads the temporary there instead
+    std::string hoist(IrProgram& ir, int id, int at, TreeEdits& edits) {
+        std::string name = next();
+        std::unique_ptr<Expr>& site = *ir.instrs[id].site;
+        const IrAnchor& anchor = ir.anchors[at];
+        auto assign = std::make_unique<AssignStmt>(name, std::move(site));
+        assign->line = anchor.stmt->line;
+        edits.insertBefore(anchor, std::move(assign));
+        site = std::make_unique<VariableExpr>(name);
+        return name;
+    }
+
+private:
+    int count = 0;
+};
+
+// true when the instruction or one around it was already replaced
+static bool replacedAbove(const IrProgram& ir, const std::vector<char>& replaced, int id) {
+    for (; id != -1; id = ir.instrs[id].parent) {
+        if (replaced[id]) return true;
+    }
+    return false;
+}
+
+// ===== strength reduction =====
+
+// the value of a constant operator on constants, false when it would throw
+// or is not a number
+static bool foldBinary(TokenTypes op, const Value& l, const Value& r, Value& out) {
+    auto asDouble = [](const Value& v) {
+        return std::holds_alternative<int>(v) ? static_cast<double>(std::get<int>(v)) : std::get<double>(v);
+    };
+    bool divides = op == TokenTypes::SLASH || op == TokenTypes::MODULUS;
+    switch (binaryRule(op, l.index(), r.index())) {
+        case BinaryRule::INT_MATH: {
+            long long a = std::get<int>(l), b = std::get<int>(r);
+            if (divides && (b == 0 || b == -1)) return false;
+            // wraps the way the interpreter does
+            switch (op) {
+                case TokenTypes::PLUS:     out = static_cast<int>(static_cast<unsigned>(a + b)); break;
+                case TokenTypes::MINUS:    out = static_cast<int>(static_cast<unsigned>(a - b)); break;
+                case TokenTypes::ASTERISK: out = static_cast<int>(static_cast<unsigned>(a * b)); break;
+                default:                   out = arithmetic<int>(op, static_cast<int>(a), static_cast<int>(b)); break;
+            }
+            return true;
+        }
+        case BinaryRule::DOUBLE_MATH:
+            if (op == TokenTypes::MODULUS || (divides && asDouble(r) == 0)) return false;
+            out = arithmetic<double>(op, asDouble(l), asDouble(r));
+            return true;
+        case BinaryRule::INT_COMPARE:
+            out = comparison<int>(op, std::get<int>(l), std::get<int>(r));
+            return true;
+        case BinaryRule::DOUBLE_COMPARE:
+            out = comparison<double>(op, asDouble(l), asDouble(r));
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 4.0 -> 0.25 with nothing lost
+static bool exactReciprocal(double c) {
+    if (c == 0 || !std::isfinite(c)) return false;
+    int exponent;
+    double mantissa = std::frexp(c, &exponent);
+    return (mantissa == 0.5 || mantissa == -0.5) && std::isnormal(1.0 / c);
+}
+
+class StrengthPass {
+public:
+    StrengthPass(IrProgram& ir, IrReport& report) : ir(ir), report(report) {}
+
+    void run() {
+        for (size_t i = 0; i < ir.instrs.size(); i++) {
+            IrInstr& in = ir.instrs[i];
+            if (in.removed || in.op != IrOp::BINARY || !in.site) continue;
+            int id = static_cast<int>(i);
+            Value v;
+            const Value* l = known(in.args[0]);
+            const Value* r = known(in.args[1]);
+            if (l && r && foldBinary(in.binop, *l, *r, v)) {
+                // written at once, an operator around it replaces it again
+                *in.site = std::make_unique<literalExpressions>(v);
+                folded[id] = std::move(v);
+                continue;
+            }
+            if (reduce(id)) report.reduced++;
+        }
+
+        for (const auto& f : folded) {
+            int parent = ir.instrs[f.first].parent;
+            if (parent == -1 || !folded.count(parent)) report.folded++;
+        }
+    }
+
+private:
+    IrProgram& ir;
+    IrReport& report;
+    std::unordered_map<int, Value> folded;
+
+    const Value* known(int value) {
+        auto it = folded.find(value);
+        if (it != folded.end()) return &it->second;
+        int c = constantOf(ir, value);
+        return c >= 0 ? ir.instrs[c].constant : nullptr;
+    }
+
+    bool constantNumber(int value, double& out) {
+        const Value* v = known(value);
+        if (!v || std::holds_alternative<std::string>(*v)) return false;
+        out = std::holds_alternative<int>(*v) ? std::get<int>(*v) : std::get<double>(*v);
+        return true;
+    }
+
+    // x op c or c op x, when the answer is x itself or something cheaper
+    bool reduce(int id) {
+        IrInstr& in = ir.instrs[id];
+        auto bin = dynamic_cast<BinaryExpr*>(in.site->get());
+        if (!bin || canThrow(ir, in)) return false;
+        unsigned lt = ir.instrs[in.args[0]].types;
+        unsigned rt = ir.instrs[in.args[1]].types;
+        if (!isNumber(lt) || !isNumber(rt)) return false;
+
+        double lc = 0, rc = 0;
+        bool lk = constantNumber(in.args[0], lc);
+        bool rk = constantNumber(in.args[1], rc);
+        if (lk == rk) return false;
+
+        bool onRight = rk;
+        double c = onRight ? rc : lc;
+        int x = onRight ? in.args[0] : in.args[1];
+        unsigned xt = onRight ? lt : rt;
+        unsigned ct = onRight ? rt : lt;
+        std::unique_ptr<Expr>& xExpr = onRight ? bin->left : bin->right;
+        // an int constant never turns a double into an int, a double one
+        // would turn an int into a double
+        bool keepsType = xt == ct || xt == TYPE_DOUBLE;
+        TokenTypes op = in.binop;
+
+        std::unique_ptr<Expr> out;
+        if (keepsType && ((op == TokenTypes::PLUS && c == 0 && xt == TYPE_INT) ||
+                          (op == TokenTypes::MINUS && c == 0 && onRight) ||
+                          (op == TokenTypes::ASTERISK && c == 1) ||
+                          (op == TokenTypes::SLASH && c == 1 && onRight))) {
+            out = std::move(xExpr);
+        } else if (op == TokenTypes::ASTERISK && c == 0 && xt == TYPE_INT && ct == TYPE_INT &&
+                   (ir.instrs[x].parent != id || safeTree(ir, x))) {
+            out = std::make_unique<literalExpressions>(0);
+        } else if (op == TokenTypes::ASTERISK && c == 2 && keepsType && dynamic_cast<VariableExpr*>(xExpr.get())) {
+            const std::string& name = static_cast<VariableExpr*>(xExpr.get())->n;
+            out = std::make_unique<BinaryExpr>(TokenTypes::PLUS, std::make_unique<VariableExpr>(name),
+                                               std::make_unique<VariableExpr>(name));
+        } else if (op == TokenTypes::SLASH && onRight && (xt == TYPE_DOUBLE || ct == TYPE_DOUBLE) && exactReciprocal(c)) {
+            out = std::make_unique<BinaryExpr>(TokenTypes::ASTERISK, std::move(xExpr),
+                                               std::make_unique<literalExpressions>(1.0 / c));
+        } else {
+            return false;
+        }
+        *in.site = std::move(out);
+        return true;
+    }
+};
+
+// ===== loop-invariant code motion =====
+
+static void hoistInvariants(IrProgram& ir, Temps& temps, IrReport& report) {
+    std::vector<long> numbers = valueNumbers(ir);
+    std::vector<char> replaced(ir.instrs.size(), 0);
+    TreeEdits edits;
+
+    for (const IrLoop& loop : ir.loops) {
+        if (loop.anchor < 0) continue;
+        auto inLoop = [&](int id) {
+            int b = ir.instrs[id].block;
+            return b >= loop.first && b < loop.end;
+        };
+
+        // operands come from outside the loop or are invariant themselves
+        std::vector<char> invariant(ir.instrs.size(), 0);
+        std::vector<int> found;
+        for (int b = loop.first; b < loop.end; b++) {
+            for (int id : ir.blocks[b].instrs) {
+                const IrInstr& in = ir.instrs[id];
+                if (in.op == IrOp::CONST) {
+                    invariant[id] = 1;
+                    continue;
+                }
+                if (numbers[id] < 0) continue;
+                bool ok = true;
+                for (int a : in.args) ok = ok && (invariant[a] || !inLoop(a));
+                if (!ok) continue;
+                invariant[id] = 1;
+                found.push_back(id);
+            }
+        }
+
+        // the biggest invariant expressions, one temporary per value
+        std::unordered_map<long, std::string> temp;
+        for (int id : found) {
+            int parent = ir.instrs[id].parent;
+            if ((parent != -1 && invariant[parent]) || replacedAbove(ir, replaced, id)) continue;
+            auto it = temp.find(numbers[id]);
+            if (it == temp.end()) {
+                temp[numbers[id]] = temps.hoist(ir, id, loop.anchor, edits);
+                report.hoisted++;
+            } else {
+                *ir.instrs[id].site = std::make_unique<VariableExpr>(it->second);
+                report.shared++;
+            }
+            replaced[id] = 1;
+        }
+    }
+    edits.apply();
+}
+
+// ===== common subexpressions =====
+
+static void shareValues(IrProgram& ir, Temps& temps, IrReport& report) {
+    std::vector<long> numbers = valueNumbers(ir);
+
+    // the first evaluation on every path is the one that keeps the value
+    // {an instruction in a block the leader's block dominates}
+    std::vector<std::vector<int>> children(ir.blocks.size());
+    for (size_t b = 1; b < ir.blocks.size(); b++) {
+        if (ir.idom[b] >= 0) children[ir.idom[b]].push_back(static_cast<int>(b));
+    }
+    std::unordered_map<long, int> leaders;
+    std::unordered_map<int, std::vector<int>> members;
+    std::vector<std::pair<int, size_t>> stack = { { 0, 0 } };
+    std::vector<std::vector<long>> added(ir.blocks.size());
+
+    auto enter = [&](int b) {
+        for (int id : ir.blocks[b].instrs) {
+            long n = numbers[id];
+            if (n < 0) continue;
+            auto it = leaders.find(n);
+            if (it != leaders.end()) {
+                members[it->second].push_back(id);
+            } else if (ir.instrs[id].anchor >= 0) {
+                leaders[n] = id;
+                added[b].push_back(n);
+            }
+        }
+    };
+    enter(0);
+    while (!stack.empty()) {
+        int b = stack.back().first;
+        size_t& next = stack.back().second;
+        if (next < children[b].size()) {
+            int c = children[b][next++];
+            enter(c);
+            stack.push_back({ c, 0 });
+            continue;
+        }
+        for (long n : added[b]) leaders.erase(n);
+        stack.pop_back();
+    }
+
+    // bigger expressions first, so a shared one takes the ones inside it along
+    std::vector<int> order;
+    for (const auto& m : members) order.push_back(m.first);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (ir.instrs[a].size != ir.instrs[b].size) return ir.instrs[a].size > ir.instrs[b].size;
+        return a < b;
+    });
+
+    std::vector<char> replaced(ir.instrs.size(), 0);
+    TreeEdits edits;
+    for (int leader : order) {
+        if (replacedAbove(ir, replaced, leader)) continue;
+        std::vector<int> kept;
+        for (int m : members[leader]) {
+            if (!replacedAbove(ir, replaced, m)) kept.push_back(m);
+        }
+        if (kept.empty()) continue;
+
+        std::string name = temps.hoist(ir, leader, ir.instrs[leader].anchor, edits);
+        replaced[leader] = 1;
+        for (int m : kept) {
+            *ir.instrs[m].site = std::make_unique<VariableExpr>(name);
+            replaced[m] = 1;
+            report.shared++;
+        }
+    }
+    edits.apply();
+}
+
+// ===== dead code =====
+
+static bool constantCondition(const IrProgram& ir, int value, bool& truth) {
+    double d;
+    if (!numberOf(ir, value, d)) return false;
+    truth = d != 0;
+    return true;
+}
+
+static size_t indexIn(const IrAnchor& at) {
+    for (size_t i = 0; i < at.list->size(); i++) {
+        if ((*at.list)[i].get() == at.stmt) return i;
+    }
+    return at.list->size();
+}
+
+static void removeDeadCode(IrProgram& ir, IrReport& report) {
+    // live: has an effect, is kept because something in it may throw, or
+    // feeds something live. A kept statement reads everything in it.
+    std::vector<char> live(ir.instrs.size(), 0);
+    std::vector<int> work;
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        const IrInstr& in = ir.instrs[i];
+        if (in.removed) continue;
+        bool root = in.op == IrOp::OUT || in.op == IrOp::USE || in.op == IrOp::BRANCH ||
+                    in.op == IrOp::INPUT || in.op == IrOp::OPAQUE ||
+                    (in.op == IrOp::SET && in.anchor < 0);
+        bool evaluated = in.op != IrOp::CONST && in.op != IrOp::UNDEF && in.op != IrOp::PHI;
+        if (!root && !(evaluated && canThrow(ir, in))) continue;
+        int top = static_cast<int>(i);
+        while (ir.instrs[top].parent != -1) top = ir.instrs[top].parent;
+        if (!live[top]) {
+            live[top] = 1;
+            work.push_back(top);
+        }
+    }
+    while (!work.empty()) {
+        int id = work.back();
+        work.pop_back();
+        for (int a : ir.instrs[id].args) {
+            if (!live[a]) {
+                live[a] = 1;
+                work.push_back(a);
+            }
+        }
+    }
+
+    TreeEdits edits;
+    for (const IrInstr& in : ir.instrs) {
+        if (in.op != IrOp::SET || in.anchor < 0 || live[&in - &ir.instrs[0]]) continue;
+        int value = in.args[0];
+        if (ir.instrs[value].parent == &in - &ir.instrs[0] && !safeTree(ir, value)) continue;
+        edits.drop(ir.anchors[in.anchor]);
+        report.deadStores++;
+    }
+    for (int at : ir.unreachable) {
+        edits.drop(ir.anchors[at]);
+        report.deadCode++;
+    }
+
+    // ifs that always take one branch, whiles that never run
+    std::vector<std::pair<int, bool>> decided; // anchor, which way
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        const IrInstr& in = ir.instrs[i];
+        bool truth;
+        if (in.op != IrOp::BRANCH || in.anchor < 0 || !constantCondition(ir, in.args[0], truth)) continue;
+        if (ir.instrs[in.args[0]].parent == static_cast<int>(i) && !safeTree(ir, in.args[0])) continue;
+        decided.push_back({ in.anchor, truth });
+    }
+    for (const IrLoop& loop : ir.loops) {
+        if (loop.anchor < 0 || loop.branch < 0) continue;
+        if (!dynamic_cast<WhileStmt*>(ir.anchors[loop.anchor].stmt)) continue;
+        bool truth;
+        int cond = ir.instrs[loop.branch].args[0];
+        if (constantCondition(ir, cond, truth) && !truth && safeTree(ir, cond)) decided.push_back({ loop.anchor, false });
+    }
+    edits.apply();
+
+    // inner statements first: an outer one may throw away the list they sit in
+    std::sort(decided.begin(), decided.end(), [](const std::pair<int, bool>& a, const std::pair<int, bool>& b) {
+        return a.first > b.first;
+    });
+    for (const auto& d : decided) {
+        const IrAnchor& at = ir.anchors[d.first];
+        size_t i = indexIn(at);
+        if (i == at.list->size()) continue;
+        std::vector<std::unique_ptr<Stmt>> taken;
+        if (auto ifStmt = dynamic_cast<IfStmt*>(at.stmt)) taken = std::move(d.second ? ifStmt->thenBody : ifStmt->elseBody);
+        at.list->erase(at.list->begin() + i);
+        at.list->insert(at.list->begin() + i, std::make_move_iterator(taken.begin()), std::make_move_iterator(taken.end()));
+        report.deadCode++;
+    }
+}
+
+// ===== the pipeline =====
+
+// statements the passes have rewritten so far
+static size_t rewrites(const IrReport& r) {
+    return r.folded + r.reduced + r.hoisted + r.shared + r.deadStores + r.deadCode;
+}
+
+IrReport optimizeIr(std::vector<std::unique_ptr<Stmt>>& program, const IrOptions& options) {
+    IrReport report;
+    if (!options.strength && !options.licm && !options.cse && !options.dce && !options.dump) {
+        return report; // nothing would use the lowering
+    }
+    IrProgram ir = lowerToIr(program, options.maxInstrs);
+    bool snapshots = false;
+    for (const IrInstr& in : ir.instrs) {
+        snapshots = snapshots || (in.op == IrOp::CALL && static_cast<BuiltinId>(in.builtin) == BuiltinId::SNAPSHOT);
+    }
+    if (ir.opaque || snapshots) {
+        report.skipped = true;
+        return report;
+    }
+
+    // a pass that changed nothing leaves the IR as good as new
+    size_t lowered = 0;
+    auto fresh = [&]() -> IrProgram& {
+        if (rewrites(report) != lowered) {
+            ir = lowerToIr(program, options.maxInstrs);
+            lowered = rewrites(report);
+        }
+        return ir;
+    };
+
+    Temps temps;
+    if (options.strength) StrengthPass(fresh(), report).run();
+    if (options.licm) hoistInvariants(fresh(), temps, report);
+    if (options.cse) shareValues(fresh(), temps, report);
+    if (options.dce) removeDeadCode(fresh(), report);
+    return report;
+}
+
+void printIrReport(const IrReport& report, std::ostream& os) {
+    if (report.skipped) {
+        os << "# passes skipped: the program calls snapshot(), is too big or holds a form the IR does not describe\n";
+        return;
+    }
+    os << "# folded " << report.folded << ", reduced " << report.reduced
+       << ", hoisted " << report.hoisted << ", shared " << report.shared << "\n";
+    os << "# dead stores " << report.deadStores << ", dead code " << report.deadCode << "\n";
+}
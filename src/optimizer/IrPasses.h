@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "../parser/AST.h"
+
+// The passes run on the SSA IR {see SsaIR.h}, before types and fusion.
+// Each one lowers the program again, decides on the IR and rewrites the tree:
+//   - strength reduction works out operators on constants and turns
+//     x * 1, x + 0, x * 2 and x / 4.0 into x, x, x + x and x * 0.25
+//     where the operand types say the result is the same
+//   - loop-invariant code motion computes an expression whose operands
+//     the loop never changes once, into a temporary before the loop
+//   - common subexpression elimination keeps an expression's value in a
+//     temporary when it is computed again on the same values
+//   - dead code elimination drops stores nothing reads, statements after
+//     a break, and ifs and whiles on a constant
+// Only expressions that cannot throw are moved, shared or dropped, and
+// temporaries only ever hold numbers, so every error still happens where
+// and as it did. Temporaries are named %t1, %t2, ..., which a script
+// cannot write. Programs that call snapshot() are left alone: the file
+// records where the program stopped by statement. So are programs that
+// spawn tasks, whose variables change whenever a task waits, and programs
+// that lower to more than maxInstrs instructions.
+
+struct IrOptions {
+    bool strength = true;
+    bool licm = true;
+    bool cse = true;
+    bool dce = true;
+    bool dump = false; // --dump-ir wants the report even with every pass off
+    // bigger programs {a few thousand lines} run as they are: lowering
+    // takes about half a microsecond an instruction, up to four times
+    size_t maxInstrs = 1 << 16;
+};
+
+struct IrReport {
+    size_t folded = 0;
+    size_t reduced = 0;
+    size_t hoisted = 0;    // expressions computed before their loop
+    size_t shared = 0;     // expressions that reuse an earlier value
+    size_t deadStores = 0;
+    size_t deadCode = 0;   // statements dropped or ifs replaced by one branch
+    bool skipped = false;
+};
+
+IrReport optimizeIr(std::vector<std::unique_ptr<Stmt>>& program, const IrOptions& options);
+
+// the counts, as comment lines after --dump-ir
+void printIrReport(const IrReport& report, std::ostream& os);
@@ -0,0 +1,760 @@
+#include "SsaIR.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <variant>
+
+#include "../runtime/NumberFormat.h"
+
+// ===== lowering =====
+
+using VarMap = std::map<std::string, int>;
+
+// control leaving `block` with these values in the variables
+struct IrEdge {
+    int block;
+    VarMap vars;
+};
+
+static void collectWrites(const std::vector<std::unique_ptr<Stmt>>& list, std::set<std::string>& out);
+
+// every name a statement can assign, for the phis at the head of a loop
+static void collectWrites(const Stmt* s, std::set<std::string>& out) {
+    if (auto assign = dynamic_cast<const AssignStmt*>(s)) {
+        out.insert(assign->name);
+    } else if (auto input = dynamic_cast<const InputStmt*>(s)) {
+        out.insert(input->name);
+    } else if (auto block = dynamic_cast<const BlockStmt*>(s)) {
+        collectWrites(block->statements, out);
+    } else if (auto ifStmt = dynamic_cast<const IfStmt*>(s)) {
+        collectWrites(ifStmt->thenBody, out);
+        collectWrites(ifStmt->elseBody, out);
+    } else if (auto whileStmt = dynamic_cast<const WhileStmt*>(s)) {
+        collectWrites(whileStmt->body, out);
+    } else if (auto forStmt = dynamic_cast<const ForStmt*>(s)) {
+        collectWrites(forStmt->init.get(), out);
+        collectWrites(forStmt->update.get(), out);
+        collectWrites(forStmt->body, out);
+    } else if (auto each = dynamic_cast<const EachLineStmt*>(s)) {
+        collectWrites(each->bind, out);
+        collectWrites(each->body, out);
+    } else if (auto phase = dynamic_cast<const PhaseStmt*>(s)) {
+        collectWrites(phase->body, out);
+    } else if (auto lazy = dynamic_cast<const LazyBlockStmt*>(s)) {
+        out.insert(lazy->names.begin(), lazy->names.end());
+    }
+}
+
+static void collectWrites(const std::vector<std::unique_ptr<Stmt>>& list, std::set<std::string>& out) {
+    for (const auto& s : list) collectWrites(s.get(), out);
+}
+
+// thrown by the builder past its limit
+struct IrTooBig {};
+
+class IrBuilder {
+public:
+    IrProgram ir;
+    size_t limit = 0;
+
+    void run(std::vector<std::unique_ptr<Stmt>>& program) {
+        current = newBlock("entry", 0);
+        stmts(program);
+        auto& entry = ir.blocks[0].instrs;
+        entry.insert(entry.begin(), undefOrder.rbegin(), undefOrder.rend());
+        simplifyPhis();
+        inferTypes();
+        dominators();
+    }
+
+private:
+    int current = -1;
+    bool reachable = true;
+    VarMap vars;
+    std::unordered_map<std::string, int> undefs;
+    std::vector<int> undefOrder; // go in front of block 0 once lowering is done
+    std::vector<std::vector<IrEdge>> breaks; // per enclosing loop
+    size_t depth = 0; // of the expression being lowered
+
+    int newBlock(const char* what, int line) {
+        IrBlock b;
+        b.what = what;
+        b.line = line;
+        ir.blocks.push_back(std::move(b));
+        return static_cast<int>(ir.blocks.size()) - 1;
+    }
+
+    void grow() {
+        if (limit != 0 && ir.instrs.size() >= limit) throw IrTooBig();
+    }
+
+    int emitIn(int block, IrInstr in) {
+        grow();
+        in.block = block;
+        ir.instrs.push_back(std::move(in));
+        int id = static_cast<int>(ir.instrs.size()) - 1;
+        ir.blocks[block].instrs.push_back(id);
+        return id;
+    }
+
+    int emit(IrInstr in) { return emitIn(current, std::move(in)); }
+
+    static IrInstr make(IrOp op, std::vector<int> args = {}) {
+        IrInstr in;
+        in.op = op;
+        in.args = std::move(args);
+        return in;
+    }
+
+    // one UNDEF per name, at the top of the entry block
+    int value(const std::string& name) {
+        auto it = vars.find(name);
+        if (it != vars.end()) return it->second;
+        auto u = undefs.find(name);
+        if (u != undefs.end()) return u->second;
+        grow();
+        IrInstr in = make(IrOp::UNDEF);
+        in.name = name;
+        in.block = 0;
+        ir.instrs.push_back(std::move(in));
+        int id = static_cast<int>(ir.instrs.size()) - 1;
+        undefs[name] = id;
+        undefOrder.push_back(id);
+        return id;
+    }
+
+    int valueIn(const VarMap& map, const std::string& name) {
+        auto it = map.find(name);
+        return it != map.end() ? it->second : value(name);
+    }
+
+    // sends `from` to `to`: fills the open target of its branch, or adds a jump
+    void link(int from, int to) {
+        auto& list = ir.blocks[from].instrs;
+        if (!list.empty()) {
+            IrInstr& last = ir.instrs[list.back()];
+            if (last.op == IrOp::BRANCH || last.op == IrOp::JUMP) {
+                for (int& t : last.targets) {
+                    if (t == -1) {
+                        t = to;
+                        ir.blocks[to].preds.push_back(from);
+                        return;
+                    }
+                }
+            }
+        }
+        IrInstr jump = make(IrOp::JUMP);
+        jump.targets.push_back(to);
+        emitIn(from, std::move(jump));
+        ir.blocks[to].preds.push_back(from);
+    }
+
+    // a block where the edges meet, with a phi for every variable whose value differs
+    void joinAt(const std::vector<IrEdge>& edges, const char* what, int line) {
+        if (edges.empty()) {
+            reachable = false;
+            return;
+        }
+        int join = newBlock(what, line);
+        for (const auto& e : edges) link(e.block, join);
+        current = join;
+        reachable = true;
+        if (edges.size() == 1) {
+            vars = edges[0].vars;
+            return;
+        }
+
+        std::set<std::string> names;
+        for (const auto& e : edges) {
+            for (const auto& v : e.vars) names.insert(v.first);
+        }
+        VarMap merged;
+        for (const auto& name : names) {
+            std::vector<int> values;
+            for (const auto& e : edges) values.push_back(valueIn(e.vars, name));
+            bool same = true;
+            for (int v : values) same = same && v == values[0];
+            if (same) {
+                merged[name] = values[0];
+                continue;
+            }
+            IrInstr phi = make(IrOp::PHI, std::move(values));
+            phi.name = name;
+            merged[name] = emit(std::move(phi));
+        }
+        vars = std::move(merged);
+    }
+
+    struct LoopHead {
+        int block;
+        std::vector<std::pair<std::string, int>> phis;
+    };
+
+    // the block the loop comes back to, with a phi for each name it assigns;
+    // the second operands are added by closeLoop
+    LoopHead openLoop(const std::set<std::string>& writes, const char* what, int line) {
+        LoopHead head;
+        head.block = newBlock(what, line);
+        link(current, head.block);
+        current = head.block;
+        for (const auto& name : writes) {
+            IrInstr phi = make(IrOp::PHI, { value(name) });
+            phi.name = name;
+            int id = emit(std::move(phi));
+            vars[name] = id;
+            head.phis.push_back({ name, id });
+        }
+        return head;
+    }
+
+    void closeLoop(const LoopHead& head) {
+        if (!reachable) return;
+        link(current, head.block);
+        for (const auto& p : head.phis) ir.instrs[p.second].args.push_back(value(p.first));
+    }
+
+    int beginLoopRecord(int anchor) {
+        ir.loops.push_back({ static_cast<int>(ir.blocks.size()), 0, anchor, -1 });
+        return static_cast<int>(ir.loops.size()) - 1;
+    }
+
+    // ----- statements -----
+
+    void stmts(std::vector<std::unique_ptr<Stmt>>& list) {
+        for (auto& s : list) {
+            int anchor = static_cast<int>(ir.anchors.size());
+            ir.anchors.push_back({ s.get(), &list });
+            if (!reachable) {
+                ir.unreachable.push_back(anchor);
+                continue;
+            }
+            stmt(s.get(), anchor);
+        }
+    }
+
+    // the statements of a list no temporary may go in front of
+    void stmtsUnanchored(std::vector<std::unique_ptr<Stmt>>& list) {
+        for (auto& s : list) {
+            if (reachable) stmt(s.get(), -1);
+        }
+    }
+
+    void stmt(Stmt* s, int anchor) {
+        if (auto assign = dynamic_cast<AssignStmt*>(s)) {
+            int made;
+            int v = expr(assign->expression, anchor, made);
+            IrInstr set = make(IrOp::SET, { v });
+            set.name = assign->name;
+            set.anchor = anchor;
+            vars[assign->name] = adopt(made, emit(std::move(set)));
+            return;
+        }
+
+        if (auto input = dynamic_cast<InputStmt*>(s)) {
+            IrInstr in = make(IrOp::INPUT);
+            in.name = input->name;
+            vars[input->name] = emit(std::move(in));
+            return;
+        }
+
+        if (auto print = dynamic_cast<PrintStmt*>(s)) {
+            int made;
+            int v = expr(print->expression, anchor, made);
+            adopt(made, emit(make(IrOp::OUT, { v })));
+            return;
+        }
+
+        if (auto block = dynamic_cast<BlockStmt*>(s)) {
+            stmts(block->statements);
+            return;
+        }
+
+        if (auto phase = dynamic_cast<PhaseStmt*>(s)) {
+            stmts(phase->body);
+            return;
+        }
+
+        if (dynamic_cast<BreakStmt*>(s)) {
+            if (!breaks.empty()) {
+                IrInstr jump = make(IrOp::JUMP);
+                jump.targets.push_back(-1);
+                emit(std::move(jump));
+                breaks.back().push_back({ current, vars });
+            }
+            reachable = false;
+            return;
+        }
+
+        if (auto ifStmt = dynamic_cast<IfStmt*>(s)) {
+            int made;
+            int cond = expr(ifStmt->condition, anchor, made);
+            int from = current;
+            int thenBlock = newBlock("then", s->line);
+            int elseBlock = newBlock("else", s->line);
+            IrInstr branch = make(IrOp::BRANCH, { cond });
+            branch.targets = { thenBlock, elseBlock };
+            branch.anchor = anchor;
+            adopt(made, emit(std::move(branch)));
+            ir.blocks[thenBlock].preds.push_back(from);
+            ir.blocks[elseBlock].preds.push_back(from);
+
+            VarMap before = vars;
+            std::vector<IrEdge> edges;
+            current = thenBlock;
+            stmts(ifStmt->thenBody);
+            if (reachable) edges.push_back({ current, std::move(vars) });
+
+            vars = std::move(before);
+            reachable = true;
+            current = elseBlock;
+            stmts(ifStmt->elseBody);
+            if (reachable) edges.push_back({ current, std::move(vars) });
+
+            joinAt(edges, "end if", s->line);
+            return;
+        }
+
+        if (auto whileStmt = dynamic_cast<WhileStmt*>(s)) {
+            std::set<std::string> writes;
+            collectWrites(whileStmt->body, writes);
+            int loop = beginLoopRecord(anchor);
+
+            LoopHead head = openLoop(writes, "while", s->line);
+            loopBody(whileStmt->condition, whileStmt->body, nullptr, head, loop);
+            return;
+        }
+
+        if (auto forStmt = dynamic_cast<ForStmt*>(s)) {
+            std::set<std::string> writes;
+            collectWrites(forStmt->update.get(), writes);
+            collectWrites(forStmt->body, writes);
+            int loop = beginLoopRecord(anchor);
+
+            // the init is part of the loop, so nothing it sets looks invariant
+            int init = newBlock("for", s->line);
+            link(current, init);
+            current = init;
+            stmt(forStmt->init.get(), -1);
+
+            LoopHead head = openLoop(writes, "for condition", s->line);
+            loopBody(forStmt->condition, forStmt->body, forStmt->update.get(), head, loop);
+            return;
+        }
+
+        if (auto each = dynamic_cast<EachLineStmt*>(s)) {
+            std::set<std::string> writes;
+            collectWrites(each->bind, writes);
+            collectWrites(each->body, writes);
+            int loop = beginLoopRecord(anchor);
+
+            LoopHead head = openLoop(writes, "each line", s->line);
+            IrInstr more = make(IrOp::OPAQUE);
+            more.name = "line left";
+            int cond = emit(std::move(more));
+            int body = newBlock("each line body", s->line);
+            IrInstr branch = make(IrOp::BRANCH, { cond });
+            branch.targets = { body, -1 };
+            emit(std::move(branch));
+            ir.blocks[body].preds.push_back(head.block);
+            VarMap headVars = vars;
+
+            current = body;
+            stmtsUnanchored(each->bind);
+            stmts(each->body);
+            closeLoop(head);
+
+            ir.loops[loop].end = static_cast<int>(ir.blocks.size());
+            joinAt({ { head.block, std::move(headVars) } }, "after each line", s->line);
+            return;
+        }
+
+        if (auto lazy = dynamic_cast<LazyBlockStmt*>(s)) {
+            std::vector<int> reads;
+            for (const auto& name : lazy->names) reads.push_back(value(name));
+            emit(make(IrOp::USE, std::move(reads)));
+            for (const auto& name : lazy->names) {
+                IrInstr changed = make(IrOp::OPAQUE, { value(name) });
+                changed.name = name;
+                vars[name] = emit(std::move(changed));
+            }
+            if (lazy->hasBreak && !breaks.empty()) {
+                IrInstr left = make(IrOp::OPAQUE);
+                left.name = "broke";
+                int cond = emit(std::move(left));
+                int next = newBlock("after lazy break", s->line);
+                IrInstr branch = make(IrOp::BRANCH, { cond });
+                branch.targets = { next, -1 };
+                emit(std::move(branch));
+                ir.blocks[next].preds.push_back(current);
+                breaks.back().push_back({ current, vars });
+                current = next;
+            }
+            return;
+        }
+
+        // a spawn body runs between any two waits of the rest, which the
+        // blocks cannot show; typed and fused forms come later
+        ir.opaque = true;
+    }
+
+    // condition, body and (for a for loop) update, then the block after the loop
+    void loopBody(std::unique_ptr<Expr>& condition, std::vector<std::unique_ptr<Stmt>>& body,
+                  Stmt* update, const LoopHead& head, int loop) {
+        int made;
+        int cond = expr(condition, -1, made);
+        int bodyBlock = newBlock(update ? "for body" : "while body", ir.blocks[head.block].line);
+        IrInstr branch = make(IrOp::BRANCH, { cond });
+        branch.targets = { bodyBlock, -1 };
+        ir.loops[loop].branch = adopt(made, emit(std::move(branch)));
+        ir.blocks[bodyBlock].preds.push_back(head.block);
+        VarMap headVars = vars;
+
+        current = bodyBlock;
+        breaks.emplace_back();
+        stmts(body);
+        if (update && reachable) stmt(update, -1);
+        closeLoop(head);
+
+        std::vector<IrEdge> exits = std::move(breaks.back());
+        breaks.pop_back();
+        exits.insert(exits.begin(), { head.block, std::move(headVars) });
+        ir.loops[loop].end = static_cast<int>(ir.blocks.size());
+        joinAt(exits, update ? "after for" : "after while", ir.blocks[head.block].line);
+    }
+
+    // ----- expressions -----
+
+    int expr(std::unique_ptr<Expr>& e, int anchor, int& made) {
+        int size = 0;
+        return expr(e, anchor, made, size);
+    }
+
+    // the statement's own instruction becomes the parent of its expression
+    int adopt(int made, int id) {
+        if (made != -1) ir.instrs[made].parent = id;
+        return id;
+    }
+
+    // `made` is the instruction e became, -1 for a variable read
+    int expr(std::unique_ptr<Expr>& e, int anchor, int& made, int& size) {
+        size = 1;
+        made = -1;
+        if (auto var = dynamic_cast<VariableExpr*>(e.get())) return value(var->n);
+
+        IrInstr in = make(IrOp::OPAQUE);
+        std::vector<int> kids;
+        if (auto lit = dynamic_cast<literalExpressions*>(e.get())) {
+            in.op = IrOp::CONST;
+            in.constant = &lit->val;
+        } else if (auto str = dynamic_cast<StringExpr*>(e.get())) {
+            in.op = IrOp::CONST;
+            in.constant = &str->value;
+        } else if (depth >= MAX_IR_DEPTH) {
+            // every level is a frame with an instruction in it; nothing
+            // written by hand gets here, so the passes just leave it alone
+            ir.opaque = true;
+        } else if (auto bin = dynamic_cast<BinaryExpr*>(e.get())) {
+            int lm, ls, rm, rs;
+            depth++;
+            int l = expr(bin->left, anchor, lm, ls);
+            int r = expr(bin->right, anchor, rm, rs);
+            depth--;
+            in.op = IrOp::BINARY;
+            in.binop = bin->op;
+            in.args = { l, r };
+            size += ls + rs;
+            kids = { lm, rm };
+        } else if (auto call = dynamic_cast<CallExpr*>(e.get())) {
+            in.op = IrOp::CALL;
+            in.name = call->callee;
+            in.builtin = call->builtin;
+            depth++;
+            for (auto& arg : call->arguments) {
+                int m, n;
+                in.args.push_back(expr(arg, anchor, m, n));
+                size += n;
+                kids.push_back(m);
+            }
+            depth--;
+        } else if (auto rec = dynamic_cast<RecordExpr*>(e.get())) {
+            static const char* const NAMES[] = { "line", "NR", "NF", "f" };
+            in.op = IrOp::RECORD;
+            in.name = NAMES[rec->kind];
+            if (rec->kind == RecordExpr::FIELD) in.name += std::to_string(rec->field);
+            in.types = (rec->kind == RecordExpr::NUMBER || rec->kind == RecordExpr::FIELD_COUNT) ? TYPE_INT : TYPE_STRING;
+        } else {
+            ir.opaque = true;
+        }
+        in.site = &e;
+        in.anchor = anchor;
+        in.size = size;
+        made = emit(std::move(in));
+        for (int k : kids) {
+            if (k != -1) ir.instrs[k].parent = made;
+        }
+        return made;
+    }
+
+    // ----- after lowering -----
+
+    // a phi whose operands are all one value (or itself) is that value
+    void simplifyPhis() {
+        std::vector<int> phis;
+        for (size_t i = 0; i < ir.instrs.size(); i++) {
+            if (ir.instrs[i].op == IrOp::PHI) phis.push_back(static_cast<int>(i));
+        }
+        if (phis.empty()) return;
+
+        std::vector<int> replaced(ir.instrs.size(), -1);
+        auto resolve = [&](int v) {
+            while (replaced[v] != -1) v = replaced[v];
+            return v;
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int i : phis) {
+                IrInstr& in = ir.instrs[i];
+                if (in.removed) continue;
+                int same = -1;
+                bool trivial = true;
+                for (int a : in.args) {
+                    a = resolve(a);
+                    if (a == i || a == same) continue;
+                    if (same != -1) {
+                        trivial = false;
+                        break;
+                    }
+                    same = a;
+                }
+                if (!trivial || same == -1) continue;
+                replaced[i] = same;
+                in.removed = true;
+                changed = true;
+            }
+        }
+
+        std::set<int> blocks;
+        for (int i : phis) {
+            if (ir.instrs[i].removed) blocks.insert(ir.instrs[i].block);
+        }
+        if (blocks.empty()) return;
+        for (auto& in : ir.instrs) {
+            for (int& a : in.args) a = resolve(a);
+        }
+        for (int b : blocks) {
+            auto& list = ir.blocks[b].instrs;
+            list.erase(std::remove_if(list.begin(), list.end(), [&](int id) { return ir.instrs[id].removed; }), list.end());
+        }
+    }
+
+    // same rules as the type pass, over values instead of variables;
+    // phis around loops grow until nothing changes
+    void inferTypes() {
+        const unsigned ANY = TYPE_INT | TYPE_DOUBLE | TYPE_STRING;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& in : ir.instrs) {
+                if (in.removed) continue;
+                unsigned t = in.types;
+                switch (in.op) {
+                    case IrOp::CONST:
+                        if (std::holds_alternative<int>(*in.constant)) t = TYPE_INT;
+                        else if (std::holds_alternative<double>(*in.constant)) t = TYPE_DOUBLE;
+                        else t = TYPE_STRING;
+                        break;
+                    case IrOp::UNDEF:  t = TYPE_UNSET; break;
+                    case IrOp::PHI:
+                        for (int a : in.args) t |= ir.instrs[a].types;
+                        break;
+                    // a read of an unset variable throws, so the copy is never unset
+                    case IrOp::SET:    t = ir.instrs[in.args[0]].types & ~TYPE_UNSET; break;
+                    case IrOp::BINARY:
+                        t = binaryTypes(in.binop, ir.instrs[in.args[0]].types, ir.instrs[in.args[1]].types);
+                        break;
+                    case IrOp::CALL: {
+                        std::vector<unsigned> args;
+                        for (int a : in.args) args.push_back(ir.instrs[a].types);
+                        t = in.builtin < 0 ? ANY : callTypes(in.builtin, args);
+                        break;
+                    }
+                    case IrOp::INPUT:  t = TYPE_STRING; break;
+                    case IrOp::OPAQUE:
+                        t = in.args.empty() ? TYPE_INT : ANY | (ir.instrs[in.args[0]].types & TYPE_UNSET);
+                        break;
+                    default: break;
+                }
+                if (t != in.types) {
+                    in.types = t;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Cooper, Harvey and Kennedy's iteration over reverse postorder
+    void dominators() {
+        size_t n = ir.blocks.size();
+        std::vector<int> order; // postorder
+        std::vector<char> seen(n, 0);
+        std::vector<std::pair<int, size_t>> stack = { { 0, 0 } };
+        seen[0] = 1;
+        while (!stack.empty()) {
+            int b = stack.back().first;
+            const auto& list = ir.blocks[b].instrs;
+            std::vector<int> succ;
+            if (!list.empty()) {
+                const IrInstr& last = ir.instrs[list.back()];
+                if (last.op == IrOp::BRANCH || last.op == IrOp::JUMP) succ = last.targets;
+            }
+            size_t& next = stack.back().second;
+            if (next < succ.size()) {
+                int s = succ[next++];
+                if (s >= 0 && !seen[s]) {
+                    seen[s] = 1;
+                    stack.push_back({ s, 0 });
+                }
+                continue;
+            }
+            order.push_back(b);
+            stack.pop_back();
+        }
+
+        std::vector<int> rank(n, -1);
+        for (size_t i = 0; i < order.size(); i++) rank[order[i]] = static_cast<int>(i);
+
+        ir.idom.assign(n, -1);
+        ir.idom[0] = 0;
+        auto intersect = [&](int a, int b) {
+            while (a != b) {
+                while (rank[a] < rank[b]) a = ir.idom[a];
+                while (rank[b] < rank[a]) b = ir.idom[b];
+            }
+            return a;
+        };
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = order.size(); i-- > 0;) {
+                int b = order[i];
+                if (b == 0) continue;
+                int idom = -1;
+                for (int p : ir.blocks[b].preds) {
+                    if (rank[p] == -1 || ir.idom[p] == -1) continue;
+                    idom = idom == -1 ? p : intersect(p, idom);
+                }
+                if (idom != ir.idom[b]) {
+                    ir.idom[b] = idom;
+                    changed = true;
+                }
+            }
+        }
+        ir.idom[0] = -1;
+    }
+};
+
+IrProgram lowerToIr(std::vector<std::unique_ptr<Stmt>>& program, size_t maxInstrs) {
+    IrBuilder builder;
+    builder.limit = maxInstrs;
+    try {
+        builder.run(program);
+    } catch (const IrTooBig&) {
+        IrProgram empty;
+        empty.opaque = true;
+        return empty;
+    }
+    return std::move(builder.ir);
+}
+
+int constantOf(const IrProgram& ir, int value) {
+    while (ir.instrs[value].op == IrOp::SET) value = ir.instrs[value].args[0];
+    return ir.instrs[value].op == IrOp::CONST ? value : -1;
+}
+
+// ===== --dump-ir =====
+
+static const char* opName(TokenTypes op) {
+    switch (op) {
+        case TokenTypes::PLUS:          return "add";
+        case TokenTypes::MINUS:         return "sub";
+        case TokenTypes::ASTERISK:      return "mul";
+        case TokenTypes::SLASH:         return "div";
+        case TokenTypes::MODULUS:       return "mod";
+        case TokenTypes::EQUAL_EQUAL:   return "eq";
+        case TokenTypes::NOT_EQUAL:     return "ne";
+        case TokenTypes::GREATER:       return "gt";
+        case TokenTypes::LESSER:        return "lt";
+        case TokenTypes::GREATER_EQUAL: return "ge";
+        case TokenTypes::LESSER_EQUAL:  return "le";
+        default:                        return "?";
+    }
+}
+
+static std::string constantText(const Value& v) {
+    if (auto i = std::get_if<int>(&v)) return formatInt(*i);
+    if (auto d = std::get_if<double>(&v)) return formatDouble(*d);
+    return "\"" + std::get<std::string>(v) + "\"";
+}
+
+static void printInstr(const IrProgram& ir, int id, std::ostream& os) {
+    const IrInstr& in = ir.instrs[id];
+    std::string text;
+    auto args = [&](size_t from) {
+        for (size_t i = from; i < in.args.size(); i++) text += " %" + std::to_string(in.args[i]);
+    };
+
+    switch (in.op) {
+        case IrOp::CONST:  text = "const " + constantText(*in.constant); break;
+        case IrOp::UNDEF:  text = "undef " + in.name; break;
+        case IrOp::PHI: {
+            text = "phi " + in.name;
+            const auto& preds = ir.blocks[in.block].preds;
+            for (size_t i = 0; i < in.args.size(); i++) {
+                text += " [b" + (i < preds.size() ? std::to_string(preds[i]) : std::string("?")) +
+                        " %" + std::to_string(in.args[i]) + "]";
+            }
+            break;
+        }
+        case IrOp::SET:    text = "set " + in.name; args(0); break;
+        case IrOp::BINARY: text = opName(in.binop); args(0); break;
+        case IrOp::CALL:   text = "call " + in.name; args(0); break;
+        case IrOp::RECORD: text = "record " + in.name; break;
+        case IrOp::INPUT:  text = "in " + in.name; break;
+        case IrOp::OPAQUE: text = "opaque " + in.name; args(0); break;
+        case IrOp::OUT:    text = "out"; args(0); break;
+        case IrOp::USE:    text = "use"; args(0); break;
+        case IrOp::BRANCH:
+            text = "branch %" + std::to_string(in.args[0]) + " b" + std::to_string(in.targets[0]) +
+                   " b" + std::to_string(in.targets[1]);
+            break;
+        case IrOp::JUMP:   text = "jump b" + std::to_string(in.targets[0]); break;
+    }
+
+    bool value = in.op != IrOp::OUT && in.op != IrOp::USE && in.op != IrOp::BRANCH && in.op != IrOp::JUMP;
+    os << "    ";
+    if (value) {
+        std::string lhs = "%" + std::to_string(id) + " = ";
+        text = lhs + text;
+        if (text.size() < 40) text += std::string(40 - text.size(), ' ');
+        text += "  ; " + typeNames(in.types);
+    }
+    os << text << "\n";
+}
+
+void printIr(const IrProgram& ir, std::ostream& os) {
+    for (size_t b = 0; b < ir.blocks.size(); b++) {
+        const IrBlock& block = ir.blocks[b];
+        os << "b" << b << " (" << block.what;
+        if (block.line > 0) os << ", line " << block.line;
+        os << ")";
+        if (!block.preds.empty()) {
+            os << " <-";
+            for (int p : block.preds) os << " b" << p;
+        }
+        os << ":\n";
+        for (int id : block.instrs) printInstr(ir, id, os);
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../parser/AST.h"
+#include "TypeInference.h"
+
+// A mid-level view of the program for the passes in IrPasses.h: basic
+// blocks of instructions in SSA form, where every assignment makes a new
+// value and the places two paths meet pick between them with a phi.
+// The interpreter still runs the tree; each instruction remembers the
+// expression it came from and the statement a temporary could be computed
+// before, so a pass decides on the IR and rewrites the tree.
+//
+// Built from the program as the parser left it, before types and fusion.
+// A --lazy-parse body that has not been parsed shows up as a USE of every
+// name it mentions followed by an OPAQUE new value for each of them.
+
+enum class IrOp {
+    CONST,   // a literal
+    UNDEF,   // a variable nothing was assigned to yet; reading it throws
+    PHI,     // one operand per predecessor of the block, in order
+    SET,     // name = operand, its own value so a dead store can be found
+    BINARY,
+    CALL,
+    RECORD,  // --each-line line, NR, NF or a field
+    INPUT,   // in(name)
+    OPAQUE,  // anything the IR does not look into
+    OUT,
+    USE,     // a lazy body may read these
+    BRANCH,  // targets: when true, when false
+    JUMP
+};
+
+struct IrInstr {
+    IrOp op;
+    int block = -1;
+    std::vector<int> args;   // values, by instruction index
+    std::vector<int> targets;
+    std::string name;        // variable, or function for CALL
+    TokenTypes binop = TokenTypes::PLUS;
+    int builtin = -1;
+    const Value* constant = nullptr; // the literal in the tree
+    unsigned types = 0;      // TYPE_* bits {see TypeInference.h}
+    bool removed = false;    // a phi that turned out to pick one value
+
+    // back into the tree
+    std::unique_ptr<Expr>* site = nullptr; // expression this value came from
+    int parent = -1;   // instruction of the expression around this one
+    int anchor = -1;   // statement it is evaluated in, when a temporary may go before it;
+                       // for SET the assignment, for BRANCH the if
+    int size = 1;      // nodes in the expression, variable reads included
+};
+
+// a statement and the list that holds it
+struct IrAnchor {
+    Stmt* stmt;
+    std::vector<std::unique_ptr<Stmt>>* list;
+};
+
+struct IrBlock {
+    std::vector<int> preds;
+    std::vector<int> instrs;
+    std::string what; // "while", "then", ... for --dump-ir
+    int line = 0;
+};
+
+// blocks [first, end) are the loop, its init included for a for loop
+struct IrLoop {
+    int first;
+    int end;
+    int anchor;      // the loop statement
+    int branch = -1; // leaves the loop when its condition is 0
+};
+
+struct IrProgram {
+    std::vector<IrInstr> instrs;
+    std::vector<IrBlock> blocks;
+    std::vector<IrLoop> loops;   // outer loops before the ones inside them
+    std::vector<IrAnchor> anchors;
+    std::vector<int> unreachable; // anchors of statements after a break
+    std::vector<int> idom;        // immediate dominator of each block, -1 for the entry
+    bool opaque = false; // holds something the IR cannot describe; the passes leave it alone
+};
+
+// expressions nested deeper than this lower to an opaque program
+static const size_t MAX_IR_DEPTH = 2048;
+
+// lowers the program; the tree must outlive the result and not change
+// while the sites and anchors are in use. Past maxInstrs {0: no limit}
+// it stops and gives back an empty program marked opaque.
+IrProgram lowerToIr(std::vector<std::unique_ptr<Stmt>>& program, size_t maxInstrs = 0);
+
+// follows SET chains down to a CONST; -1 when the value is not constant
+int constantOf(const IrProgram& ir, int value);
+
+// --dump-ir
+void printIr(const IrProgram& ir, std::ostream& os);
@@ -0,0 +1,419 @@
+#include "Superinstructions.h"
+#include <climits>
+#include <set>
+#include <unordered_map>
+#include <variant>
+
+#include "../runtime/StackGuard.h"
+
+static const literalExpressions* intLiteral(const Expr* expr) {
+    auto lit = dynamic_cast<const literalExpressions*>(expr);
+    if (lit && std::holds_alternative<int>(lit->val)) return lit;
+    return nullptr;
+}
+
+static const VariableExpr* variable(const Expr* expr) {
+    return dynamic_cast<const VariableExpr*>(expr);
+}
+
+static bool isComparison(TokenTypes op) {
+    return op == TokenTypes::EQUAL_EQUAL || op == TokenTypes::NOT_EQUAL ||
+           op == TokenTypes::GREATER || op == TokenTypes::LESSER ||
+           op == TokenTypes::GREATER_EQUAL || op == TokenTypes::LESSER_EQUAL;
+}
+
+static std::unique_ptr<Expr> fuseCondition(std::unique_ptr<Expr> cond) {
+    auto bin = dynamic_cast<const BinaryExpr*>(cond.get());
+    if (!bin || !isComparison(bin->op)) return cond;
+
+    auto left = variable(bin->left.get());
+    if (!left) return cond;
+
+    if (auto right = variable(bin->right.get())) {
+        std::string l = left->n, r = right->n;
+        return std::make_unique<CompareVarsExpr>(bin->op, l, r, 0, std::move(cond));
+    }
+    if (auto k = intLiteral(bin->right.get())) {
+        std::string l = left->n;
+        int v = std::get<int>(k->val);
+        return std::make_unique<CompareVarsExpr>(bin->op, l, "", v, std::move(cond));
+    }
+    return cond;
+}
+
+// names a spawned task may assign while the running one waits
+using SharedNames = std::set<std::string>;
+
+static void fuseBlock(std::vector<std::unique_ptr<Stmt>>& stmts, const SharedNames& shared);
+
+// ===== counted for loops =====
+// Runs before the type pass has or has not boxed the loop variable, so
+// every check accepts both the plain and the unboxed form.
+
+static bool binaryParts(const Expr* e, TokenTypes& op, const Expr*& left, const Expr*& right) {
+    if (auto bin = dynamic_cast<const BinaryExpr*>(e)) {
+        op = bin->op;
+        left = bin->left.get();
+        right = bin->right.get();
+        return true;
+    }
+    if (auto typed = dynamic_cast<const TypedBinaryExpr*>(e)) {
+        op = typed->op;
+        left = typed->left.get();
+        right = typed->right.get();
+        return true;
+    }
+    return false;
+}
+
+static bool isVar(const Expr* e, const std::string& name) {
+    if (auto var = variable(e)) return var->n == name;
+    if (auto slot = dynamic_cast<const SlotExpr*>(e)) return slot->name == name;
+    return false;
+}
+
+static bool assignParts(const Stmt* s, std::string& name, const Expr*& value) {
+    if (auto assign = dynamic_cast<const AssignStmt*>(s)) {
+        name = assign->name;
+        value = assign->expression.get();
+        return true;
+    }
+    if (auto slot = dynamic_cast<const SlotAssignStmt*>(s)) {
+        name = slot->name;
+        value = slot->expression.get();
+        return true;
+    }
+    return false;
+}
+
+static void collectWrites(const std::vector<std::unique_ptr<Stmt>>& stmts, std::set<std::string>& out);
+
+// every variable a statement can assign, looking into nested blocks
+static void collectWrites(const Stmt* s, std::set<std::string>& out) {
+    std::string name;
+    const Expr* value = nullptr;
+    if (assignParts(s, name, value)) {
+        out.insert(name);
+    } else if (auto input = dynamic_cast<const InputStmt*>(s)) {
+        out.insert(input->name);
+    } else if (auto block = dynamic_cast<const BlockStmt*>(s)) {
+        collectWrites(block->statements, out);
+    } else if (auto ifStmt = dynamic_cast<const IfStmt*>(s)) {
+        collectWrites(ifStmt->thenBody, out);
+        collectWrites(ifStmt->elseBody, out);
+    } else if (auto whileStmt = dynamic_cast<const WhileStmt*>(s)) {
+        collectWrites(whileStmt->body, out);
+    } else if (auto lazy = dynamic_cast<const LazyBlockStmt*>(s)) {
+        // not parsed yet: anything it names may be assigned
+        out.insert(lazy->names.begin(), lazy->names.end());
+    } else if (auto forStmt = dynamic_cast<const ForStmt*>(s)) {
+        collectWrites(forStmt->init.get(), out);
+        collectWrites(forStmt->update.get(), out);
+        collectWrites(forStmt->body, out);
+    } else if (auto spawn = dynamic_cast<const SpawnStmt*>(s)) {
+        collectWrites(spawn->body, out);
+    }
+}
+
+static void collectWrites(const std::vector<std::unique_ptr<Stmt>>& stmts, std::set<std::string>& out) {
+    for (const auto& s : stmts) collectWrites(s.get(), out);
+}
+
+// what every spawn body in the program assigns
+static void spawnedWrites(const std::vector<std::unique_ptr<Stmt>>& stmts, SharedNames& out) {
+    for (const auto& s : stmts) {
+        if (auto spawn = dynamic_cast<const SpawnStmt*>(s.get())) {
+            collectWrites(spawn->body, out);
+        } else if (auto block = dynamic_cast<const BlockStmt*>(s.get())) {
+            spawnedWrites(block->statements, out);
+        } else if (auto ifStmt = dynamic_cast<const IfStmt*>(s.get())) {
+            spawnedWrites(ifStmt->thenBody, out);
+            spawnedWrites(ifStmt->elseBody, out);
+        } else if (auto whileStmt = dynamic_cast<const WhileStmt*>(s.get())) {
+            spawnedWrites(whileStmt->body, out);
+        } else if (auto forStmt = dynamic_cast<const ForStmt*>(s.get())) {
+            spawnedWrites(forStmt->body, out);
+        } else if (auto each = dynamic_cast<const EachLineStmt*>(s.get())) {
+            spawnedWrites(each->body, out);
+        }
+    }
+}
+
+// variables an expression reads; false if it calls anything, since a call
+// may give a different answer (or do something) every time
+static bool pureReads(const Expr* e, std::set<std::string>& out) {
+    if (auto var = variable(e)) {
+        out.insert(var->n);
+        return true;
+    }
+    if (auto slot = dynamic_cast<const SlotExpr*>(e)) {
+        out.insert(slot->name);
+        return true;
+    }
+    TokenTypes op;
+    const Expr* left = nullptr;
+    const Expr* right = nullptr;
+    if (binaryParts(e, op, left, right)) return pureReads(left, out) && pureReads(right, out);
+    return dynamic_cast<const literalExpressions*>(e) || dynamic_cast<const StringExpr*>(e);
+}
+
+// for (i = a; i < b; i = i + k) -> CountedForStmt, anything else stays a ForStmt
+static std::unique_ptr<Stmt> countedFor(std::unique_ptr<ForStmt> loop, const SharedNames& shared) {
+    std::string var, updated;
+    const Expr* start = nullptr;
+    const Expr* step = nullptr;
+    if (!assignParts(loop->init.get(), var, start)) return loop;
+    if (!assignParts(loop->update.get(), updated, step) || updated != var) return loop;
+
+    auto slotInit = dynamic_cast<const SlotAssignStmt*>(loop->init.get());
+    if (slotInit && slotInit->kind != NumKind::INT) return loop;
+
+    TokenTypes cmp;
+    const Expr* counter = nullptr;
+    const Expr* bound = nullptr;
+    if (!binaryParts(loop->condition.get(), cmp, counter, bound)) return loop;
+    if (!isComparison(cmp) || !isVar(counter, var)) return loop;
+
+    // i = i + k;  i = k + i;  i = i - k;
+    TokenTypes stepOp;
+    const Expr* l = nullptr;
+    const Expr* r = nullptr;
+    if (!binaryParts(step, stepOp, l, r)) return loop;
+    int delta = 0;
+    if (stepOp == TokenTypes::PLUS && isVar(l, var) && intLiteral(r)) {
+        delta = std::get<int>(intLiteral(r)->val);
+    } else if (stepOp == TokenTypes::PLUS && isVar(r, var) && intLiteral(l)) {
+        delta = std::get<int>(intLiteral(l)->val);
+    } else if (stepOp == TokenTypes::MINUS && isVar(l, var) && intLiteral(r) &&
+               std::get<int>(intLiteral(r)->val) != INT_MIN) {
+        delta = -std::get<int>(intLiteral(r)->val);
+    } else {
+        return loop;
+    }
+
+    // another task may run at any call in the body
+    std::set<std::string> writes = shared;
+    collectWrites(loop->body, writes);
+    if (writes.count(var)) return loop;
+    writes.insert(var);
+
+    // a bound with calls is evaluated by the generic loop only
+    std::set<std::string> reads;
+    if (!pureReads(bound, reads)) return loop;
+    bool invariant = true;
+    for (const auto& name : reads) {
+        if (writes.count(name)) invariant = false;
+    }
+
+    fuseBlock(loop->body, shared);
+    int line = loop->line;
+    auto counted = std::make_unique<CountedForStmt>(var, cmp, delta, bound, invariant, std::move(loop));
+    if (slotInit) {
+        counted->slotted = true;
+        counted->slot = slotInit->slot;
+    }
+    counted->line = line;
+    return counted;
+}
+
+static std::unique_ptr<Stmt> fuseStmt(std::unique_ptr<Stmt> stmt, const SharedNames& shared) {
+    if (auto assign = dynamic_cast<AssignStmt*>(stmt.get())) {
+        const Expr* rhs = assign->expression.get();
+
+        // x = y;
+        if (auto src = variable(rhs)) {
+            auto copy = std::make_unique<CopyStmt>(assign->name, src->n);
+            copy->line = stmt->line;
+            return copy;
+        }
+
+        // x = x + k;  x = k + x;  x = x - k;
+        if (auto bin = dynamic_cast<const BinaryExpr*>(rhs)) {
+            auto lv = variable(bin->left.get());
+            auto rv = variable(bin->right.get());
+            auto lk = intLiteral(bin->left.get());
+            auto rk = intLiteral(bin->right.get());
+
+            bool fused = false;
+            int delta = 0;
+            if (bin->op == TokenTypes::PLUS && lv && lv->n == assign->name && rk) {
+                delta = std::get<int>(rk->val);
+                fused = true;
+            } else if (bin->op == TokenTypes::PLUS && rv && rv->n == assign->name && lk) {
+                delta = std::get<int>(lk->val);
+                fused = true;
+            } else if (bin->op == TokenTypes::MINUS && lv && lv->n == assign->name && rk &&
+                       std::get<int>(rk->val) != INT_MIN) {
+                delta = -std::get<int>(rk->val);
+                fused = true;
+            }
+
+            if (fused) {
+                std::string name = assign->name;
+                int line = stmt->line;
+                auto inc = std::make_unique<IncrementStmt>(name, delta, std::move(stmt));
+                inc->line = line;
+                return inc;
+            }
+        }
+        return stmt;
+    }
+
+    if (auto block = dynamic_cast<BlockStmt*>(stmt.get())) {
+        fuseBlock(block->statements, shared);
+        return stmt;
+    }
+
+    if (auto ifStmt = dynamic_cast<IfStmt*>(stmt.get())) {
+        ifStmt->condition = fuseCondition(std::move(ifStmt->condition));
+        fuseBlock(ifStmt->thenBody, shared);
+        fuseBlock(ifStmt->elseBody, shared);
+        return stmt;
+    }
+
+    if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt.get())) {
+        whileStmt->condition = fuseCondition(std::move(whileStmt->condition));
+        fuseBlock(whileStmt->body, shared);
+        return stmt;
+    }
+
+    if (auto each = dynamic_cast<EachLineStmt*>(stmt.get())) {
+        fuseBlock(each->body, shared);
+        return stmt;
+    }
+
+    if (auto spawn = dynamic_cast<SpawnStmt*>(stmt.get())) {
+        fuseBlock(spawn->body, shared);
+        return stmt;
+    }
+
+    if (dynamic_cast<ForStmt*>(stmt.get())) {
+        std::unique_ptr<ForStmt> loop(static_cast<ForStmt*>(stmt.release()));
+        auto fused = countedFor(std::move(loop), shared);
+
+        // not a counted loop: fuse its parts like any other statements
+        if (auto forStmt = dynamic_cast<ForStmt*>(fused.get())) {
+            forStmt->init = fuseStmt(std::move(forStmt->init), shared);
+            forStmt->condition = fuseCondition(std::move(forStmt->condition));
+            forStmt->update = fuseStmt(std::move(forStmt->update), shared);
+            fuseBlock(forStmt->body, shared);
+        }
+        return fused;
+    }
+
+    return stmt;
+}
+
+static void fuseBlock(std::vector<std::unique_ptr<Stmt>>& stmts, const SharedNames& shared) {
+    for (auto& s : stmts) {
+        s = fuseStmt(std::move(s), shared);
+    }
+}
+
+void fuseSuperinstructions(std::vector<std::unique_ptr<Stmt>>& program) {
+    SharedNames shared;
+    spawnedWrites(program, shared);
+    fuseBlock(program, shared);
+}
+
+// ===== shapes for --profile-shapes =====
+
+static const char* opSymbol(TokenTypes op) {
+    switch (op) {
+        case TokenTypes::PLUS:          return "+";
+        case TokenTypes::MINUS:         return "-";
+        case TokenTypes::ASTERISK:      return "*";
+        case TokenTypes::SLASH:         return "/";
+        case TokenTypes::MODULUS:       return "%";
+        case TokenTypes::EQUAL_EQUAL:   return "==";
+        case TokenTypes::NOT_EQUAL:     return "!=";
+        case TokenTypes::GREATER:       return ">";
+        case TokenTypes::LESSER:        return "<";
+        case TokenTypes::GREATER_EQUAL: return ">=";
+        case TokenTypes::LESSER_EQUAL:  return "<=";
+        default:                        return "?";
+    }
+}
+
+using NameIds = std::unordered_map<std::string, int>;
+
+static std::string nameShape(const std::string& name, NameIds& ids) {
+    auto it = ids.find(name);
+    if (it == ids.end()) it = ids.emplace(name, static_cast<int>(ids.size())).first;
+    return "v" + std::to_string(it->second);
+}
+
+static std::string exprShape(const Expr* expr, NameIds& ids, bool nested) {
+    if (stackLow()) return "..."; // a shape that deep is cut short {see runtime/StackGuard.h}
+    if (auto lit = dynamic_cast<const literalExpressions*>(expr)) {
+        if (std::holds_alternative<int>(lit->val)) return "int";
+        if (std::holds_alternative<double>(lit->val)) return "float";
+        return "str";
+    }
+    if (dynamic_cast<const StringExpr*>(expr)) return "str";
+    if (auto var = dynamic_cast<const VariableExpr*>(expr)) return nameShape(var->n, ids);
+    if (auto bin = dynamic_cast<const BinaryExpr*>(expr)) {
+        std::string l = exprShape(bin->left.get(), ids, true);
+        std::string r = exprShape(bin->right.get(), ids, true);
+        std::string s = l + " " + opSymbol(bin->op) + " " + r;
+        return nested ? "(" + s + ")" : s;
+    }
+    if (auto call = dynamic_cast<const CallExpr*>(expr)) {
+        std::string args;
+        for (const auto& arg : call->arguments) {
+            if (!args.empty()) args += ", ";
+            args += exprShape(arg.get(), ids, false);
+        }
+        return call->callee + "(" + args + ")";
+    }
+    if (auto cmp = dynamic_cast<const CompareVarsExpr*>(expr)) {
+        return "fused[" + exprShape(cmp->original.get(), ids, false) + "]";
+    }
+    if (dynamic_cast<const RecordExpr*>(expr)) return "record";
+    return "?";
+}
+
+static std::string shapeOf(const Stmt* stmt, NameIds& ids) {
+    if (auto assign = dynamic_cast<const AssignStmt*>(stmt)) {
+        std::string name = nameShape(assign->name, ids);
+        return name + " = " + exprShape(assign->expression.get(), ids, false);
+    }
+    if (auto print = dynamic_cast<const PrintStmt*>(stmt)) {
+        return "out(" + exprShape(print->expression.get(), ids, false) + ")";
+    }
+    if (auto input = dynamic_cast<const InputStmt*>(stmt)) {
+        return "in(" + nameShape(input->name, ids) + ")";
+    }
+    if (auto ifStmt = dynamic_cast<const IfStmt*>(stmt)) {
+        return "if (" + exprShape(ifStmt->condition.get(), ids, false) + ")";
+    }
+    if (auto whileStmt = dynamic_cast<const WhileStmt*>(stmt)) {
+        return "while (" + exprShape(whileStmt->condition.get(), ids, false) + ")";
+    }
+    if (auto forStmt = dynamic_cast<const ForStmt*>(stmt)) {
+        std::string init = shapeOf(forStmt->init.get(), ids);
+        std::string cond = exprShape(forStmt->condition.get(), ids, false);
+        return "for (" + init + "; " + cond + "; " + shapeOf(forStmt->update.get(), ids) + ")";
+    }
+    if (auto counted = dynamic_cast<const CountedForStmt*>(stmt)) {
+        return "fused[for (" + exprShape(counted->original->condition.get(), ids, false) + ")]";
+    }
+    if (dynamic_cast<const EachLineStmt*>(stmt)) return "each line";
+    if (dynamic_cast<const SpawnStmt*>(stmt)) return "spawn";
+    if (dynamic_cast<const LazyBlockStmt*>(stmt)) return "{ lazy }";
+    if (dynamic_cast<const BlockStmt*>(stmt)) return "{ }";
+    if (dynamic_cast<const BreakStmt*>(stmt)) return "break";
+    if (auto inc = dynamic_cast<const IncrementStmt*>(stmt)) {
+        return "fused[" + nameShape(inc->name, ids) + " += int]";
+    }
+    if (auto copy = dynamic_cast<const CopyStmt*>(stmt)) {
+        std::string dst = nameShape(copy->dst, ids);
+        return "fused[" + dst + " = " + nameShape(copy->src, ids) + "]";
+    }
+    return "?";
+}
+
+std::string stmtShape(const Stmt* stmt) {
+    NameIds ids;
+    return shapeOf(stmt, ids);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../parser/AST.h"
+
+// Rewrites the hottest statement shapes into fused nodes the interpreter
+// can run with one env lookup and no temporary Values:
+//   i = i + 1;       -> IncrementStmt
+//   x = y;           -> CopyStmt
+//   while (i < n)    -> condition becomes CompareVarsExpr (also for if)
+//   for (i = 0; i < n; i = i + 1) -> CountedForStmt
+// Every fused node keeps enough of the original to fall back to the
+// generic path, so types and error messages do not change.
+void fuseSuperinstructions(std::vector<std::unique_ptr<Stmt>>& program);
+
+// Readable shape of a statement with variable names numbered by first use,
+// e.g. `i = i + 1;` is "v0 = v0 + int". Used by --profile-shapes.
+std::string stmtShape(const Stmt* stmt);
@@ -0,0 +1,552 @@
+#include "TypeInference.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <variant>
+
+#include "../interpreter/BinaryOps.h"
+#include "../runtime/Builtins.h"
+
+// ===== abstract state =====
+
+// types each variable may hold at one program point; a name that is not in
+// the map has never been assigned on any path
+struct TypeState {
+    bool reachable = true;
+    std::map<std::string, unsigned> vars;
+
+    unsigned get(const std::string& name) const {
+        auto it = vars.find(name);
+        return it == vars.end() ? TYPE_UNSET : it->second;
+    }
+
+    static TypeState unreachable() {
+        TypeState s;
+        s.reachable = false;
+        return s;
+    }
+
+    bool operator==(const TypeState& o) const {
+        return reachable == o.reachable && vars == o.vars;
+    }
+};
+
+static TypeState join(const TypeState& a, const TypeState& b) {
+    if (!a.reachable) return b;
+    if (!b.reachable) return a;
+
+    TypeState out;
+    for (const auto& v : a.vars) out.vars[v.first] = v.second | b.get(v.first);
+    for (const auto& v : b.vars) out.vars[v.first] = a.get(v.first) | v.second;
+    return out;
+}
+
+// one concrete type as a Value alternative
+static size_t valueKind(unsigned type) {
+    if (type == TYPE_INT) return VALUE_INT;
+    if (type == TYPE_DOUBLE) return VALUE_DOUBLE;
+    return VALUE_STRING;
+}
+
+// result of one operator on one pair of concrete types, 0 if it throws;
+// read off the interpreter's own rules
+static unsigned binaryResult(TokenTypes op, unsigned l, unsigned r) {
+    switch (binaryRule(op, valueKind(l), valueKind(r))) {
+        case BinaryRule::INT_MATH:        return TYPE_INT;
+        case BinaryRule::DOUBLE_MATH:     return op == TokenTypes::MODULUS ? 0 : TYPE_DOUBLE;
+        case BinaryRule::INT_COMPARE:
+        case BinaryRule::DOUBLE_COMPARE:
+        case BinaryRule::STRING_EQUALITY: return TYPE_INT;
+        case BinaryRule::CONCAT:          return TYPE_STRING;
+        default:                          return 0;
+    }
+}
+
+unsigned binaryTypes(TokenTypes op, unsigned left, unsigned right) {
+    static const unsigned VALUES[] = { TYPE_INT, TYPE_DOUBLE, TYPE_STRING };
+    unsigned out = 0;
+    for (unsigned l : VALUES) {
+        if (!(left & l)) continue;
+        for (unsigned r : VALUES) {
+            if (right & r) out |= binaryResult(op, l, r);
+        }
+    }
+    return out;
+}
+
+unsigned callTypes(int builtin, const std::vector<unsigned>& args) {
+    // the parser already checked the argument count
+    const Builtin& fn = builtinAt(builtin);
+    BuiltinId id = static_cast<BuiltinId>(builtin);
+    if (id == BuiltinId::TO_STRING || id == BuiltinId::TO_NUM) {
+        unsigned values = args[0] & (TYPE_INT | TYPE_DOUBLE | TYPE_STRING);
+        if (id == BuiltinId::TO_STRING) return values ? TYPE_STRING : 0;
+        unsigned out = values & (TYPE_INT | TYPE_DOUBLE);
+        if (values & TYPE_STRING) out |= TYPE_INT | TYPE_DOUBLE;
+        return out;
+    }
+    if (fn.result == BuiltinResult::INT) return TYPE_INT;
+    if (fn.result == BuiltinResult::STRING) return TYPE_STRING;
+    return TYPE_INT | TYPE_DOUBLE | TYPE_STRING;
+}
+
+// ===== names shared with tasks =====
+// Another task can store anything in a variable a spawn body mentions
+// whenever the running one waits on a channel or input, so no read of it
+// has a type the pass can prove, inside the body or out.
+
+static void sharedNames(const std::vector<std::unique_ptr<Stmt>>& list, bool spawned,
+                        std::set<std::string>& out);
+
+static void sharedNames(const Expr* e, std::set<std::string>& out) {
+    if (auto var = dynamic_cast<const VariableExpr*>(e)) {
+        out.insert(var->n);
+    } else if (auto bin = dynamic_cast<const BinaryExpr*>(e)) {
+        sharedNames(bin->left.get(), out);
+        sharedNames(bin->right.get(), out);
+    } else if (auto call = dynamic_cast<const CallExpr*>(e)) {
+        for (const auto& a : call->arguments) sharedNames(a.get(), out);
+    }
+}
+
+static void sharedNames(const Stmt* s, bool spawned, std::set<std::string>& out) {
+    if (auto assign = dynamic_cast<const AssignStmt*>(s)) {
+        if (!spawned) return;
+        out.insert(assign->name);
+        sharedNames(assign->expression.get(), out);
+    } else if (auto input = dynamic_cast<const InputStmt*>(s)) {
+        if (spawned) out.insert(input->name);
+    } else if (auto print = dynamic_cast<const PrintStmt*>(s)) {
+        if (spawned) sharedNames(print->expression.get(), out);
+    } else if (auto block = dynamic_cast<const BlockStmt*>(s)) {
+        sharedNames(block->statements, spawned, out);
+    } else if (auto ifStmt = dynamic_cast<const IfStmt*>(s)) {
+        if (spawned) sharedNames(ifStmt->condition.get(), out);
+        sharedNames(ifStmt->thenBody, spawned, out);
+        sharedNames(ifStmt->elseBody, spawned, out);
+    } else if (auto whileStmt = dynamic_cast<const WhileStmt*>(s)) {
+        if (spawned) sharedNames(whileStmt->condition.get(), out);
+        sharedNames(whileStmt->body, spawned, out);
+    } else if (auto forStmt = dynamic_cast<const ForStmt*>(s)) {
+        sharedNames(forStmt->init.get(), spawned, out);
+        if (spawned) sharedNames(forStmt->condition.get(), out);
+        sharedNames(forStmt->update.get(), spawned, out);
+        sharedNames(forStmt->body, spawned, out);
+    } else if (auto each = dynamic_cast<const EachLineStmt*>(s)) {
+        sharedNames(each->bind, spawned, out);
+        sharedNames(each->body, spawned, out);
+    } else if (auto lazy = dynamic_cast<const LazyBlockStmt*>(s)) {
+        if (spawned) out.insert(lazy->names.begin(), lazy->names.end());
+    } else if (auto spawn = dynamic_cast<const SpawnStmt*>(s)) {
+        sharedNames(spawn->body, true, out);
+    }
+}
+
+static void sharedNames(const std::vector<std::unique_ptr<Stmt>>& list, bool spawned,
+                        std::set<std::string>& out) {
+    for (const auto& s : list) sharedNames(s.get(), spawned, out);
+}
+
+// ===== analysis =====
+
+static const unsigned ANY_VALUE = TYPE_INT | TYPE_DOUBLE | TYPE_STRING;
+
+class TypeAnalysis {
+public:
+    // per read, every type seen there over all passes through it
+    std::unordered_map<const VariableExpr*, unsigned> reads;
+    std::map<std::string, unsigned> assigned;
+
+    void run(const std::vector<std::unique_ptr<Stmt>>& program) {
+        sharedNames(program, false, shared);
+        TypeState state;
+        stmts(program, state);
+    }
+
+private:
+    std::set<std::string> shared;
+
+    // states at the break statements of each enclosing loop
+    std::vector<TypeState> breaks;
+
+    unsigned expr(const Expr* e, const TypeState& state) {
+        if (auto lit = dynamic_cast<const literalExpressions*>(e)) {
+            if (std::holds_alternative<int>(lit->val)) return TYPE_INT;
+            if (std::holds_alternative<double>(lit->val)) return TYPE_DOUBLE;
+            return TYPE_STRING;
+        }
+        if (dynamic_cast<const StringExpr*>(e)) return TYPE_STRING;
+
+        if (auto var = dynamic_cast<const VariableExpr*>(e)) {
+            if (!state.reachable) return 0;
+            unsigned types = shared.count(var->n) ? ANY_VALUE | TYPE_UNSET : state.get(var->n);
+            reads[var] |= types;
+            return types;
+        }
+
+        if (auto bin = dynamic_cast<const BinaryExpr*>(e)) {
+            unsigned l = expr(bin->left.get(), state);
+            unsigned r = expr(bin->right.get(), state);
+            return binaryTypes(bin->op, l, r);
+        }
+
+        if (auto rec = dynamic_cast<const RecordExpr*>(e)) {
+            bool number = rec->kind == RecordExpr::NUMBER || rec->kind == RecordExpr::FIELD_COUNT;
+            return number ? TYPE_INT : TYPE_STRING;
+        }
+
+        if (auto call = dynamic_cast<const CallExpr*>(e)) {
+            std::vector<unsigned> args;
+            for (const auto& a : call->arguments) args.push_back(expr(a.get(), state));
+            return callTypes(call->builtin, args);
+        }
+
+        return 0;
+    }
+
+    void assign(const std::string& name, unsigned types, TypeState& state) {
+        if (!state.reachable) return;
+        assigned[name] |= shared.count(name) ? ANY_VALUE : types;
+        // an assignment that always throws ends this path
+        if (types == 0) state = TypeState::unreachable();
+        else state.vars[name] = types;
+    }
+
+    void stmts(const std::vector<std::unique_ptr<Stmt>>& list, TypeState& state) {
+        for (const auto& s : list) stmt(s.get(), state);
+    }
+
+    void stmt(const Stmt* s, TypeState& state) {
+        if (auto assignStmt = dynamic_cast<const AssignStmt*>(s)) {
+            unsigned types = expr(assignStmt->expression.get(), state);
+            assign(assignStmt->name, types, state);
+            return;
+        }
+
+        if (auto input = dynamic_cast<const InputStmt*>(s)) {
+            assign(input->name, TYPE_STRING, state);
+            return;
+        }
+
+        if (auto print = dynamic_cast<const PrintStmt*>(s)) {
+            expr(print->expression.get(), state);
+            return;
+        }
+
+        if (auto block = dynamic_cast<const BlockStmt*>(s)) {
+            stmts(block->statements, state);
+            return;
+        }
+
+        if (dynamic_cast<const BreakStmt*>(s)) {
+            // outside a loop break is a runtime error, either way nothing follows
+            if (state.reachable && !breaks.empty()) breaks.back() = join(breaks.back(), state);
+            state = TypeState::unreachable();
+            return;
+        }
+
+        if (auto ifStmt = dynamic_cast<const IfStmt*>(s)) {
+            expr(ifStmt->condition.get(), state);
+            TypeState thenState = state;
+            TypeState elseState = state;
+            stmts(ifStmt->thenBody, thenState);
+            stmts(ifStmt->elseBody, elseState);
+            state = join(thenState, elseState);
+            return;
+        }
+
+        if (auto whileStmt = dynamic_cast<const WhileStmt*>(s)) {
+            // grow the loop head state until another pass adds nothing
+            TypeState head = state;
+            breaks.push_back(TypeState::unreachable());
+            while (true) {
+                expr(whileStmt->condition.get(), head);
+                TypeState body = head;
+                stmts(whileStmt->body, body);
+
+                TypeState next = join(head, body);
+                if (next == head) break;
+                head = next;
+            }
+            state = join(head, breaks.back());
+            breaks.pop_back();
+            return;
+        }
+
+        if (auto each = dynamic_cast<const EachLineStmt*>(s)) {
+            // a loop without a condition that runs any number of times
+            TypeState head = state;
+            while (true) {
+                TypeState body = head;
+                stmts(each->bind, body);
+                stmts(each->body, body);
+
+                TypeState next = join(head, body);
+                if (next == head) break;
+                head = next;
+            }
+            state = head;
+            return;
+        }
+
+        if (auto lazy = dynamic_cast<const LazyBlockStmt*>(s)) {
+            // --lazy-parse body, not parsed yet: every name in it may end
+            // up holding anything, so none of them is unboxed
+            for (const auto& name : lazy->names) {
+                if (state.reachable) state.vars[name] = state.get(name) | ANY_VALUE;
+                assigned[name] |= ANY_VALUE;
+            }
+            if (lazy->hasBreak && state.reachable && !breaks.empty()) {
+                breaks.back() = join(breaks.back(), state);
+            }
+            return;
+        }
+
+        if (auto spawn = dynamic_cast<const SpawnStmt*>(s)) {
+            // runs later, from where the program is now; every name it
+            // mentions is shared, so nothing it does changes the state here
+            TypeState body = state;
+            breaks.push_back(TypeState::unreachable());
+            stmts(spawn->body, body);
+            breaks.pop_back();
+            return;
+        }
+
+        if (auto forStmt = dynamic_cast<const ForStmt*>(s)) {
+            // same as the while above with the update at the end of the body
+            stmt(forStmt->init.get(), state);
+            TypeState head = state;
+            breaks.push_back(TypeState::unreachable());
+            while (true) {
+                expr(forStmt->condition.get(), head);
+                TypeState body = head;
+                stmts(forStmt->body, body);
+                stmt(forStmt->update.get(), body);
+
+                TypeState next = join(head, body);
+                if (next == head) break;
+                head = next;
+            }
+            state = join(head, breaks.back());
+            breaks.pop_back();
+            return;
+        }
+    }
+};
+
+// ===== rewrite =====
+
+static NumKind toKind(unsigned type) {
+    return type == TYPE_DOUBLE ? NumKind::DOUBLE : NumKind::INT;
+}
+
+class TypeRewriter {
+public:
+    TypeRewriter(const TypeAnalysis& analysis, TypeReport& report) : analysis(analysis), report(report) {
+        for (auto& v : report.vars) byName[v.name] = &v;
+    }
+
+    void stmts(std::vector<std::unique_ptr<Stmt>>& list) {
+        for (auto& s : list) s = stmt(std::move(s));
+    }
+
+private:
+    const TypeAnalysis& analysis;
+    TypeReport& report;
+    std::unordered_map<std::string, TypedVar*> byName;
+
+    const TypedVar* slotted(const std::string& name) const {
+        auto it = byName.find(name);
+        if (it == byName.end() || !it->second->slotted) return nullptr;
+        return it->second;
+    }
+
+    // rewrites e in place; returns TYPE_INT / TYPE_DOUBLE when the result is
+    // exactly that number type, 0 otherwise
+    unsigned expr(std::unique_ptr<Expr>& e) {
+        if (auto lit = dynamic_cast<const literalExpressions*>(e.get())) {
+            if (std::holds_alternative<int>(lit->val)) return TYPE_INT;
+            if (std::holds_alternative<double>(lit->val)) return TYPE_DOUBLE;
+            return 0;
+        }
+
+        if (auto var = dynamic_cast<const VariableExpr*>(e.get())) {
+            auto it = analysis.reads.find(var);
+            unsigned types = it == analysis.reads.end() ? 0 : it->second;
+
+            auto info = byName.find(var->n);
+            if (info != byName.end()) {
+                info->second->reads++;
+                if (types == TYPE_INT || types == TYPE_DOUBLE) info->second->provenReads++;
+            }
+
+            if (const TypedVar* slot = slotted(var->n)) {
+                e = std::make_unique<SlotExpr>(slot->kind, slot->slot, slot->name);
+                return slot->kind == NumKind::INT ? TYPE_INT : TYPE_DOUBLE;
+            }
+            return (types == TYPE_INT || types == TYPE_DOUBLE) ? types : 0;
+        }
+
+        if (auto bin = dynamic_cast<BinaryExpr*>(e.get())) {
+            report.binaryOps++;
+            unsigned l = expr(bin->left);
+            unsigned r = expr(bin->right);
+            if (!l || !r) return 0;
+
+            unsigned operands = (l == TYPE_DOUBLE || r == TYPE_DOUBLE) ? TYPE_DOUBLE : TYPE_INT;
+            // float modulo is a runtime error, leave it to the generic path
+            if (bin->op == TokenTypes::MODULUS && operands == TYPE_DOUBLE) return 0;
+            if (!isArithmeticOp(bin->op) && !isComparisonOp(bin->op)) return 0;
+
+            unsigned result = isComparisonOp(bin->op) ? TYPE_INT : operands;
+            report.typedOps++;
+            e = std::make_unique<TypedBinaryExpr>(bin->op, toKind(operands), toKind(result),
+                                                  toKind(l), toKind(r),
+                                                  std::move(bin->left), std::move(bin->right));
+            return result;
+        }
+
+        if (auto call = dynamic_cast<CallExpr*>(e.get())) {
+            for (auto& arg : call->arguments) expr(arg);
+            return 0;
+        }
+
+        if (auto rec = dynamic_cast<const RecordExpr*>(e.get())) {
+            bool number = rec->kind == RecordExpr::NUMBER || rec->kind == RecordExpr::FIELD_COUNT;
+            return number ? TYPE_INT : 0;
+        }
+
+        return 0;
+    }
+
+    std::unique_ptr<Stmt> stmt(std::unique_ptr<Stmt> s) {
+        if (auto assign = dynamic_cast<AssignStmt*>(s.get())) {
+            expr(assign->expression);
+            if (const TypedVar* slot = slotted(assign->name)) {
+                auto slotAssign = std::make_unique<SlotAssignStmt>(slot->kind, slot->slot, slot->name,
+                                                                   std::move(assign->expression));
+                slotAssign->line = assign->line;
+                return slotAssign;
+            }
+            return s;
+        }
+        if (auto print = dynamic_cast<PrintStmt*>(s.get())) {
+            expr(print->expression);
+            return s;
+        }
+        if (auto block = dynamic_cast<BlockStmt*>(s.get())) {
+            stmts(block->statements);
+            return s;
+        }
+        if (auto ifStmt = dynamic_cast<IfStmt*>(s.get())) {
+            expr(ifStmt->condition);
+            stmts(ifStmt->thenBody);
+            stmts(ifStmt->elseBody);
+            return s;
+        }
+        if (auto whileStmt = dynamic_cast<WhileStmt*>(s.get())) {
+            expr(whileStmt->condition);
+            stmts(whileStmt->body);
+            return s;
+        }
+        if (auto each = dynamic_cast<EachLineStmt*>(s.get())) {
+            stmts(each->bind);
+            stmts(each->body);
+            return s;
+        }
+        if (auto spawn = dynamic_cast<SpawnStmt*>(s.get())) {
+            stmts(spawn->body);
+            return s;
+        }
+        if (auto forStmt = dynamic_cast<ForStmt*>(s.get())) {
+            forStmt->init = stmt(std::move(forStmt->init));
+            expr(forStmt->condition);
+            stmts(forStmt->body);
+            forStmt->update = stmt(std::move(forStmt->update));
+            return s;
+        }
+        return s;
+    }
+};
+
+TypeReport specializeTypes(std::vector<std::unique_ptr<Stmt>>& program) {
+    TypeAnalysis analysis;
+    analysis.run(program);
+
+    // what each variable was assigned and what it looked like when read
+    std::map<std::string, TypedVar> vars;
+    for (const auto& a : analysis.assigned) {
+        vars[a.first].assigned = a.second;
+    }
+    for (const auto& r : analysis.reads) {
+        vars[r.first->n].read |= r.second;
+    }
+
+    TypeReport report;
+    for (auto& entry : vars) {
+        TypedVar& v = entry.second;
+        v.name = entry.first;
+
+        // one number type on every store, and never read while unset
+        unsigned type = v.assigned;
+        if ((type == TYPE_INT || type == TYPE_DOUBLE) && (v.read & ~type) == 0) {
+            v.slotted = true;
+            v.kind = toKind(type);
+            v.slot = v.kind == NumKind::INT ? report.intSlots++ : report.doubleSlots++;
+        }
+        report.vars.push_back(v);
+    }
+
+    TypeRewriter rewriter(analysis, report);
+    rewriter.stmts(program);
+    return report;
+}
+
+// ===== --dump-types =====
+
+std::string typeNames(unsigned types) {
+    std::string out;
+    auto add = [&](unsigned bit, const char* name) {
+        if (!(types & bit)) return;
+        if (!out.empty()) out += "|";
+        out += name;
+    };
+    add(TYPE_INT, "int");
+    add(TYPE_DOUBLE, "double");
+    add(TYPE_STRING, "string");
+    add(TYPE_UNSET, "unset");
+    return out.empty() ? "none" : out;
+}
+
+void printTypeReport(const TypeReport& report, std::ostream& os) {
+    size_t width = 8;
+    for (const auto& v : report.vars) width = std::max(width, v.name.size() + 2);
+
+    for (const auto& v : report.vars) {
+        os << v.name << std::string(width - v.name.size(), ' ');
+
+        if (v.slotted) {
+            os << (v.kind == NumKind::INT ? "int" : "double") << " slot " << v.slot << "\n";
+            continue;
+        }
+
+        os << "boxed: ";
+        if (v.assigned == 0) {
+            os << "never assigned";
+        } else if ((v.assigned & (v.assigned - 1)) != 0) {
+            os << "holds " << typeNames(v.assigned);
+        } else if (v.assigned == TYPE_STRING) {
+            os << "string";
+        } else {
+            os << "may be read before it is set";
+        }
+        if (v.provenReads != 0) {
+            os << ", " << v.provenReads << " of " << v.reads << " reads known to be numbers";
+        }
+        os << "\n";
+    }
+
+    os << report.typedOps << " of " << report.binaryOps << " operators run on unboxed numbers, "
+       << report.intSlots << " int slots, " << report.doubleSlots << " double slots\n";
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../parser/AST.h"
+
+// Flow-sensitive type inference over the AST. Every variable read gets the
+// set of types it can hold at that point (int, double, string, or not set
+// yet). Then the program is rewritten:
+//   - variables that are only ever assigned ints (or only doubles) and are
+//     always set before they are read move into unboxed slots
+//     (SlotExpr / SlotAssignStmt)
+//   - arithmetic and comparisons whose operands are known numbers become
+//     TypedBinaryExpr, which runs without looking at variant tags
+// Anything the pass cannot prove is left alone and runs as before.
+// Variables a spawn body mentions can change whenever a task waits, so
+// they are never specialized.
+
+// possible types of a value, as bits
+static const unsigned TYPE_UNSET = 1;
+static const unsigned TYPE_INT = 2;
+static const unsigned TYPE_DOUBLE = 4;
+static const unsigned TYPE_STRING = 8;
+
+struct TypedVar {
+    std::string name;
+    unsigned assigned = 0;  // TYPE_* bits of every value stored into it
+    unsigned read = 0;      // TYPE_* bits seen at any read
+    size_t reads = 0;
+    size_t provenReads = 0; // reads where it was exactly one number type
+    bool slotted = false;
+    NumKind kind = NumKind::INT;
+    size_t slot = 0;
+};
+
+struct TypeReport {
+    std::vector<TypedVar> vars; // sorted by name
+    size_t intSlots = 0;
+    size_t doubleSlots = 0;
+    size_t binaryOps = 0;
+    size_t typedOps = 0;
+};
+
+// the types `left op right` can give, 0 when every pair throws
+unsigned binaryTypes(TokenTypes op, unsigned left, unsigned right);
+// the types a builtin call can give for these argument types
+unsigned callTypes(int builtin, const std::vector<unsigned>& args);
+// "int|string", for dumps
+std::string typeNames(unsigned types);
+
+TypeReport specializeTypes(std::vector<std::unique_ptr<Stmt>>& program);
+
+// --dump-types: which variables were specialized and why the rest were not
+void printTypeReport(const TypeReport& report, std::ostream& os);
@@ -1,107 +1,325 @@
-#pragma once
-
-#include <memory>
-#include <string>
-#include <vector>
-#include <variant>
-#include "../lexer/Token.h"  
-
-
-using Value = std::variant<int, double, std::string>;
-struct Expr {
-    virtual ~Expr() = default;
-};
-
-struct literalExpressions : Expr {
-    Value val;
-    literalExpressions(Value v) : val(v) {}
-};
-
-struct StringExpr : Expr {
-    std::string val;
-    StringExpr(const std::string &v) : val(v) {}
-};
-
-struct VariableExpr : Expr {
-    std::string n;
-    VariableExpr(const std::string  &n) : n(n) {}
-};
-
-struct BinaryExpr : Expr {
-    TokenTypes op;
-    std::unique_ptr<Expr> left;
-    std::unique_ptr<Expr> right;
-
-    BinaryExpr(
-        TokenTypes op,std::unique_ptr<Expr> left,std::unique_ptr<Expr> right): op(op),left(std::move(left)),right(std::move(right)) {}
-};
-
-struct CallExpr : Expr {
-    std::string callee;
-    std::unique_ptr<Expr> argument;
-
-    CallExpr(const std::string &c, std::unique_ptr<Expr> arg)
-        : callee(c), argument(std::move(arg)) {}
-};
-
-//=======================================================
-
-struct Stmt {
-    virtual ~Stmt() = default;
-};
-
-struct PrintStmt : Stmt {
-    std::unique_ptr<Expr> expression;
-
-    PrintStmt(std::unique_ptr<Expr> expression)
-        : expression(std::move(expression)) {}
-};
-
-struct BreakStmt : Stmt{
-    BreakStmt() = default;
-};
-struct InputStmt : Stmt {
-    std::string name;
-
-    InputStmt(const std::string &name)
-        : name(name) {}
-};
-
-struct AssignStmt : Stmt {
-    std::string name;
-    std::unique_ptr<Expr> expression;
-
-    AssignStmt(const std::string &n, std::unique_ptr<Expr> e)
-        : name(n), expression(std::move(e)) {}
-};
-
-// Block statement: { stmt; stmt; ... }
-struct BlockStmt : Stmt {
-    std::vector<std::unique_ptr<Stmt>> statements;
-
-    BlockStmt(std::vector<std::unique_ptr<Stmt>> stmts)
-        : statements(std::move(stmts)) {}
-};
-
-// If statement
-struct IfStmt : Stmt {
-    std::unique_ptr<Expr> condition;
-    std::vector<std::unique_ptr<Stmt>> thenBody;
-    std::vector<std::unique_ptr<Stmt>> elseBody;
-
-    IfStmt(
-        std::unique_ptr<Expr> cond,std::vector<std::unique_ptr<Stmt>> thenB, std::vector<std::unique_ptr<Stmt>> elseB)
-        : condition(std::move(cond)),thenBody(std::move(thenB)),elseBody(std::move(elseB)) {}
-};
-
-struct WhileStmt : Stmt {
-    std::unique_ptr<Expr> condition;
-    std::vector<std::unique_ptr<Stmt>> body;
-
-    WhileStmt(
-        std::unique_ptr<Expr> cond,
-        std::vector<std::unique_ptr<Stmt>> body
-    )
-        : condition(std::move(cond)),
-          body(std::move(body)) {}
-};
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <variant>
+#include "../lexer/Token.h"  
+
+
+using Value = std::variant<int, double, std::string>;
+struct Expr {
+    virtual ~Expr() = default;
+};
+
+struct literalExpressions : Expr {
+    Value val;
+    literalExpressions(Value v) : val(v) {}
+};
+
+struct StringExpr : Expr {
+    std::string val;
+    Value value; // same text, ready to hand out by reference
+    StringExpr(const std::string &v) : val(v), value(v) {}
+};
+
+struct VariableExpr : Expr {
+    std::string n;
+    VariableExpr(const std::string  &n) : n(n) {}
+};
+
+struct BinaryExpr : Expr {
+    TokenTypes op;
+    std::unique_ptr<Expr> left;
+    std::unique_ptr<Expr> right;
+
+    BinaryExpr(
+        TokenTypes op,std::unique_ptr<Expr> left,std::unique_ptr<Expr> right): op(op),left(std::move(left)),right(std::move(right)) {}
+    ~BinaryExpr() override;
+};
+
+struct CallExpr : Expr {
+    std::string callee;
+    std::vector<std::unique_ptr<Expr>> arguments;
+    int builtin = -1; // index in the builtin table {see runtime/Builtins.h}, set by the parser
+
+    CallExpr(const std::string &c, std::vector<std::unique_ptr<Expr>> args)
+        : callee(c), arguments(std::move(args)) {}
+    ~CallExpr() override;
+};
+
+// --each-line: part of the current input line, see EachLineStmt
+struct RecordExpr : Expr {
+    enum Kind { LINE, NUMBER, FIELD_COUNT, FIELD } kind; // line, NR, NF, f1 f2 ...
+    int field; // from 1, for FIELD
+
+    RecordExpr(Kind k, int f) : kind(k), field(f) {}
+};
+
+// ===== typed forms {built by the type inference pass, never by the parser} =====
+
+enum class NumKind { INT, DOUBLE };
+
+// a variable that only ever holds one number type, read from an unboxed slot
+struct SlotExpr : Expr {
+    NumKind kind;
+    size_t slot;
+    std::string name;
+
+    SlotExpr(NumKind k, size_t s, const std::string &n) : kind(k), slot(s), name(n) {}
+};
+
+// arithmetic or comparison whose operand types are known before running;
+// comparisons give an INT, everything else gives `operands`
+struct TypedBinaryExpr : Expr {
+    TokenTypes op;
+    NumKind operands;  // DOUBLE when either side is a double
+    NumKind result;
+    NumKind leftKind;
+    NumKind rightKind;
+    std::unique_ptr<Expr> left;
+    std::unique_ptr<Expr> right;
+
+    TypedBinaryExpr(TokenTypes op, NumKind operands, NumKind result, NumKind lk, NumKind rk,
+                    std::unique_ptr<Expr> l, std::unique_ptr<Expr> r)
+        : op(op), operands(operands), result(result), leftKind(lk), rightKind(rk),
+          left(std::move(l)), right(std::move(r)) {}
+    ~TypedBinaryExpr() override;
+};
+
+// Generated code can nest expressions millions deep; freeing them through
+// unique_ptr would recurse once per level, so nested operator and call
+// nodes are detached onto a worklist and freed one at a time.
+inline void releaseExprTree(std::unique_ptr<Expr> a, std::unique_ptr<Expr> b = nullptr) {
+    auto nested = [](const std::unique_ptr<Expr>& e) {
+        return dynamic_cast<BinaryExpr*>(e.get()) || dynamic_cast<CallExpr*>(e.get()) ||
+               dynamic_cast<TypedBinaryExpr*>(e.get());
+    };
+    if (!nested(a) && !nested(b)) return;
+
+    std::vector<std::unique_ptr<Expr>> pending;
+    pending.push_back(std::move(a));
+    pending.push_back(std::move(b));
+
+    while (!pending.empty()) {
+        std::unique_ptr<Expr> e = std::move(pending.back());
+        pending.pop_back();
+
+        if (auto bin = dynamic_cast<BinaryExpr*>(e.get())) {
+            pending.push_back(std::move(bin->left));
+            pending.push_back(std::move(bin->right));
+        } else if (auto call = dynamic_cast<CallExpr*>(e.get())) {
+            for (auto& arg : call->arguments) pending.push_back(std::move(arg));
+        } else if (auto typed = dynamic_cast<TypedBinaryExpr*>(e.get())) {
+            pending.push_back(std::move(typed->left));
+            pending.push_back(std::move(typed->right));
+        }
+    }
+}
+
+inline BinaryExpr::~BinaryExpr() {
+    releaseExprTree(std::move(left), std::move(right));
+}
+
+inline CallExpr::~CallExpr() {
+    for (auto& arg : arguments) releaseExprTree(std::move(arg));
+}
+
+inline TypedBinaryExpr::~TypedBinaryExpr() {
+    releaseExprTree(std::move(left), std::move(right));
+}
+
+//=======================================================
+
+struct Stmt {
+    int line = 0; // source line of the statement's first token
+    virtual ~Stmt() = default;
+};
+
+struct PrintStmt : Stmt {
+    std::unique_ptr<Expr> expression;
+
+    PrintStmt(std::unique_ptr<Expr> expression)
+        : expression(std::move(expression)) {}
+};
+
+struct BreakStmt : Stmt{
+    BreakStmt() = default;
+};
+struct InputStmt : Stmt {
+    std::string name;
+
+    InputStmt(const std::string &name)
+        : name(name) {}
+};
+
+struct AssignStmt : Stmt {
+    std::string name;
+    std::unique_ptr<Expr> expression;
+
+    AssignStmt(const std::string &n, std::unique_ptr<Expr> e)
+        : name(n), expression(std::move(e)) {}
+};
+
+// Block statement: { stmt; stmt; ... }
+struct BlockStmt : Stmt {
+    std::vector<std::unique_ptr<Stmt>> statements;
+
+    BlockStmt(std::vector<std::unique_ptr<Stmt>> stmts)
+        : statements(std::move(stmts)) {}
+};
+
+// If statement
+struct IfStmt : Stmt {
+    std::unique_ptr<Expr> condition;
+    std::vector<std::unique_ptr<Stmt>> thenBody;
+    std::vector<std::unique_ptr<Stmt>> elseBody;
+
+    IfStmt(
+        std::unique_ptr<Expr> cond,std::vector<std::unique_ptr<Stmt>> thenB, std::vector<std::unique_ptr<Stmt>> elseB)
+        : condition(std::move(cond)),thenBody(std::move(thenB)),elseBody(std::move(elseB)) {}
+};
+
+struct WhileStmt : Stmt {
+    std::unique_ptr<Expr> condition;
+    std::vector<std::unique_ptr<Stmt>> body;
+
+    WhileStmt(
+        std::unique_ptr<Expr> cond,
+        std::vector<std::unique_ptr<Stmt>> body
+    )
+        : condition(std::move(cond)),
+          body(std::move(body)) {}
+};
+
+// for (init; condition; update) { body }
+// init and update are assignments; break skips the update
+struct ForStmt : Stmt {
+    std::unique_ptr<Stmt> init;
+    std::unique_ptr<Expr> condition;
+    std::unique_ptr<Stmt> update;
+    std::vector<std::unique_ptr<Stmt>> body;
+
+    ForStmt(
+        std::unique_ptr<Stmt> init,
+        std::unique_ptr<Expr> cond,
+        std::unique_ptr<Stmt> update,
+        std::vector<std::unique_ptr<Stmt>> body
+    )
+        : init(std::move(init)),
+          condition(std::move(cond)),
+          update(std::move(update)),
+          body(std::move(body)) {}
+};
+
+// BEGIN { ... } or END { ... } at the top level; Parser::arrangePhases
+// moves their statements to the start / end of the program
+struct PhaseStmt : Stmt {
+    bool end;
+    std::vector<std::unique_ptr<Stmt>> body;
+
+    PhaseStmt(bool end, std::vector<std::unique_ptr<Stmt>> body) : end(end), body(std::move(body)) {}
+};
+
+// --each-line: the program outside BEGIN and END, run once per input
+// line. `bind` assigns the record variables the program uses
+// (line = RecordExpr, NR = ..., f2 = ...) before each run of the body.
+struct EachLineStmt : Stmt {
+    std::vector<std::unique_ptr<Stmt>> bind;
+    std::vector<std::unique_ptr<Stmt>> body;
+
+    EachLineStmt(std::vector<std::unique_ptr<Stmt>> bind, std::vector<std::unique_ptr<Stmt>> body)
+        : bind(std::move(bind)), body(std::move(body)) {}
+};
+
+// --lazy-parse: an if or while body the parser only skipped over by
+// matching braces. The interpreter parses it the first time it runs; until
+// then the passes only know `names`, the variables it mentions, and treat
+// them as read and assigned with any type.
+struct LazyBlockStmt : Stmt {
+    const std::vector<Token>* tokens; // the caller keeps them alive
+    size_t begin;  // first token after '{'
+    size_t end;    // the matching '}'
+    int loopDepth; // of the body, for the 'break' check
+    bool hasBreak = false;
+    std::vector<std::string> names;
+
+    // filled once, by whoever runs the body first
+    mutable std::once_flag parsed;
+    mutable std::vector<std::unique_ptr<Stmt>> body;
+
+    LazyBlockStmt(const std::vector<Token>* tokens, size_t begin, size_t end, int loopDepth)
+        : tokens(tokens), begin(begin), end(end), loopDepth(loopDepth) {}
+};
+
+// spawn { body }: the body runs as a task of its own {see runtime/Tasks.h}
+// while the statements after it go on. It shares the variables of the
+// program; 'break' cannot leave it.
+struct SpawnStmt : Stmt {
+    std::vector<std::unique_ptr<Stmt>> body;
+
+    SpawnStmt(std::vector<std::unique_ptr<Stmt>> body) : body(std::move(body)) {}
+};
+
+// ===== fused forms {built by the superinstruction pass, never by the parser} =====
+
+// name = name + k  or  name = name - k  with an int literal k
+struct IncrementStmt : Stmt {
+    std::string name;
+    int delta;
+    std::unique_ptr<Stmt> original; // generic form for when name is not an int
+
+    IncrementStmt(const std::string &n, int d, std::unique_ptr<Stmt> orig)
+        : name(n), delta(d), original(std::move(orig)) {}
+};
+
+// dst = src;
+struct CopyStmt : Stmt {
+    std::string dst;
+    std::string src;
+
+    CopyStmt(const std::string &d, const std::string &s) : dst(d), src(s) {}
+};
+
+// a < b  or  a < 5  used as an if/while condition
+struct CompareVarsExpr : Expr {
+    TokenTypes op;
+    std::string left;
+    std::string right;     // empty when comparing against rightConst
+    int rightConst = 0;
+    std::unique_ptr<Expr> original; // generic form for non-int operands
+
+    CompareVarsExpr(TokenTypes op, const std::string &l, const std::string &r, int k, std::unique_ptr<Expr> orig)
+        : op(op), left(l), right(r), rightConst(k), original(std::move(orig)) {}
+};
+
+// for (i = a; i < b; i = i + k) where the body never assigns i: the
+// counter is stepped as a plain int and b, when nothing in the body can
+// change it, is evaluated once
+struct CountedForStmt : Stmt {
+    std::string var;
+    bool slotted = false;  // i lives in an int slot {see TypeInference.h}
+    size_t slot = 0;
+    TokenTypes cmp;
+    int step;
+    const Expr* bound;     // right side of original->condition
+    bool invariantBound;
+    std::unique_ptr<ForStmt> original; // generic form for when i or b is not an int
+
+    CountedForStmt(const std::string &v, TokenTypes cmp, int step, const Expr* bound,
+                   bool invariant, std::unique_ptr<ForStmt> orig)
+        : var(v), cmp(cmp), step(step), bound(bound), invariantBound(invariant),
+          original(std::move(orig)) {}
+};
+
+// name = expression; for a variable kept in an unboxed slot
+struct SlotAssignStmt : Stmt {
+    NumKind kind;
+    size_t slot;
+    std::string name;
+    std::unique_ptr<Expr> expression;
+
+    SlotAssignStmt(NumKind k, size_t s, const std::string &n, std::unique_ptr<Expr> e)
+        : kind(k), slot(s), name(n), expression(std::move(e)) {}
+};
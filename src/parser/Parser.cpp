@@ -1,316 +1,599 @@
-#include "Parser.h"
-#include <stdexcept>
-#include <iostream>
-
-//consturctor
-Parser::Parser(const std::vector<Token>& tokens)
-    : tokens(tokens), cur(0) {}
-
-
-
-const Token& Parser::peek() const {
-    return tokens[cur];
-}
-
-const Token& Parser::previous() const {
-    return tokens[cur - 1];
-}
-
-bool Parser::isAtEnd() const {
-    return peek().t == TokenTypes::END_OF_FILE;
-}
-
-const Token& Parser::advance() {
-    if (!isAtEnd()) cur++;
-    return previous();
-}
-
-bool Parser::check(TokenTypes type) const {
-    if (isAtEnd()) return false;
-    return peek().t == type;
-}
-
-bool Parser::match(TokenTypes type) {
-    if (check(type)) {
-        advance();
-        return true;
-    }
-    return false;
-}
-
-std::vector<std::unique_ptr<Stmt>> Parser::parse() {
-    
-    std::vector<std::unique_ptr<Stmt>> statements;
-
-    while (!isAtEnd()) {
-        if(check(TokenTypes::END_OF_FILE)) {break;};
-        statements.push_back(parseStatement());
-    }
-
-    return statements;
-}
-
-
-// Parses a block: assumes current token is '{' (it will consume it).
-// Returns a vector of statements that were inside the block.
-std::vector<std::unique_ptr<Stmt>> Parser::parseBlock() {
-    if (!match(TokenTypes::CURLY_L))
-        throw std::runtime_error("Expected '{' to start block");
-
-    std::vector<std::unique_ptr<Stmt>> stmts;
-
-    while (!check(TokenTypes::CURLY_R) && !isAtEnd()) {
-        stmts.push_back(parseStatement());
-    }
-
-    if (!match(TokenTypes::CURLY_R))
-        throw std::runtime_error("Expected '}' to close block");
-
-    return stmts;
-}
-
-
-std::unique_ptr<Stmt> Parser::parseStatement() {
-    // Skip leading comments
-    while (check(TokenTypes::COMMENT)) advance();
-
-    // block as a statement: { ... }
-    if (check(TokenTypes::CURLY_L)) {
-        auto body = parseBlock();
-        return std::make_unique<BlockStmt>(std::move(body));
-    }
-    
-    if (match(TokenTypes::BREAK)) {
-        if (loopDepth == 0) {
-            throw std::runtime_error("'break' used outside of a loop");
-        }
-
-        if (!match(TokenTypes::SEMICOLON))
-            throw std::runtime_error("Expected ';' after 'break'");
-
-        return std::make_unique<BreakStmt>();
-    }
-
-
-    // out(expression);
-    if (match(TokenTypes::OUT)) {
-        if (!match(TokenTypes::PAREN_L))
-            throw std::runtime_error("Expected '(' after 'out'");
-
-        auto expr = parseExpression();
-
-        if (!match(TokenTypes::PAREN_R))
-            throw std::runtime_error("Expected ')' after expression");
-
-        if (!match(TokenTypes::SEMICOLON))
-            throw std::runtime_error("Expected ';' after out statement");
-
-        return std::make_unique<PrintStmt>(std::move(expr));
-    }
-
-    // in(identifier);
-    if (match(TokenTypes::IN)) {
-        if (!match(TokenTypes::PAREN_L))
-            throw std::runtime_error("Expected '(' after 'in'");
-
-        if (!match(TokenTypes::IDENTIFIER))
-            throw std::runtime_error("Expected identifier in in()");
-
-        std::string name = previous().value;
-
-        if (!match(TokenTypes::PAREN_R))
-            throw std::runtime_error("Expected ')' after identifier");
-
-        if (!match(TokenTypes::SEMICOLON))
-            throw std::runtime_error("Expected ';' after in statement");
-
-        return std::make_unique<InputStmt>(name);
-    }
-
-    // if (condition) { ... }
-    if (match(TokenTypes::IF)) {
-        if (!match(TokenTypes::PAREN_L))
-            throw std::runtime_error("Expected '(' after 'if'");
-
-        auto condition = parseExpression();
-
-        if (!match(TokenTypes::PAREN_R))
-            throw std::runtime_error("Expected ')' after if condition");
-
-        auto thenBody = parseBlock();
-
-        std::vector<std::unique_ptr<Stmt>> elseBody;
-
-        if (match(TokenTypes::ELSE)) {
-            elseBody = parseBlock();
-        }
-
-        return std::make_unique<IfStmt>(
-            std::move(condition),
-            std::move(thenBody),
-            std::move(elseBody)
-        );
-    }
-
-    // while (condition) { ... }
-if (match(TokenTypes::WHILE)) {
-    if (!match(TokenTypes::PAREN_L))
-        throw std::runtime_error("Expected '(' after 'while'");
-
-    auto condition = parseExpression();
-
-    if (!match(TokenTypes::PAREN_R))
-        throw std::runtime_error("Expected ')' after while condition");
-
-    loopDepth++;
-    auto body = parseBlock();
-    loopDepth--;
-
-    return std::make_unique<WhileStmt>(
-        std::move(condition),
-        std::move(body)
-    );
-}
-
-    // assignment: identifier = expression;
-    if (check(TokenTypes::IDENTIFIER)) {
-        // look ahead safely (skip comments)
-        size_t i = cur + 1;
-        while (i < tokens.size() && tokens[i].t == TokenTypes::COMMENT) i++;
-
-        bool isAssign = (i < tokens.size() && tokens[i].t == TokenTypes::EQUALS);
-
-        if (isAssign) {
-            advance(); // consume identifier
-            std::string name = previous().value;
-
-            // consume any comments as they are ignored either way
-            while (check(TokenTypes::COMMENT)) advance();
-
-            // consume '=' {we dont want this to go for calculation}
-            if (!match(TokenTypes::EQUALS))
-                throw std::runtime_error("Expected '=' after identifier");
-
-            auto expr = parseExpression();
-
-            if (!match(TokenTypes::SEMICOLON))
-                throw std::runtime_error("Expected ';' after assignment");
-
-            return std::make_unique<AssignStmt>(name, std::move(expr));
-        }
-    }
-
-    throw std::runtime_error("Unknown statement");
-}
-
-
-std::unique_ptr<Expr> Parser::parseExpression() {
-    return parseComparison();
-}
-
-std::unique_ptr<Expr> Parser::parseComparison() {
-    auto expr = parseTerm();
-
-    while (
-        match(TokenTypes::EQUAL_EQUAL) ||
-        match(TokenTypes::NOT_EQUAL) ||
-        match(TokenTypes::GREATER) ||
-        match(TokenTypes::LESSER) ||
-        match(TokenTypes::GREATER_EQUAL) ||
-        match(TokenTypes::LESSER_EQUAL)
-    ) {
-        TokenTypes op = previous().t;
-        auto right = parseTerm();
-
-        expr = std::make_unique<BinaryExpr>(
-            op,
-            std::move(expr),
-            std::move(right)
-        );
-    }
-
-    return expr;
-}
-
-std::unique_ptr<Expr> Parser::parseTerm() {
-    auto expr = parseFactor();
-
-    while (match(TokenTypes::PLUS) || match(TokenTypes::MINUS)) {
-        TokenTypes op = previous().t;
-        auto right = parseFactor();
-
-        expr = std::make_unique<BinaryExpr>(
-            op,
-            std::move(expr),
-            std::move(right)
-        );
-    }
-
-    return expr;
-}
-
-std::unique_ptr<Expr> Parser::parseFactor() {
-    auto expr = parsePrimary();
-
-    while (
-        match(TokenTypes::ASTERISK) ||
-        match(TokenTypes::SLASH) ||
-        match(TokenTypes::MODULUS)
-    ) {
-        TokenTypes op = previous().t;
-        auto right = parsePrimary();
-
-        expr = std::make_unique<BinaryExpr>(
-            op,
-            std::move(expr),
-            std::move(right)
-        );
-    }
-
-    return expr;
-}
-
-std::unique_ptr<Expr> Parser::parsePrimary() {
-
-    if (match(TokenTypes::NUMBER)) {
-    int v = std::stoi(previous().value);
-    return std::make_unique< literalExpressions>(v);
-        }
-
-        if (match(TokenTypes::FLOAT)) {
-            double v = std::stod(previous().value);
-            return std::make_unique< literalExpressions>(v);
-        }
-
-
-    if (match(TokenTypes::STRING)) {
-        return std::make_unique<StringExpr>(previous().value);
-    }
-
-    if (match(TokenTypes::IDENTIFIER)) {
-        std::string name = previous().value;
-
-        // function call
-        if (match(TokenTypes::PAREN_L)) {
-            auto arg = parseExpression();
-
-            if (!match(TokenTypes::PAREN_R))
-                throw std::runtime_error("Expected ')' after function argument");
-
-            return std::make_unique<CallExpr>(name, std::move(arg));
-        }
-
-        return std::make_unique<VariableExpr>(name);
-    }
-
-    if (match(TokenTypes::PAREN_L)) {
-        auto expr = parseExpression();
-
-        if (!match(TokenTypes::PAREN_R))
-            throw std::runtime_error("Expected ')' after expression");
-
-        return expr;
-    }
-
-    throw std::runtime_error("Expected expression");
-}
+#include "Parser.h"
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <array>
+#include <set>
+
+#include "../runtime/Builtins.h"
+#include "../runtime/NumberFormat.h"
+
+//consturctor
+Parser::Parser(const std::vector<Token>& tokens, bool lazy)
+    : lazy(lazy), tokens(tokens), cur(0) {}
+
+
+
+const Token& Parser::peek() const {
+    return tokens[cur];
+}
+
+const Token& Parser::previous() const {
+    return tokens[cur - 1];
+}
+
+bool Parser::isAtEnd() const {
+    return peek().t == TokenTypes::END_OF_FILE;
+}
+
+const Token& Parser::advance() {
+    if (!isAtEnd()) cur++;
+    return previous();
+}
+
+bool Parser::check(TokenTypes type) const {
+    if (isAtEnd()) return false;
+    return peek().t == type;
+}
+
+// looks one token past the current one
+bool Parser::checkNext(TokenTypes type) const {
+    if (isAtEnd() || cur + 1 >= tokens.size()) return false;
+    return tokens[cur + 1].t == type;
+}
+
+bool Parser::match(TokenTypes type) {
+    if (check(type)) {
+        advance();
+        return true;
+    }
+    return false;
+}
+
+std::vector<std::unique_ptr<Stmt>> Parser::parse() {
+    
+    std::vector<std::unique_ptr<Stmt>> statements;
+
+    // a task can change variables at any point another task waits, so the
+    // passes need to see every body of a program that spawns one
+    for (const Token& t : tokens) {
+        if (t.t == TokenTypes::SPAWN) lazy = false;
+    }
+
+    while (!isAtEnd()) {
+        if(check(TokenTypes::END_OF_FILE)) {break;};
+
+        // BEGIN { ... } / END { ... }, only at the top level
+        if (check(TokenTypes::IDENTIFIER) && (peek().value == "BEGIN" || peek().value == "END") &&
+            checkNext(TokenTypes::CURLY_L)) {
+            int line = peek().line;
+            bool end = advance().value == "END";
+            auto phase = std::make_unique<PhaseStmt>(end, parseBlock());
+            phase->line = line;
+            statements.push_back(std::move(phase));
+            continue;
+        }
+        statements.push_back(parseStatement());
+    }
+
+    return statements;
+}
+
+// which record variable a name is, false for everything else
+static bool recordVariable(const std::string& name, RecordExpr::Kind& kind, int& field) {
+    field = 0;
+    if (name == "line") kind = RecordExpr::LINE;
+    else if (name == "NR") kind = RecordExpr::NUMBER;
+    else if (name == "NF") kind = RecordExpr::FIELD_COUNT;
+    else {
+        // f1, f2, ... without leading zeros
+        if (name.size() < 2 || name.size() > 6 || name[0] != 'f' || name[1] == '0') return false;
+        for (size_t i = 1; i < name.size(); i++) {
+            if (name[i] < '0' || name[i] > '9') return false;
+        }
+        kind = RecordExpr::FIELD;
+        field = std::stoi(name.substr(1));
+    }
+    return true;
+}
+
+void Parser::arrangePhases(std::vector<std::unique_ptr<Stmt>>& program, bool eachLine) const {
+    std::vector<std::unique_ptr<Stmt>> begin, body, end;
+    for (auto& s : program) {
+        if (auto phase = dynamic_cast<PhaseStmt*>(s.get())) {
+            auto& to = phase->end ? end : begin;
+            for (auto& inner : phase->body) to.push_back(std::move(inner));
+        } else {
+            body.push_back(std::move(s));
+        }
+    }
+
+    program = std::move(begin);
+    if (!eachLine) {
+        for (auto& s : body) program.push_back(std::move(s));
+    } else {
+        // bind only what the program mentions, each name once, in order
+        std::vector<std::unique_ptr<Stmt>> bind;
+        std::set<std::string> seen;
+        for (const Token& t : tokens) {
+            RecordExpr::Kind kind;
+            int field = 0;
+            if (t.t != TokenTypes::IDENTIFIER || !recordVariable(t.value, kind, field)) continue;
+            if (!seen.insert(t.value).second) continue;
+            bind.push_back(std::make_unique<AssignStmt>(t.value, std::make_unique<RecordExpr>(kind, field)));
+        }
+
+        int line = body.empty() ? 1 : body.front()->line;
+        for (auto& b : bind) b->line = line;
+        auto each = std::make_unique<EachLineStmt>(std::move(bind), std::move(body));
+        each->line = line;
+        program.push_back(std::move(each));
+    }
+    for (auto& s : end) program.push_back(std::move(s));
+}
+
+
+// Parses a block: assumes current token is '{' (it will consume it).
+// Returns a vector of statements that were inside the block.
+std::vector<std::unique_ptr<Stmt>> Parser::parseBlock() {
+    if (!match(TokenTypes::CURLY_L))
+        throw std::runtime_error("Expected '{' to start block");
+
+    std::vector<std::unique_ptr<Stmt>> stmts;
+
+    while (!check(TokenTypes::CURLY_R) && !isAtEnd()) {
+        stmts.push_back(parseStatement());
+    }
+
+    if (!match(TokenTypes::CURLY_R))
+        throw std::runtime_error("Expected '}' to close block");
+
+    return stmts;
+}
+
+
+// if and while bodies: with --lazy-parse a big body is only skimmed for
+// its closing brace and the variables it names, and parsed when it runs
+std::vector<std::unique_ptr<Stmt>> Parser::parseBody() {
+    if (!lazy || !check(TokenTypes::CURLY_L)) return parseBlock();
+
+    size_t open = cur;
+    size_t close = cur;
+    int depth = 0;
+    for (; tokens[close].t != TokenTypes::END_OF_FILE; close++) {
+        if (tokens[close].t == TokenTypes::CURLY_L) depth++;
+        else if (tokens[close].t == TokenTypes::CURLY_R && --depth == 0) break;
+    }
+    if (tokens[close].t != TokenTypes::CURLY_R)
+        throw std::runtime_error("Expected '}' to close block");
+    if (close - open - 1 < LAZY_MIN_TOKENS) return parseBlock();
+
+    auto block = std::make_unique<LazyBlockStmt>(&tokens, open + 1, close, loopDepth);
+    block->line = tokens[open + 1].line;
+    std::set<std::string> names;
+    for (size_t i = open + 1; i < close; i++) {
+        if (tokens[i].t == TokenTypes::BREAK) block->hasBreak = true;
+        // a name followed by '(' is a function
+        if (tokens[i].t == TokenTypes::IDENTIFIER && tokens[i + 1].t != TokenTypes::PAREN_L)
+            names.insert(tokens[i].value);
+    }
+    block->names.assign(names.begin(), names.end());
+    cur = close + 1;
+
+    std::vector<std::unique_ptr<Stmt>> body;
+    body.push_back(std::move(block));
+    return body;
+}
+
+std::vector<std::unique_ptr<Stmt>> Parser::parseSkipped(const LazyBlockStmt& block) {
+    cur = block.begin;
+    loopDepth = block.loopDepth;
+
+    std::vector<std::unique_ptr<Stmt>> stmts;
+    while (cur < block.end) {
+        stmts.push_back(parseStatement());
+    }
+    if (cur != block.end)
+        throw std::runtime_error("Expected '}' to close block");
+    return stmts;
+}
+
+std::unique_ptr<Stmt> Parser::parseStatement() {
+    // Skip leading comments
+    while (check(TokenTypes::COMMENT)) advance();
+
+    // every statement remembers where it starts, for profiles and errors
+    int line = peek().line;
+    auto stmt = parseStatementKind();
+    stmt->line = line;
+    return stmt;
+}
+
+std::unique_ptr<Stmt> Parser::parseStatementKind() {
+    // block as a statement: { ... }
+    if (check(TokenTypes::CURLY_L)) {
+        auto body = parseBlock();
+        return std::make_unique<BlockStmt>(std::move(body));
+    }
+    
+    if (match(TokenTypes::BREAK)) {
+        if (loopDepth == 0) {
+            throw std::runtime_error("'break' used outside of a loop");
+        }
+
+        if (!match(TokenTypes::SEMICOLON))
+            throw std::runtime_error("Expected ';' after 'break'");
+
+        return std::make_unique<BreakStmt>();
+    }
+
+
+    // spawn { ... }; break cannot leave a task
+    if (match(TokenTypes::SPAWN)) {
+        if (!check(TokenTypes::CURLY_L))
+            throw std::runtime_error("Expected '{' after 'spawn'");
+
+        int outer = loopDepth;
+        loopDepth = 0;
+        auto body = parseBlock();
+        loopDepth = outer;
+
+        return std::make_unique<SpawnStmt>(std::move(body));
+    }
+
+    // out(expression);
+    if (match(TokenTypes::OUT)) {
+        if (!match(TokenTypes::PAREN_L))
+            throw std::runtime_error("Expected '(' after 'out'");
+
+        auto expr = parseExpression();
+
+        if (!match(TokenTypes::PAREN_R))
+            throw std::runtime_error("Expected ')' after expression");
+
+        if (!match(TokenTypes::SEMICOLON))
+            throw std::runtime_error("Expected ';' after out statement");
+
+        return std::make_unique<PrintStmt>(std::move(expr));
+    }
+
+    // in(identifier);
+    if (match(TokenTypes::IN)) {
+        if (!match(TokenTypes::PAREN_L))
+            throw std::runtime_error("Expected '(' after 'in'");
+
+        if (!match(TokenTypes::IDENTIFIER))
+            throw std::runtime_error("Expected identifier in in()");
+
+        std::string name = previous().value;
+
+        if (!match(TokenTypes::PAREN_R))
+            throw std::runtime_error("Expected ')' after identifier");
+
+        if (!match(TokenTypes::SEMICOLON))
+            throw std::runtime_error("Expected ';' after in statement");
+
+        return std::make_unique<InputStmt>(name);
+    }
+
+    // if (condition) { ... }
+    if (match(TokenTypes::IF)) {
+        if (!match(TokenTypes::PAREN_L))
+            throw std::runtime_error("Expected '(' after 'if'");
+
+        auto condition = parseExpression();
+
+        if (!match(TokenTypes::PAREN_R))
+            throw std::runtime_error("Expected ')' after if condition");
+
+        auto thenBody = parseBody();
+
+        std::vector<std::unique_ptr<Stmt>> elseBody;
+
+        if (match(TokenTypes::ELSE)) {
+            elseBody = parseBody();
+        }
+
+        return std::make_unique<IfStmt>(
+            std::move(condition),
+            std::move(thenBody),
+            std::move(elseBody)
+        );
+    }
+
+    // while (condition) { ... }
+if (match(TokenTypes::WHILE)) {
+    if (!match(TokenTypes::PAREN_L))
+        throw std::runtime_error("Expected '(' after 'while'");
+
+    auto condition = parseExpression();
+
+    if (!match(TokenTypes::PAREN_R))
+        throw std::runtime_error("Expected ')' after while condition");
+
+    loopDepth++;
+    auto body = parseBody();
+    loopDepth--;
+
+    return std::make_unique<WhileStmt>(
+        std::move(condition),
+        std::move(body)
+    );
+}
+
+    // for (i = 0; i < n; i = i + 1) { ... }
+    if (match(TokenTypes::FOR)) {
+        if (!match(TokenTypes::PAREN_L))
+            throw std::runtime_error("Expected '(' after 'for'");
+
+        auto init = parseForAssignment("Expected assignment to start the for loop");
+
+        if (!match(TokenTypes::SEMICOLON))
+            throw std::runtime_error("Expected ';' after for initializer");
+
+        auto condition = parseExpression();
+
+        if (!match(TokenTypes::SEMICOLON))
+            throw std::runtime_error("Expected ';' after for condition");
+
+        auto update = parseForAssignment("Expected assignment as the for update");
+
+        if (!match(TokenTypes::PAREN_R))
+            throw std::runtime_error("Expected ')' after for update");
+
+        loopDepth++;
+        auto body = parseBlock();
+        loopDepth--;
+
+        return std::make_unique<ForStmt>(
+            std::move(init),
+            std::move(condition),
+            std::move(update),
+            std::move(body)
+        );
+    }
+
+    // assignment: identifier = expression;
+    if (check(TokenTypes::IDENTIFIER)) {
+        // look ahead safely (skip comments)
+        size_t i = cur + 1;
+        while (i < tokens.size() && tokens[i].t == TokenTypes::COMMENT) i++;
+
+        bool isAssign = (i < tokens.size() && tokens[i].t == TokenTypes::EQUALS);
+
+        if (isAssign) {
+            advance(); // consume identifier
+            std::string name = previous().value;
+
+            // consume any comments as they are ignored either way
+            while (check(TokenTypes::COMMENT)) advance();
+
+            // consume '=' {we dont want this to go for calculation}
+            if (!match(TokenTypes::EQUALS))
+                throw std::runtime_error("Expected '=' after identifier");
+
+            auto expr = parseExpression();
+
+            if (!match(TokenTypes::SEMICOLON))
+                throw std::runtime_error("Expected ';' after assignment");
+
+            return std::make_unique<AssignStmt>(name, std::move(expr));
+        }
+    }
+
+    throw std::runtime_error("Unknown statement");
+}
+
+
+// `name = expression` inside a for header, no ';'
+std::unique_ptr<Stmt> Parser::parseForAssignment(const char* what) {
+    int line = peek().line;
+    if (!check(TokenTypes::IDENTIFIER) || !checkNext(TokenTypes::EQUALS))
+        throw std::runtime_error(what);
+
+    std::string name = advance().value;
+    advance(); // '='
+
+    auto stmt = std::make_unique<AssignStmt>(name, parseExpression());
+    stmt->line = line;
+    return stmt;
+}
+
+// binding power of every token as a binary operator, 0 = not an operator.
+// one table lookup per token decides both "is it an operator" and "how tight"
+static const int OPERATOR_COUNT = static_cast<int>(TokenTypes::END_OF_FILE) + 1;
+
+static const std::array<unsigned char, OPERATOR_COUNT> PRECEDENCE = [] {
+    std::array<unsigned char, OPERATOR_COUNT> table{};
+
+    table[static_cast<int>(TokenTypes::EQUAL_EQUAL)] = 1;
+    table[static_cast<int>(TokenTypes::NOT_EQUAL)] = 1;
+    table[static_cast<int>(TokenTypes::GREATER)] = 1;
+    table[static_cast<int>(TokenTypes::LESSER)] = 1;
+    table[static_cast<int>(TokenTypes::GREATER_EQUAL)] = 1;
+    table[static_cast<int>(TokenTypes::LESSER_EQUAL)] = 1;
+
+    table[static_cast<int>(TokenTypes::PLUS)] = 2;
+    table[static_cast<int>(TokenTypes::MINUS)] = 2;
+
+    table[static_cast<int>(TokenTypes::ASTERISK)] = 3;
+    table[static_cast<int>(TokenTypes::SLASH)] = 3;
+    table[static_cast<int>(TokenTypes::MODULUS)] = 3;
+
+    return table;
+}();
+
+// Operator-precedence parse with explicit stacks instead of one C++ call per
+// precedence level and per '(' -- nesting depth is limited by heap only.
+// All operators are left associative.
+std::unique_ptr<Expr> Parser::parseExpression() {
+    // pending work on the operator stack
+    struct Frame {
+        enum Kind { BINARY, GROUP, CALL } kind;
+        TokenTypes op;
+        int prec;
+        std::string callee;
+        size_t args; // commas seen so far, plus one
+    };
+
+    std::vector<std::unique_ptr<Expr>> operands;
+    std::vector<size_t> heights; // levels of each operand's tree, see MAX_EXPR_DEPTH
+    std::vector<Frame> ops;
+    size_t openGroups = 0;
+
+    auto push = [&](std::unique_ptr<Expr> e, size_t height) {
+        if (height > MAX_EXPR_DEPTH) {
+            throw std::runtime_error("Expression nested more than " + std::to_string(MAX_EXPR_DEPTH) + " levels deep");
+        }
+        operands.push_back(std::move(e));
+        heights.push_back(height);
+    };
+
+    auto reduce = [&]() {
+        Frame f = std::move(ops.back());
+        ops.pop_back();
+        auto right = std::move(operands.back());
+        operands.pop_back();
+        auto left = std::move(operands.back());
+        operands.pop_back();
+        size_t height = std::max(heights[heights.size() - 2], heights.back()) + 1;
+        heights.resize(heights.size() - 2);
+        push(std::make_unique<BinaryExpr>(f.op, std::move(left), std::move(right)), height);
+    };
+
+    while (true) {
+        // operand position: any number of '(' or `name(` then one primary
+        bool haveOperand = false;
+        while (true) {
+            if (match(TokenTypes::PAREN_L)) {
+                ops.push_back({ Frame::GROUP, TokenTypes::PAREN_L, 0, "", 0 });
+                openGroups++;
+            } else if (check(TokenTypes::IDENTIFIER) && checkNext(TokenTypes::PAREN_L)) {
+                std::string name = advance().value;
+                advance();
+                if (match(TokenTypes::PAREN_R)) {
+                    // name() -- nothing to collect
+                    push(makeCall(name, std::vector<std::unique_ptr<Expr>>()), 1);
+                    haveOperand = true;
+                    break;
+                }
+                ops.push_back({ Frame::CALL, TokenTypes::PAREN_L, 0, name, 1 });
+                openGroups++;
+            } else {
+                break;
+            }
+        }
+        if (!haveOperand) push(parsePrimary(), 1);
+
+        // operator position: close groups until a binary operator or the end
+        bool sawOperator = false;
+        while (!sawOperator) {
+            TokenTypes t = peek().t;
+            int prec = PRECEDENCE[static_cast<int>(t)];
+
+            if (prec > 0) {
+                advance();
+                while (!ops.empty() && ops.back().kind == Frame::BINARY && ops.back().prec >= prec) {
+                    reduce();
+                }
+                ops.push_back({ Frame::BINARY, t, prec, "", 0 });
+                sawOperator = true;
+            } else if (openGroups > 0 && t == TokenTypes::COMMA) {
+                advance();
+                while (ops.back().kind == Frame::BINARY) reduce();
+                if (ops.back().kind != Frame::CALL)
+                    throw std::runtime_error("Unexpected ',' in expression");
+                ops.back().args++;
+                sawOperator = true; // next comes another argument
+            } else if (openGroups > 0 && t == TokenTypes::PAREN_R) {
+                advance();
+                while (ops.back().kind == Frame::BINARY) reduce();
+
+                Frame group = std::move(ops.back());
+                ops.pop_back();
+                openGroups--;
+
+                if (group.kind == Frame::CALL) {
+                    std::vector<std::unique_ptr<Expr>> args(group.args);
+                    size_t height = 0;
+                    for (size_t i = group.args; i > 0; i--) {
+                        args[i - 1] = std::move(operands.back());
+                        operands.pop_back();
+                        height = std::max(height, heights.back());
+                        heights.pop_back();
+                    }
+                    push(makeCall(group.callee, std::move(args)), height + 1);
+                }
+            } else {
+                // end of the expression
+                while (!ops.empty() && ops.back().kind == Frame::BINARY) reduce();
+
+                if (openGroups > 0) {
+                    if (ops.back().kind == Frame::CALL)
+                        throw std::runtime_error("Expected ')' after function argument");
+                    throw std::runtime_error("Expected ')' after expression");
+                }
+                return std::move(operands.back());
+            }
+        }
+    }
+}
+
+// binds a call to its entry in the builtin table. Unknown names and wrong
+// argument counts are caught here, and a pure builtin whose arguments are
+// all constants is replaced by its result.
+std::unique_ptr<Expr> Parser::makeCall(const std::string& name, std::vector<std::unique_ptr<Expr>> args) {
+    int index = findBuiltin(name);
+    if (index < 0) throw std::runtime_error("Unknown function: " + name);
+    const Builtin& fn = builtinAt(index);
+    std::string bad = arityError(fn, args.size());
+    if (!bad.empty()) throw std::runtime_error(bad);
+
+    if (fn.pure) {
+        const Value* values[MAX_BUILTIN_ARGS] = { nullptr, nullptr, nullptr };
+        bool constant = true;
+        for (size_t i = 0; i < args.size() && constant; i++) {
+            if (auto lit = dynamic_cast<const literalExpressions*>(args[i].get())) values[i] = &lit->val;
+            else if (auto str = dynamic_cast<const StringExpr*>(args[i].get())) values[i] = &str->value;
+            else constant = false;
+        }
+
+        Value folded;
+        if (constant && foldBuiltin(fn, values, args.size(), folded)) {
+            if (auto s = std::get_if<std::string>(&folded)) return std::make_unique<StringExpr>(*s);
+            return std::make_unique<literalExpressions>(folded);
+        }
+    }
+
+    auto call = std::make_unique<CallExpr>(name, std::move(args));
+    call->builtin = index;
+    return call;
+}
+
+// a single literal or variable; groups and calls are handled by parseExpression
+std::unique_ptr<Expr> Parser::parsePrimary() {
+
+    if (match(TokenTypes::NUMBER)) {
+        int v = 0;
+        if (!parseIntLiteral(previous().value, v))
+            throw std::runtime_error("Integer literal out of range: " + previous().value);
+        return std::make_unique< literalExpressions>(v);
+    }
+
+    if (match(TokenTypes::FLOAT)) {
+        double v = 0.0;
+        if (!parseDoubleLiteral(previous().value, v))
+            throw std::runtime_error("Invalid number: " + previous().value);
+        return std::make_unique< literalExpressions>(v);
+    }
+
+    if (match(TokenTypes::STRING)) {
+        return std::make_unique<StringExpr>(previous().value);
+    }
+
+    if (match(TokenTypes::IDENTIFIER)) {
+        return std::make_unique<VariableExpr>(previous().value);
+    }
+
+    throw std::runtime_error("Expected expression");
+}
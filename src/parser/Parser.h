@@ -1,38 +1,58 @@
-#pragma once
-#include <vector>
-#include <memory>
-
-#include "../lexer/Token.h"
-#include "AST.h"
-
-class Parser {
-public:
-    Parser(const std::vector<Token>& tokens);
-    std::vector<std::unique_ptr<Stmt>> parse();
-
-private:
-    int loopDepth = 0;
-
-    const std::vector<Token>& tokens;
-    size_t cur;
-
-    // token helpers
-    const Token& peek() const;
-    const Token& previous() const;
-    bool isAtEnd() const;
-    const Token& advance();
-    bool check(TokenTypes type) const;
-    bool match(TokenTypes type);
-    bool checkNext(TokenTypes type) const;
-
-
-    std::unique_ptr<Stmt> parseStatement();
-    std::vector<std::unique_ptr<Stmt>> parseBlock();
-
-
-    std::unique_ptr<Expr> parseExpression();
-    std::unique_ptr<Expr> parseComparison();
-    std::unique_ptr<Expr> parseTerm();
-    std::unique_ptr<Expr> parseFactor();
-    std::unique_ptr<Expr> parsePrimary();
-};
+#pragma once
+#include <vector>
+#include <memory>
+
+#include "../lexer/Token.h"
+#include "AST.h"
+
+class Parser {
+public:
+    // lazy: skip if and while bodies of LAZY_MIN_TOKENS or more, see LazyBlockStmt;
+    // ignored for programs that spawn tasks
+    Parser(const std::vector<Token>& tokens, bool lazy = false);
+    std::vector<std::unique_ptr<Stmt>> parse();
+
+    // the statements of a skipped body; bodies inside it are skipped again
+    std::vector<std::unique_ptr<Stmt>> parseSkipped(const LazyBlockStmt& block);
+
+    // smaller bodies cost less to parse than to skip and keep their
+    // variables open to the type pass
+    static const size_t LAZY_MIN_TOKENS = 64;
+
+    // Parsing itself needs no stack per level, but the passes and the
+    // interpreter walk expression trees recursively; a deeper tree (a chain
+    // of 1 + 1 + ... included) is a syntax error rather than a crash later
+    static const size_t MAX_EXPR_DEPTH = 1 << 15;
+
+    // BEGIN blocks first and END blocks last; with eachLine what is left
+    // becomes an EachLineStmt that runs once per input line
+    void arrangePhases(std::vector<std::unique_ptr<Stmt>>& program, bool eachLine) const;
+
+private:
+    int loopDepth = 0;
+    bool lazy;
+
+    const std::vector<Token>& tokens;
+    size_t cur;
+
+    // token helpers
+    const Token& peek() const;
+    const Token& previous() const;
+    bool isAtEnd() const;
+    const Token& advance();
+    bool check(TokenTypes type) const;
+    bool match(TokenTypes type);
+    bool checkNext(TokenTypes type) const;
+
+
+    std::unique_ptr<Stmt> parseStatement();
+    std::unique_ptr<Stmt> parseStatementKind();
+    std::vector<std::unique_ptr<Stmt>> parseBlock();
+    std::vector<std::unique_ptr<Stmt>> parseBody();
+    std::unique_ptr<Stmt> parseForAssignment(const char* what);
+
+
+    std::unique_ptr<Expr> parseExpression();
+    std::unique_ptr<Expr> parsePrimary();
+    std::unique_ptr<Expr> makeCall(const std::string& name, std::vector<std::unique_ptr<Expr>> args);
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+
+// Every operator new in the program goes through AllocCounter.cpp, which
+// keeps a running count. --alloc-stats reads it before and after the
+// interpreter runs to see how many heap allocations a loop iteration costs.
+unsigned long long allocationCount();
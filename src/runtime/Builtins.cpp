@@ -0,0 +1,239 @@
+#include "Builtins.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "NumberFormat.h"
+#include "StringOps.h"
+
+// ===== argument checks =====
+
+const std::string& stringArg(const std::string& fn, const Value& v) {
+    if (!std::holds_alternative<std::string>(v)) throw std::runtime_error(fn + ": expected a string");
+    return std::get<std::string>(v);
+}
+
+int indexArg(const std::string& fn, const Value& v) {
+    if (!std::holds_alternative<int>(v)) throw std::runtime_error(fn + ": expected an int");
+    int i = std::get<int>(v);
+    if (i < 0) throw std::runtime_error(fn + ": negative position " + std::to_string(i));
+    return i;
+}
+
+int indexValue(size_t n) {
+    if (n > static_cast<size_t>(INT_MAX)) throw std::runtime_error("string too long for an int position");
+    return static_cast<int>(n);
+}
+
+Value parseNumber(const std::string& s) {
+    double dv = 0.0;
+    if (!parseNumberPrefix(s, dv)) {
+        throw std::runtime_error("toNum: cannot convert \"" + s + "\" to number");
+    }
+    if (dv == std::floor(dv) && dv >= INT_MIN && dv <= INT_MAX) {
+        return static_cast<int>(dv);
+    }
+    return dv;
+}
+
+void seekPiece(const std::string& s, const std::string& sep, int piece, int& at, size_t& offset) {
+    while (at < piece) {
+        size_t end = findBytes(s, sep, offset);
+        if (end == NOT_FOUND) {
+            throw std::runtime_error("split: no piece " + std::to_string(piece) +
+                                     ", the string has only " + std::to_string(at + 1) + " pieces");
+        }
+        offset = end + sep.size();
+        at++;
+    }
+}
+
+void substrBounds(const std::string& s, const Value* const* args, size_t count,
+                  size_t& start, size_t& length) {
+    start = static_cast<size_t>(indexArg("substr", *args[1]));
+    if (start > s.size()) {
+        throw std::runtime_error("substr: start " + std::to_string(start) +
+                                 " is past the end of a string of length " + std::to_string(s.size()));
+    }
+    length = s.size() - start;
+    if (count == 3) length = std::min(length, static_cast<size_t>(indexArg("substr", *args[2])));
+}
+
+// ===== pure builtins =====
+// The interpreter calls these for the ones where it has nothing to save
+// (int results) and runs its own copy-free versions of the rest; the
+// parser calls all of them to fold constant calls.
+
+static Value toStringFn(const Value* const* args, size_t) {
+    const Value& v = *args[0];
+    if (auto i = std::get_if<int>(&v)) return formatInt(*i);
+    if (auto d = std::get_if<double>(&v)) return formatDouble(*d);
+    return v;
+}
+
+static Value toNumFn(const Value* const* args, size_t) {
+    const Value& v = *args[0];
+    if (auto s = std::get_if<std::string>(&v)) return parseNumber(*s);
+    return v;
+}
+
+static Value lenFn(const Value* const* args, size_t) {
+    return indexValue(stringArg("len", *args[0]).size());
+}
+
+static Value findFn(const Value* const* args, size_t count) {
+    const std::string& s = stringArg("find", *args[0]);
+    const std::string& sub = stringArg("find", *args[1]);
+    size_t from = count == 3 ? static_cast<size_t>(indexArg("find", *args[2])) : 0;
+    size_t at = findBytes(s, sub, from);
+    return at == NOT_FOUND ? -1 : indexValue(at);
+}
+
+static Value containsFn(const Value* const* args, size_t) {
+    const std::string& s = stringArg("contains", *args[0]);
+    const std::string& sub = stringArg("contains", *args[1]);
+    return findBytes(s, sub, 0) == NOT_FOUND ? 0 : 1;
+}
+
+static Value countFn(const Value* const* args, size_t) {
+    const std::string& s = stringArg("count", *args[0]);
+    const std::string& sub = stringArg("count", *args[1]);
+    if (sub.empty()) throw std::runtime_error("count: empty search string");
+    return indexValue(countBytes(s, sub));
+}
+
+static Value splitFn(const Value* const* args, size_t) {
+    const std::string& s = stringArg("split", *args[0]);
+    const std::string& sep = stringArg("split", *args[1]);
+    if (sep.empty()) throw std::runtime_error("split: empty separator");
+    int piece = indexArg("split", *args[2]);
+
+    int at = 0;
+    size_t offset = 0;
+    seekPiece(s, sep, piece, at, offset);
+    size_t end = findBytes(s, sep, offset);
+    return std::string(s, offset, (end == NOT_FOUND ? s.size() : end) - offset);
+}
+
+static Value replaceFn(const Value* const* args, size_t) {
+    const std::string& s = stringArg("replace", *args[0]);
+    const std::string& from = stringArg("replace", *args[1]);
+    const std::string& to = stringArg("replace", *args[2]);
+    if (from.empty()) throw std::runtime_error("replace: empty search string");
+    return replaceBytes(s, from, to);
+}
+
+static Value substrFn(const Value* const* args, size_t count) {
+    const std::string& s = stringArg("substr", *args[0]);
+    size_t start = 0, length = 0;
+    substrBounds(s, args, count, start, length);
+    return std::string(s, start, length);
+}
+
+static Value trimFn(const Value* const* args, size_t) {
+    const std::string& s = stringArg("trim", *args[0]);
+    size_t start = 0, length = 0;
+    trimBounds(s, start, length);
+    return std::string(s, start, length);
+}
+
+// ===== the table =====
+
+static std::vector<Builtin>& table() {
+    using R = BuiltinResult;
+    // same order as BuiltinId
+    static std::vector<Builtin> builtins = {
+        { "toString",   1, 1, true,  R::STRING, toStringFn },
+        { "toNum",      1, 1, true,  R::ANY,    toNumFn },
+        { "input",      0, 1, false, R::STRING, nullptr }, // input(x) ignores x, as it always did
+        { "readFile",   1, 1, false, R::STRING, nullptr },
+        { "openFile",   1, 1, false, R::INT,    nullptr },
+        { "hasLine",    1, 1, false, R::INT,    nullptr },
+        { "readLine",   1, 1, false, R::STRING, nullptr },
+        { "closeFile",  1, 1, false, R::INT,    nullptr },
+        { "writeFile",  2, 2, false, R::INT,    nullptr },
+        { "appendFile", 2, 2, false, R::INT,    nullptr },
+        { "len",        1, 1, true,  R::INT,    lenFn },
+        { "find",       2, 3, true,  R::INT,    findFn },
+        { "contains",   2, 2, true,  R::INT,    containsFn },
+        { "count",      2, 2, true,  R::INT,    countFn },
+        { "split",      3, 3, true,  R::STRING, splitFn },
+        { "replace",    3, 3, true,  R::STRING, replaceFn },
+        { "substr",     2, 3, true,  R::STRING, substrFn },
+        { "trim",       1, 1, true,  R::STRING, trimFn },
+        { "snapshot",   1, 1, false, R::INT,    nullptr }, // see Snapshot.h
+        { "chan",       1, 1, false, R::INT,    nullptr }, // see Tasks.h
+        { "send",       2, 2, false, R::INT,    nullptr },
+        { "receive",    1, 1, false, R::ANY,    nullptr },
+        { "hasValue",   1, 1, false, R::INT,    nullptr },
+        { "closeChan",  1, 1, false, R::INT,    nullptr },
+    };
+    return builtins;
+}
+
+static std::unordered_map<std::string, int>& names() {
+    static std::unordered_map<std::string, int> byName = []() {
+        std::unordered_map<std::string, int> m;
+        const std::vector<Builtin>& t = table();
+        for (size_t i = 0; i < t.size(); i++) m[t[i].name] = static_cast<int>(i);
+        return m;
+    }();
+    return byName;
+}
+
+int registerBuiltin(const Builtin& fn) {
+    if (findBuiltin(fn.name) >= 0) throw std::runtime_error("builtin already defined: " + fn.name);
+    if (fn.least > fn.most || fn.most > MAX_BUILTIN_ARGS) {
+        throw std::runtime_error("builtin " + fn.name + ": at most " +
+                                 std::to_string(MAX_BUILTIN_ARGS) + " arguments are supported");
+    }
+    if (!fn.native) throw std::runtime_error("builtin " + fn.name + ": no function given");
+
+    std::vector<Builtin>& t = table();
+    t.push_back(fn);
+    int index = static_cast<int>(t.size() - 1);
+    names()[fn.name] = index;
+    return index;
+}
+
+int findBuiltin(const std::string& name) {
+    auto it = names().find(name);
+    return it == names().end() ? -1 : it->second;
+}
+
+const Builtin& builtinAt(int index) {
+    return table()[static_cast<size_t>(index)];
+}
+
+std::string arityError(const Builtin& fn, size_t count) {
+    if (count >= fn.least && count <= fn.most) return "";
+    std::string want = std::to_string(fn.least);
+    if (fn.most != fn.least) want += " or " + std::to_string(fn.most);
+    return fn.name + ": expected " + want + " argument" + (fn.most == 1 ? "" : "s") +
+           ", got " + std::to_string(count);
+}
+
+// folded strings are stored in the program; a result that grows past its
+// inputs (replace with a longer string) is cheaper to build when reached
+static const size_t FOLD_MIN_BYTES = 256;
+
+bool foldBuiltin(const Builtin& fn, const Value* const* args, size_t count, Value& out) {
+    if (!fn.pure || !fn.native) return false;
+
+    size_t inputBytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (auto s = std::get_if<std::string>(args[i])) inputBytes += s->size();
+    }
+
+    try {
+        out = fn.native(args, count);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    auto s = std::get_if<std::string>(&out);
+    return !s || s->size() <= std::max(inputBytes, FOLD_MIN_BYTES);
+}
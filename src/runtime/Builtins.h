@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#include "../parser/AST.h"
+
+// Every function a script can call. The parser looks each call up here
+// once, checks the argument count and stores the table index in the
+// CallExpr, so running a call switches on a number instead of comparing
+// names, and a misspelled function is an error before anything runs.
+// A program embedding kash can add its own functions with registerBuiltin
+// before parsing.
+
+// the built-in functions, in table order
+enum class BuiltinId {
+    TO_STRING, TO_NUM, INPUT,
+    READ_FILE, OPEN_FILE, HAS_LINE, READ_LINE, CLOSE_FILE, WRITE_FILE, APPEND_FILE,
+    LEN, FIND, CONTAINS, COUNT, SPLIT, REPLACE, SUBSTR, TRIM,
+    SNAPSHOT,
+    CHAN, SEND, RECEIVE, HAS_VALUE, CLOSE_CHAN,
+    HOST // registered functions start here
+};
+
+// what a call gives back, for the type pass
+enum class BuiltinResult { ANY, INT, STRING };
+
+// gets the evaluated arguments, `count` of them
+using NativeFn = Value (*)(const Value* const* args, size_t count);
+
+struct Builtin {
+    std::string name;
+    size_t least; // arguments it takes
+    size_t most;
+    // result depends on the arguments alone and nothing else happens,
+    // so a call with constant arguments is worked out by the parser
+    bool pure;
+    BuiltinResult result;
+    NativeFn native; // null for the ones the interpreter runs itself (input, files, channels)
+};
+
+static const size_t MAX_BUILTIN_ARGS = 3;
+
+// returns the new function's index; throws when the name is taken, it
+// takes more than MAX_BUILTIN_ARGS or has no native
+int registerBuiltin(const Builtin& fn);
+
+// -1 when nothing has that name
+int findBuiltin(const std::string& name);
+const Builtin& builtinAt(int index);
+
+// "fn: expected N argument(s), got K", or empty when count is fine
+std::string arityError(const Builtin& fn, size_t count);
+
+// the result of a pure call on constants; false when the call throws
+// (it is left to fail when reached) or gives a string too big to keep
+bool foldBuiltin(const Builtin& fn, const Value* const* args, size_t count, Value& out);
+
+// ===== argument checks, shared with the interpreter =====
+
+const std::string& stringArg(const std::string& fn, const Value& v);
+// positions and counts; strings are limited by memory, ints are not
+int indexArg(const std::string& fn, const Value& v);
+int indexValue(size_t n);
+
+// toNum of a string: whole numbers that fit come back as ints
+Value parseNumber(const std::string& s);
+
+// offset of piece `piece` of s cut at sep, scanning on from piece `at`
+// which starts at `offset`; both are left at the piece found
+void seekPiece(const std::string& s, const std::string& sep, int piece, int& at, size_t& offset);
+
+// start and length of substr(s, args[1] [, args[2]])
+void substrBounds(const std::string& s, const Value* const* args, size_t count,
+                  size_t& start, size_t& length);
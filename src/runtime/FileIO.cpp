@@ -0,0 +1,237 @@
+#include "FileIO.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ===== MappedFile =====
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open file: " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        known = true;
+        device = st.st_dev;
+        inode = st.st_ino;
+    }
+    if (known && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* m = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            map = m;
+            bytes = static_cast<const char*>(m);
+            length = static_cast<size_t>(st.st_size);
+            ::close(fd); // the mapping stays valid without the fd
+            return;
+        }
+    }
+
+    // not mappable, read it the slow way
+    char chunk[64 * 1024];
+    while (true) {
+        ssize_t n = ::read(fd, chunk, sizeof chunk);
+        if (n == 0) break;
+        if (n < 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot read file: " + path);
+        }
+        fallback.append(chunk, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    bytes = fallback.data();
+    length = fallback.size();
+}
+
+MappedFile::~MappedFile() {
+    if (map) munmap(map, length);
+}
+
+void MappedFile::detach() {
+    if (!map) return;
+    fallback.assign(bytes, length);
+    munmap(map, length);
+    map = nullptr;
+    bytes = fallback.data();
+}
+
+// ===== LineReader =====
+
+size_t LineReader::nextLength() const {
+    const char* start = file.data() + pos;
+    size_t left = file.size() - pos;
+    const void* nl = std::memchr(start, '\n', left);
+    return nl ? static_cast<size_t>(static_cast<const char*>(nl) - start) : left;
+}
+
+const Value& LineReader::next() {
+    if (!hasLine()) throw std::runtime_error("readLine: no more lines");
+
+    size_t n = nextLength();
+    std::get<std::string>(line).assign(file.data() + pos, n);
+    pos += n;
+    if (pos < file.size()) pos++; // the '\n'
+    return line;
+}
+
+// ===== RecordReader =====
+
+bool RecordReader::next(const char*& line, size_t& length) {
+    while (true) {
+        const char* start = buffer.data() + pos;
+        const void* nl = std::memchr(start, '\n', filled - pos);
+        if (nl) {
+            line = start;
+            length = static_cast<size_t>(static_cast<const char*>(nl) - start);
+            pos += length + 1;
+            return true;
+        }
+        if (atEnd) {
+            if (pos == filled) return false;
+            line = start;
+            length = filled - pos;
+            pos = filled;
+            return true;
+        }
+
+        // keep the unfinished line and read behind it; grow for lines
+        // longer than a block
+        std::memmove(&buffer[0], start, filled - pos);
+        filled -= pos;
+        pos = 0;
+        if (buffer.size() < filled + BLOCK) buffer.resize(filled + BLOCK);
+
+        ssize_t n = ::read(fd, &buffer[filled], buffer.size() - filled);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("cannot read input");
+        }
+        if (n == 0) atEnd = true;
+        filled += static_cast<size_t>(n);
+    }
+}
+
+// ===== FileTable =====
+
+FileTable::~FileTable() {
+    try {
+        flushAll();
+    } catch (...) {
+        // already unwinding from a script error, nothing to report to
+    }
+}
+
+int FileTable::open(const std::string& path) {
+    flushPath(path);
+    auto r = std::make_unique<LineReader>(path);
+
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (!readers[i]) {
+            readers[i] = std::move(r);
+            return static_cast<int>(i + 1);
+        }
+    }
+    readers.push_back(std::move(r));
+    return static_cast<int>(readers.size());
+}
+
+LineReader& FileTable::reader(int handle) {
+    if (handle < 1 || static_cast<size_t>(handle) > readers.size() || !readers[handle - 1]) {
+        throw std::runtime_error("not an open file handle: " + std::to_string(handle));
+    }
+    return *readers[handle - 1];
+}
+
+void FileTable::close(int handle) {
+    reader(handle); // same check
+    readers[handle - 1].reset();
+}
+
+size_t FileTable::openCount() const {
+    size_t n = 0;
+    for (const auto& r : readers) {
+        if (r) n++;
+    }
+    return n;
+}
+
+std::unique_ptr<MappedFile> FileTable::map(const std::string& path) {
+    flushPath(path);
+    return std::make_unique<MappedFile>(path);
+}
+
+void FileTable::write(const std::string& path, const std::string& text, bool append) {
+    PendingWrite& w = pending[path];
+    if (!append) {
+        // whatever was waiting would be overwritten anyway
+        w.data.clear();
+        w.truncate = true;
+    }
+    w.data += text;
+    if (w.data.size() >= FLUSH_BYTES) flush(path, w);
+}
+
+void FileTable::flush(const std::string& path, PendingWrite& w) {
+    if (w.data.empty() && !w.truncate) return;
+
+    // truncating a file we still read from, maybe under another name;
+    // when we cannot tell which file it is, every reader lets go
+    if (w.truncate) {
+        struct stat st;
+        bool found = ::stat(path.c_str(), &st) == 0;
+        for (auto& r : readers) {
+            if (r && (!found || r->isFile(st.st_dev, st.st_ino))) r->detach();
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary | (w.truncate ? std::ios::trunc : std::ios::app));
+    if (!out) throw std::runtime_error("cannot write file: " + path);
+    out.write(w.data.data(), static_cast<std::streamsize>(w.data.size()));
+    out.close();
+    if (!out) throw std::runtime_error("cannot write file: " + path);
+
+    w.data.clear();
+    w.truncate = false;
+}
+
+void FileTable::flushPath(const std::string& path) {
+    auto it = pending.find(path);
+    if (it != pending.end()) flush(path, it->second);
+
+    // writes waiting under another name for the same file; stat only
+    // when there are some. A file that is not there yet may be one of
+    // them, so then they all go out.
+    struct stat target;
+    bool looked = false, found = false;
+    for (auto& p : pending) {
+        if (p.first == path || (p.second.data.empty() && !p.second.truncate)) continue;
+        if (!looked) {
+            looked = true;
+            found = ::stat(path.c_str(), &target) == 0;
+        }
+        struct stat st;
+        if (!found || (::stat(p.first.c_str(), &st) == 0 && st.st_dev == target.st_dev && st.st_ino == target.st_ino)) {
+            flush(p.first, p.second);
+        }
+    }
+}
+
+void FileTable::flushAll() {
+    for (auto& p : pending) flush(p.first, p.second);
+}
+
+void FileTable::reset() {
+    try {
+        flushAll();
+    } catch (...) {
+        // the run already ended, successful or not
+    }
+    readers.clear();
+    pending.clear();
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "../parser/AST.h"
+
+// File builtins for scripts: readFile, openFile / hasLine / readLine /
+// closeFile, writeFile and appendFile. Input files are mapped read-only
+// and scanned in place; nothing is copied until a script keeps the text.
+
+// A whole file as one read-only block. Regular files are mmap'd; pipes,
+// /proc files and other things mmap refuses are read into a string.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // device and inode from when it was opened; the same file can be
+    // named many ways ("x", "./x", a link)
+    bool isFile(dev_t dev, ino_t ino) const { return known && device == dev && inode == ino; }
+
+    // copy into memory and drop the mapping; a mapped file that shrinks
+    // under us raises SIGBUS on the next read
+    void detach();
+
+private:
+    void* map = nullptr;
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::string fallback;
+    bool known = false;
+    dev_t device = 0;
+    ino_t inode = 0;
+};
+
+// Hands out one line at a time from a MappedFile. The line lives in a
+// buffer owned by the reader and is only good until the next readLine;
+// the interpreter passes it around borrowed and copies it when a script
+// stores it. The buffer keeps its capacity, so a loop over the lines
+// does not allocate per line.
+class LineReader {
+public:
+    explicit LineReader(const std::string& path) : path(path), file(path) {}
+
+    const std::string path;
+
+    bool hasLine() const { return pos < file.size(); }
+    // length of the line next() would return, so callers can check budgets first
+    size_t nextLength() const;
+    const Value& next(); // without the '\n'
+
+    bool isFile(dev_t dev, ino_t ino) const { return file.isFile(dev, ino); }
+    void detach() { file.detach(); }
+
+private:
+    MappedFile file;
+    size_t pos = 0;
+    Value line = std::string();
+};
+
+// --each-line input: a file descriptor read a megabyte at a time and cut
+// at '\n'. next() points into the block it read, so nothing is copied
+// until the interpreter binds the line.
+class RecordReader {
+public:
+    explicit RecordReader(int fd) : fd(fd) {}
+
+    // false at the end of input; a last line without '\n' still counts
+    bool next(const char*& line, size_t& length);
+
+    static const size_t BLOCK = 1024 * 1024;
+
+private:
+    int fd;
+    std::string buffer;
+    size_t pos = 0;    // start of the next line
+    size_t filled = 0; // bytes of buffer holding input
+    bool atEnd = false;
+};
+
+// Open readers and pending writes of one interpreter run.
+// Handles are small positive ints so they fit in a script variable.
+class FileTable {
+public:
+    FileTable() = default;
+    ~FileTable(); // flushes, ignoring errors
+
+    FileTable(const FileTable&) = delete;
+    FileTable& operator=(const FileTable&) = delete;
+
+    int open(const std::string& path);
+    LineReader& reader(int handle);
+    void close(int handle);
+    size_t openCount() const;
+
+    // the whole file, for readFile
+    std::unique_ptr<MappedFile> map(const std::string& path);
+
+    // writes are collected per path and hit the disk at FLUSH_BYTES,
+    // before the same file is read (under any name), and from flushAll()
+    void write(const std::string& path, const std::string& text, bool append);
+    void flushAll();
+
+    // flushes like the destructor, then forgets every handle
+    void reset();
+
+    static const size_t FLUSH_BYTES = 64 * 1024;
+
+private:
+    std::vector<std::unique_ptr<LineReader>> readers; // handle - 1, null once closed
+
+    struct PendingWrite {
+        std::string data;
+        bool truncate = false; // writeFile since the last flush
+    };
+    std::unordered_map<std::string, PendingWrite> pending;
+
+    void flush(const std::string& path, PendingWrite& w);
+    void flushPath(const std::string& path);
+};
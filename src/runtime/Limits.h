@@ -0,0 +1,31 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+// execution budgets for scripts we do not trust {0 means no limit}
+struct Limits {
+    unsigned long long maxSteps = 0; // executed statements, charged on loop back-edges
+    long long timeoutMs = 0;         // wall-clock deadline from the start of interpret()
+    size_t maxHeapBytes = 0;         // bytes held by string values
+};
+
+// the longest timeout: half of what steady_clock counts, so now() plus
+// the timeout cannot wrap into the past (still about 146 years)
+static const long long MAX_TIMEOUT_MS =
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::duration::max()).count() / 2;
+
+enum class LimitKind {
+    STEPS,
+    TIME,
+    MEMORY
+};
+
+// thrown when a budget runs out, so callers can tell it apart from a script error
+struct LimitExceeded : std::runtime_error {
+    LimitKind kind;
+
+    LimitExceeded(LimitKind k, const std::string &msg)
+        : std::runtime_error(msg), kind(k) {}
+};
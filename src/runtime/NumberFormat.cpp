@@ -0,0 +1,116 @@
+#include "NumberFormat.h"
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void appendInt(std::string &out, int v) {
+    char buf[12];
+    char* end = buf + sizeof buf;
+    char* p = end;
+    unsigned u = v < 0 ? 0u - static_cast<unsigned>(v) : static_cast<unsigned>(v);
+
+    while (u >= 100) {
+        unsigned q = u / 100;
+        p -= 2;
+        std::memcpy(p, DIGIT_PAIRS + 2 * (u - q * 100), 2);
+        u = q;
+    }
+    if (u >= 10) {
+        p -= 2;
+        std::memcpy(p, DIGIT_PAIRS + 2 * u, 2);
+    } else {
+        *--p = static_cast<char>('0' + u);
+    }
+    if (v < 0) *--p = '-';
+
+    out.append(p, end);
+}
+
+std::string formatInt(int v) {
+    std::string out;
+    appendInt(out, v);
+    return out;
+}
+
+std::string formatDouble(double v) {
+    // shortest round-trip digits come from to_chars, we only lay them out
+    char buf[64];
+    auto res = std::to_chars(buf, buf + sizeof buf, v, std::chars_format::scientific);
+    if (!std::isfinite(v)) return std::string(buf, res.ptr); // inf, -inf, nan, -nan
+
+    const char* p = buf;
+    bool negative = *p == '-';
+    if (negative) p++;
+
+    const char* e = static_cast<const char*>(std::memchr(p, 'e', res.ptr - p));
+    std::string digits;
+    for (const char* c = p; c < e; c++) {
+        if (*c != '.') digits += *c;
+    }
+    int exp = 0;
+    const char* expStart = e[1] == '+' ? e + 2 : e + 1; // from_chars takes '-' but not '+'
+    std::from_chars(expStart, res.ptr, exp);
+
+    int k = static_cast<int>(digits.size()); // significant digits
+    int n = exp + 1;                         // position of the decimal point
+
+    std::string out = negative ? "-" : "";
+    if (k <= n && n <= 21) {
+        out += digits;
+        out.append(n - k, '0');
+        out += ".0";
+    } else if (0 < n && n <= 21) {
+        out.append(digits, 0, n);
+        out += '.';
+        out.append(digits, n, std::string::npos);
+    } else if (-6 < n && n <= 0) {
+        out += "0.";
+        out.append(-n, '0');
+        out += digits;
+    } else {
+        out += digits[0];
+        if (k > 1) {
+            out += '.';
+            out.append(digits, 1, std::string::npos);
+        }
+        out += exp < 0 ? "e-" : "e+";
+        appendInt(out, std::abs(exp));
+    }
+    return out;
+}
+
+bool parseIntLiteral(const std::string &s, int &out) {
+    const char* end = s.data() + s.size();
+    auto res = std::from_chars(s.data(), end, out);
+    return res.ec == std::errc() && res.ptr == end;
+}
+
+bool parseDoubleLiteral(const std::string &s, double &out) {
+    const char* end = s.data() + s.size();
+    auto res = std::from_chars(s.data(), end, out);
+    return res.ec == std::errc() && res.ptr == end;
+}
+
+bool parseNumberPrefix(const std::string &s, double &out) {
+    const char* p = s.data();
+    const char* end = p + s.size();
+
+    while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) p++;
+    if (p < end && *p == '+' && !(p + 1 < end && p[1] == '-')) p++;
+
+    auto res = std::from_chars(p, end, out);
+    return res.ec == std::errc() && res.ptr != p;
+}
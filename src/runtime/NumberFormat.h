@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+
+// One place for every number <-> text conversion, so out(), toString(),
+// toNum() and number literals all agree.
+
+// Shortest text that parses back to exactly v. Plain notation for
+// 1e-6 <= |v| < 1e21 and scientific outside that; whole numbers keep a
+// trailing ".0" so they still read as floats (5.0, 1e+21, 0.1, -0.0).
+std::string formatDouble(double v);
+
+// decimal digits of v, written two at a time from a lookup table
+std::string formatInt(int v);
+void appendInt(std::string &out, int v);
+
+// Whole-string parse of a NUMBER token; false if it does not fit in an int.
+bool parseIntLiteral(const std::string &s, int &out);
+
+// Whole-string parse of a FLOAT token.
+bool parseDoubleLiteral(const std::string &s, double &out);
+
+// toNum(): leading whitespace and a '+' are allowed and parsing stops at the
+// first character that cannot continue the number, like std::stod did.
+// false if no number could be read or it is out of range.
+bool parseNumberPrefix(const std::string &s, double &out);
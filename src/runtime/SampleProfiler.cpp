@@ -0,0 +1,138 @@
+#include "SampleProfiler.h"
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <signal.h>
+#include <time.h>
+
+// room for about 250k samples at a typical nesting depth
+static const size_t BUFFER_ENTRIES = 1 << 20;
+
+// the handler has no arguments to find its profiler with
+static SampleProfiler* active = nullptr;
+static struct sigaction previousAction;
+static timer_t timer;
+
+SampleProfiler::SampleProfiler(ExecPosition& position, unsigned hz)
+    : position(position), hz(hz), buffer(BUFFER_ENTRIES) {
+    if (hz == 0) throw std::runtime_error("sample rate must be at least 1 Hz");
+}
+
+SampleProfiler::~SampleProfiler() {
+    stop();
+}
+
+void SampleProfiler::start() {
+    if (running) return;
+    if (active) throw std::runtime_error("another sampling profiler is already running");
+    active = this;
+
+    struct sigaction action = {};
+    action.sa_handler = &SampleProfiler::onSignal;
+    action.sa_flags = SA_RESTART; // in() keeps reading through a sample
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previousAction);
+
+    // CPU-time timers (setitimer, CLOCK_PROCESS_CPUTIME_ID) only fire on
+    // scheduler ticks, often 250 Hz; a monotonic timer keeps the asked rate
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_MONOTONIC, &event, &timer) != 0) {
+        sigaction(SIGPROF, &previousAction, nullptr);
+        active = nullptr;
+        throw std::runtime_error("could not create the sampling timer");
+    }
+
+    long nsec = 1000000000L / static_cast<long>(hz);
+    if (nsec < 1000) nsec = 1000;
+    struct itimerspec every = {};
+    every.it_interval.tv_sec = nsec / 1000000000L;
+    every.it_interval.tv_nsec = nsec % 1000000000L;
+    every.it_value = every.it_interval;
+    timer_settime(timer, 0, &every, nullptr);
+    running = true;
+}
+
+void SampleProfiler::stop() {
+    if (!running) return;
+    timer_delete(timer);
+    sigaction(SIGPROF, &previousAction, nullptr);
+    active = nullptr;
+    running = false;
+}
+
+void SampleProfiler::onSignal(int) {
+    if (active) active->record();
+}
+
+// runs inside the signal handler: copy a few words, nothing else
+void SampleProfiler::record() {
+    size_t depth = position.depth.load(std::memory_order_acquire);
+    if (depth > ExecPosition::MAX_DEPTH) depth = ExecPosition::MAX_DEPTH;
+
+    if (used + depth + 2 > buffer.size()) {
+        lost++;
+        return;
+    }
+    buffer[used++] = depth;
+    for (size_t i = 0; i < depth; i++) {
+        buffer[used++] = reinterpret_cast<uintptr_t>(position.frames[i]);
+    }
+    buffer[used++] = reinterpret_cast<uintptr_t>(position.current.load(std::memory_order_relaxed));
+    taken++;
+}
+
+// ===== collapsed stacks =====
+
+// frame name; no ';' allowed, the last space separates the count
+static std::string stmtLabel(const Stmt* stmt) {
+    std::string at = " L" + std::to_string(stmt->line);
+
+    if (dynamic_cast<const WhileStmt*>(stmt)) return "while" + at;
+    if (dynamic_cast<const ForStmt*>(stmt) || dynamic_cast<const CountedForStmt*>(stmt)) return "for" + at;
+    if (dynamic_cast<const IfStmt*>(stmt)) return "if" + at;
+    if (dynamic_cast<const EachLineStmt*>(stmt)) return "each line" + at;
+    if (dynamic_cast<const SpawnStmt*>(stmt)) return "spawn" + at;
+    if (auto assign = dynamic_cast<const AssignStmt*>(stmt)) return assign->name + " =" + at;
+    if (auto slot = dynamic_cast<const SlotAssignStmt*>(stmt)) return slot->name + " =" + at;
+    if (auto inc = dynamic_cast<const IncrementStmt*>(stmt)) return inc->name + " =" + at;
+    if (auto copy = dynamic_cast<const CopyStmt*>(stmt)) return copy->dst + " =" + at;
+    if (dynamic_cast<const PrintStmt*>(stmt)) return "out" + at;
+    if (auto input = dynamic_cast<const InputStmt*>(stmt)) return "in " + input->name + at;
+    if (dynamic_cast<const BreakStmt*>(stmt)) return "break" + at;
+    if (dynamic_cast<const BlockStmt*>(stmt)) return "block" + at;
+    return "statement" + at;
+}
+
+void SampleProfiler::writeCollapsed(std::ostream& os, const std::string& root) const {
+    std::unordered_map<const Stmt*, std::string> labels;
+    auto label = [&](const Stmt* stmt) -> const std::string& {
+        auto it = labels.find(stmt);
+        if (it == labels.end()) it = labels.emplace(stmt, stmtLabel(stmt)).first;
+        return it->second;
+    };
+
+    std::map<std::string, size_t> stacks;
+    size_t i = 0;
+    while (i < used) {
+        size_t depth = buffer[i++];
+        const Stmt* last = nullptr;
+        std::string stack = root;
+
+        for (size_t f = 0; f < depth; f++) {
+            last = reinterpret_cast<const Stmt*>(buffer[i++]);
+            stack += ";" + label(last);
+        }
+        // the loop or if itself is the leaf while its condition runs
+        const Stmt* current = reinterpret_cast<const Stmt*>(buffer[i++]);
+        if (current && current != last) stack += ";" + label(current);
+
+        stacks[stack]++;
+    }
+
+    for (const auto& s : stacks) {
+        os << s.first << " " << s.second << "\n";
+    }
+}
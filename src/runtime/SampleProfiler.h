@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../parser/AST.h"
+
+// Where the interpreter is right now: the statement being executed and the
+// while/if statements around it. The interpreter writes it, the SIGPROF
+// handler reads it, both on the same thread.
+struct ExecPosition {
+    static const size_t MAX_DEPTH = 64; // deeper frames are counted, not kept
+
+    std::atomic<const Stmt*> current{nullptr};
+    std::atomic<size_t> depth{0};
+    const Stmt* frames[MAX_DEPTH] = {};
+
+    void enter(const Stmt* stmt) {
+        size_t d = depth.load(std::memory_order_relaxed);
+        if (d < MAX_DEPTH) frames[d] = stmt;
+        // release: the frame is in place before the handler can count it
+        depth.store(d + 1, std::memory_order_release);
+    }
+
+    void leave() {
+        depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    // after a break unwound through nested ifs
+    void unwindTo(size_t d) {
+        depth.store(d, std::memory_order_release);
+    }
+};
+
+// --sample-profile=HZ: a timer_create() timer raises SIGPROF HZ times per
+// second of wall-clock time and the handler copies the current
+// ExecPosition into a preallocated buffer. Time spent waiting in in()
+// is sampled too.
+// Nothing is allocated or formatted inside the handler; samples are
+// grouped into collapsed stacks ("a;b;c count") once the run is over, the
+// input format of flamegraph.pl and speedscope.
+class SampleProfiler {
+public:
+    SampleProfiler(ExecPosition& position, unsigned hz);
+    ~SampleProfiler();
+
+    void start();
+    void stop();
+
+    size_t samples() const { return taken; }
+    size_t dropped() const { return lost; }
+
+    void writeCollapsed(std::ostream& os, const std::string& root) const;
+
+private:
+    ExecPosition& position;
+    unsigned hz;
+    bool running = false;
+
+    // records of [frame count, frames..., current statement]
+    std::vector<uintptr_t> buffer;
+    size_t used = 0;
+    size_t taken = 0;
+    size_t lost = 0;
+
+    static void onSignal(int);
+    void record();
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Thin wrapper over the widest byte vector the build targets, so scanning
+// loops are written once. AVX2 gives 32 lanes, SSE2 (always there on
+// x86-64) gives 16; anything else uses the scalar loops that follow every
+// vector loop. KASH_SIMD tells callers whether Vec exists.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KASH_SIMD 1
+
+struct Vec {
+    static const size_t width = 32;
+    __m256i v;
+
+    static Vec load(const char* p) { return { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) }; }
+    static Vec splat(char c) { return { _mm256_set1_epi8(c) }; }
+
+    Vec operator==(Vec o) const { return { _mm256_cmpeq_epi8(v, o.v) }; }
+    Vec operator|(Vec o) const { return { _mm256_or_si256(v, o.v) }; }
+    Vec operator&(Vec o) const { return { _mm256_and_si256(v, o.v) }; }
+
+    // lanes with lo <= byte <= hi, compared unsigned
+    Vec inRange(unsigned char lo, unsigned char hi) const {
+        __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(static_cast<char>(lo)));
+        __m256i over = _mm256_subs_epu8(shifted, _mm256_set1_epi8(static_cast<char>(hi - lo)));
+        return { _mm256_cmpeq_epi8(over, _mm256_setzero_si256()) };
+    }
+
+    // one bit per lane that is all ones
+    uint32_t mask() const { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+};
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KASH_SIMD 1
+
+struct Vec {
+    static const size_t width = 16;
+    __m128i v;
+
+    static Vec load(const char* p) { return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) }; }
+    static Vec splat(char c) { return { _mm_set1_epi8(c) }; }
+
+    Vec operator==(Vec o) const { return { _mm_cmpeq_epi8(v, o.v) }; }
+    Vec operator|(Vec o) const { return { _mm_or_si128(v, o.v) }; }
+    Vec operator&(Vec o) const { return { _mm_and_si128(v, o.v) }; }
+
+    Vec inRange(unsigned char lo, unsigned char hi) const {
+        __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(static_cast<char>(lo)));
+        __m128i over = _mm_subs_epu8(shifted, _mm_set1_epi8(static_cast<char>(hi - lo)));
+        return { _mm_cmpeq_epi8(over, _mm_setzero_si128()) };
+    }
+
+    uint32_t mask() const { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+};
+
+#else
+#define KASH_SIMD 0
+#endif
+
+#if KASH_SIMD
+// bits set for every lane of a full vector
+static const uint32_t VEC_ALL = Vec::width == 32 ? 0xffffffffu : 0xffffu;
+
+inline unsigned lowestBit(uint32_t mask) {
+    return static_cast<unsigned>(__builtin_ctz(mask));
+}
+#endif
@@ -0,0 +1,144 @@
+#include "Snapshot.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "FileIO.h"
+
+static const char MAGIC[8] = { 'K', 'A', 'S', 'H', 'S', 'N', 'P', '1' };
+
+enum : uint8_t { TAG_INT = 1, TAG_DOUBLE = 2, TAG_STRING = 3 };
+
+// ===== writing =====
+
+static void putSize(std::string& out, uint64_t n) {
+    out.append(reinterpret_cast<const char*>(&n), sizeof n);
+}
+
+static void putBytes(std::string& out, const std::string& s) {
+    putSize(out, s.size());
+    out += s;
+}
+
+void writeSnapshot(const std::string& path, const Snapshot& snap) {
+    std::string out;
+    size_t bytes = sizeof MAGIC + 3 * sizeof(uint64_t) + snap.source.size();
+    for (const auto& v : snap.vars) {
+        bytes += 1 + sizeof(uint64_t) + v.first.size() + sizeof(uint64_t);
+        if (auto s = std::get_if<std::string>(&v.second)) bytes += s->size();
+    }
+    out.reserve(bytes);
+
+    out.append(MAGIC, sizeof MAGIC);
+    putBytes(out, snap.source);
+    putSize(out, snap.resumeAt);
+    putSize(out, snap.vars.size());
+
+    for (const auto& v : snap.vars) {
+        if (auto i = std::get_if<int>(&v.second)) {
+            out += static_cast<char>(TAG_INT);
+            putBytes(out, v.first);
+            int32_t n = *i;
+            out.append(reinterpret_cast<const char*>(&n), sizeof n);
+        } else if (auto d = std::get_if<double>(&v.second)) {
+            out += static_cast<char>(TAG_DOUBLE);
+            putBytes(out, v.first);
+            out.append(reinterpret_cast<const char*>(d), sizeof *d);
+        } else {
+            out += static_cast<char>(TAG_STRING);
+            putBytes(out, v.first);
+            putBytes(out, std::get<std::string>(v.second));
+        }
+    }
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("snapshot: cannot write " + tmp);
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        file.close();
+        if (!file) throw std::runtime_error("snapshot: cannot write " + tmp);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("snapshot: cannot write " + path);
+    }
+}
+
+// ===== reading =====
+
+// walks the mapped bytes; every read is checked against the end so a
+// truncated or foreign file is an error instead of a crash
+struct SnapshotReader {
+    const char* p;
+    const char* end;
+    const std::string& path;
+
+    void need(uint64_t n) const {
+        if (n > static_cast<uint64_t>(end - p)) {
+            throw std::runtime_error("not a kash snapshot or truncated: " + path);
+        }
+    }
+
+    void raw(void* out, size_t n) {
+        need(n);
+        std::memcpy(out, p, n);
+        p += n;
+    }
+
+    uint64_t size() {
+        uint64_t n = 0;
+        raw(&n, sizeof n);
+        return n;
+    }
+
+    std::string bytes() {
+        uint64_t n = size();
+        need(n);
+        std::string s(p, static_cast<size_t>(n));
+        p += n;
+        return s;
+    }
+};
+
+Snapshot readSnapshot(const std::string& path) {
+    MappedFile file(path);
+    SnapshotReader in{ file.data(), file.data() + file.size(), path };
+
+    char magic[sizeof MAGIC];
+    in.raw(magic, sizeof magic);
+    if (std::memcmp(magic, MAGIC, sizeof MAGIC) != 0) {
+        throw std::runtime_error("not a kash snapshot: " + path);
+    }
+
+    Snapshot snap;
+    snap.source = in.bytes();
+    snap.resumeAt = static_cast<size_t>(in.size());
+    uint64_t count = in.size();
+    // every variable takes at least a tag and a name length
+    in.need(count > SIZE_MAX / 16 ? SIZE_MAX : count * (1 + sizeof(uint64_t)));
+    snap.vars.reserve(static_cast<size_t>(count));
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint8_t tag = 0;
+        in.raw(&tag, 1);
+        std::string name = in.bytes();
+
+        if (tag == TAG_INT) {
+            int32_t n = 0;
+            in.raw(&n, sizeof n);
+            snap.vars.emplace_back(std::move(name), static_cast<int>(n));
+        } else if (tag == TAG_DOUBLE) {
+            double d = 0.0;
+            in.raw(&d, sizeof d);
+            snap.vars.emplace_back(std::move(name), d);
+        } else if (tag == TAG_STRING) {
+            snap.vars.emplace_back(std::move(name), in.bytes());
+        } else {
+            throw std::runtime_error("not a kash snapshot or truncated: " + path);
+        }
+    }
+    return snap;
+}
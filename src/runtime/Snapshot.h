@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../parser/AST.h"
+
+// Warm starts: `x = snapshot("warm.snap");` at the top level of a script
+// saves the program text and every variable, and
+// `kash --restore=warm.snap` picks the run up at the next statement with
+// x set to 1 (it is 0 in the run that wrote the file). Scripts put their
+// slow set-up before the snapshot and skip it on later runs.
+//
+// The file is the magic "KASHSNP1", then the source, the statement to
+// resume at and the variables, each as a tag byte, name and value; sizes
+// are 64-bit and everything is in the writer's byte order. It is read
+// through a read-only mapping {see FileIO.h}, so restoring costs one pass
+// over the bytes.
+
+struct Snapshot {
+    std::string source;
+    size_t resumeAt = 0; // index of the top-level statement to run next
+    std::vector<std::pair<std::string, Value>> vars;
+};
+
+// written to path + ".tmp" and renamed over path, so a crash never
+// leaves half a snapshot behind
+void writeSnapshot(const std::string& path, const Snapshot& snap);
+
+Snapshot readSnapshot(const std::string& path);
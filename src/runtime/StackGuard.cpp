@@ -0,0 +1,19 @@
+#include "StackGuard.h"
+
+#include <pthread.h>
+
+thread_local uintptr_t stackGuard = 0;
+
+// the thread's own stack; the main thread's is as big as its rlimit allows
+uintptr_t findStackGuard() {
+    pthread_attr_t attr;
+    void* lowest = nullptr;
+    size_t size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &lowest, &size);
+        pthread_attr_destroy(&attr);
+    }
+    // nothing known: nothing refused
+    stackGuard = lowest ? guardFor(lowest) : 1;
+    return stackGuard;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The interpreter evaluates expressions recursively, so a deep enough tree
+// runs the thread off the end of its stack. Each level asks stackLow()
+// first and fails with an error while there is still room to unwind.
+// Cheap enough to ask on every operator: one thread_local load and a compare.
+
+// what is left below the lowest level evaluated: room for a builtin, the
+// exception and the profiler's signal handler
+static const size_t STACK_RESERVE = 128 * 1024;
+
+// evaluating below this address is refused; null until the first stackLow()
+// on a thread, which finds its stack {see StackGuard.cpp}
+extern thread_local uintptr_t stackGuard;
+
+uintptr_t findStackGuard();
+
+inline bool stackLow() {
+    char here;
+    uintptr_t guard = stackGuard ? stackGuard : findStackGuard();
+    return reinterpret_cast<uintptr_t>(&here) < guard;
+}
+
+// a task switch {see Tasks.h} moves the thread to another stack; `lowest`
+// is its lowest usable byte
+inline uintptr_t guardFor(const void* lowest) {
+    return reinterpret_cast<uintptr_t>(lowest) + STACK_RESERVE;
+}
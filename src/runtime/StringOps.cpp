@@ -0,0 +1,84 @@
+#include "StringOps.h"
+#include <cstring>
+
+#include "Simd.h"
+
+size_t findBytes(const char* hay, size_t n, const char* needle, size_t m, size_t from) {
+    if (from > n) return NOT_FOUND;
+    if (m == 0) return from;
+    if (m > n - from) return NOT_FOUND;
+
+    if (m == 1) {
+        const void* p = std::memchr(hay + from, needle[0], n - from);
+        return p ? static_cast<size_t>(static_cast<const char*>(p) - hay) : NOT_FOUND;
+    }
+
+    // last position a match can start at
+    size_t lastStart = n - m;
+    size_t i = from;
+
+#if KASH_SIMD
+    Vec first = Vec::splat(needle[0]);
+    Vec last = Vec::splat(needle[m - 1]);
+
+    // lanes i..i+width-1 start candidates; the second load ends at i+m-1+width
+    while (i + Vec::width <= lastStart + 1) {
+        uint32_t mask = ((Vec::load(hay + i) == first) & (Vec::load(hay + i + m - 1) == last)).mask();
+        while (mask) {
+            size_t at = i + lowestBit(mask);
+            if (std::memcmp(hay + at + 1, needle + 1, m - 2) == 0) return at;
+            mask &= mask - 1;
+        }
+        i += Vec::width;
+    }
+#endif
+
+    // what is left (or everything without SIMD): memchr to the next first byte
+    while (i <= lastStart) {
+        const void* p = std::memchr(hay + i, needle[0], lastStart + 1 - i);
+        if (!p) return NOT_FOUND;
+        size_t at = static_cast<size_t>(static_cast<const char*>(p) - hay);
+        if (hay[at + m - 1] == needle[m - 1] && std::memcmp(hay + at + 1, needle + 1, m - 2) == 0) return at;
+        i = at + 1;
+    }
+    return NOT_FOUND;
+}
+
+size_t countBytes(const std::string& hay, const std::string& needle) {
+    size_t count = 0;
+    size_t at = findBytes(hay, needle, 0);
+    while (at != NOT_FOUND) {
+        count++;
+        at = findBytes(hay, needle, at + needle.size());
+    }
+    return count;
+}
+
+std::string replaceBytes(const std::string& s, const std::string& from, const std::string& to) {
+    size_t at = findBytes(s, from, 0);
+    if (at == NOT_FOUND) return s;
+
+    std::string out;
+    out.reserve(s.size());
+    size_t done = 0;
+    while (at != NOT_FOUND) {
+        out.append(s, done, at - done);
+        out += to;
+        done = at + from.size();
+        at = findBytes(s, from, done);
+    }
+    out.append(s, done, std::string::npos);
+    return out;
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+void trimBounds(const std::string& s, size_t& start, size_t& length) {
+    size_t b = 0, e = s.size();
+    while (b < e && isSpace(s[b])) b++;
+    while (e > b && isSpace(s[e - 1])) e--;
+    start = b;
+    length = e - b;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Byte searches behind find, contains, count, split and replace.
+// Needles of two or more bytes are found by comparing a whole vector of
+// candidate positions against the needle's first and last byte at once
+// (see Simd.h); only positions where both match get a memcmp. Single
+// bytes go straight to memchr.
+
+static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+// first position >= from where needle starts, or NOT_FOUND;
+// an empty needle is found at `from`
+size_t findBytes(const char* hay, size_t n, const char* needle, size_t m, size_t from);
+
+inline size_t findBytes(const std::string& hay, const std::string& needle, size_t from = 0) {
+    return findBytes(hay.data(), hay.size(), needle.data(), needle.size(), from);
+}
+
+// non-overlapping occurrences, needle must not be empty
+size_t countBytes(const std::string& hay, const std::string& needle);
+
+// every occurrence of from replaced by to, from must not be empty
+std::string replaceBytes(const std::string& s, const std::string& from, const std::string& to);
+
+// without leading and trailing spaces, tabs, \r, \n, \v and \f:
+// sets start and length of what is left
+void trimBounds(const std::string& s, size_t& start, size_t& length);
@@ -0,0 +1,347 @@
+#include "Tasks.h"
+#include "StackGuard.h"
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// thrown inside a task that reset() unwinds; never leaves the task
+struct Cancelled {};
+
+static const char* DEADLOCK = "deadlock: every task is waiting on a channel";
+
+Task::~Task() {
+    if (stack) munmap(stack, mapped);
+}
+
+TaskScheduler::TaskScheduler() {
+    mainTask.state = Task::RUNNING;
+    mainTask.started = true;
+}
+
+static size_t stackMapping() {
+    // one page below the stack stays unmapped, so running off the end
+    // faults instead of writing over something else
+    return TaskScheduler::STACK_BYTES + static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+TaskScheduler::~TaskScheduler() {
+    reset();
+    for (void* s : spareStacks) munmap(s, stackMapping());
+}
+
+// ===== tasks =====
+
+void TaskScheduler::spawn(std::function<void()> body, const Stmt* where) {
+    auto task = std::make_unique<Task>();
+
+    size_t bytes = stackMapping();
+    size_t page = bytes - STACK_BYTES;
+    void* m;
+    if (!spareStacks.empty()) {
+        m = spareStacks.back();
+        spareStacks.pop_back();
+    } else {
+        m = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (m == MAP_FAILED) throw std::runtime_error("spawn: no memory for another task");
+        // without the guard page an overflow would run into whatever is mapped below
+        if (mprotect(m, page, PROT_NONE) != 0) {
+            munmap(m, bytes);
+            throw std::runtime_error("spawn: no memory for another task");
+        }
+    }
+    task->stack = m;
+    task->mapped = bytes;
+    task->stackGuard = guardFor(static_cast<char*>(m) + page);
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = static_cast<char*>(m) + page;
+    task->context.uc_stack.ss_size = STACK_BYTES;
+    task->context.uc_link = nullptr; // runTask never returns
+    // makecontext only passes ints
+    uint64_t self = reinterpret_cast<uintptr_t>(this);
+    makecontext(&task->context, reinterpret_cast<void (*)()>(&TaskScheduler::entry), 2,
+                static_cast<uint32_t>(self >> 32), static_cast<uint32_t>(self));
+
+    task->body = std::move(body);
+    task->current = where;
+    task->frames[0] = where;
+    task->depth = 1;
+
+    task->slot = tasks.size();
+    ready.push_back(task.get());
+    tasks.push_back(std::move(task));
+}
+
+void TaskScheduler::entry(uint32_t high, uint32_t low) {
+    uint64_t self = (static_cast<uint64_t>(high) << 32) | low;
+    reinterpret_cast<TaskScheduler*>(static_cast<uintptr_t>(self))->runTask();
+}
+
+void TaskScheduler::runTask() {
+    Task* task = running;
+    task->started = true;
+    try {
+        resumed();
+        task->body();
+    } catch (const Cancelled&) {
+    } catch (...) {
+        if (!failure) failure = std::current_exception();
+    }
+    // out of the handler before switching: the exception being handled
+    // belongs to this stack
+
+    task->state = Task::DONE;
+    task->body = nullptr;
+    // still running on its stack, so it is only moved aside
+    size_t slot = task->slot;
+    dead.push_back(std::move(tasks[slot]));
+    if (slot + 1 != tasks.size()) {
+        tasks[slot] = std::move(tasks.back());
+        tasks[slot]->slot = slot;
+    }
+    tasks.pop_back();
+
+    // the main program rethrows the failure, or looks at what it waits
+    // for again when nothing else can run
+    Task* next = nullptr;
+    if (!failure && !cancelling) next = nextReady();
+    if (!next) {
+        next = &mainTask;
+        unqueue(next);
+    }
+
+    // no way back here; whoever runs next frees this stack
+    running = next;
+    next->state = Task::RUNNING;
+    setcontext(&next->context);
+}
+
+void TaskScheduler::switchTo(Task* next) {
+    Task* from = running;
+    savePosition(from);
+    from->stackGuard = stackGuard;
+    running = next;
+    next->state = Task::RUNNING;
+    swapcontext(&from->context, &next->context);
+    resumed();
+}
+
+// first thing a task does whenever it runs again
+void TaskScheduler::resumed() {
+    loadPosition(running);
+    stackGuard = running->stackGuard;
+    if (!dead.empty()) freeDead();
+    if (running != &mainTask) {
+        if (cancelling) throw Cancelled{};
+        return;
+    }
+    if (failure && !cancelling) {
+        std::exception_ptr error = failure;
+        failure = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+// a few stacks are kept, so spawning in a loop does not map and fault in
+// a fresh one every time
+void TaskScheduler::freeDead() {
+    for (auto& t : dead) {
+        if (spareStacks.size() < SPARE_STACKS) {
+            spareStacks.push_back(t->stack);
+            t->stack = nullptr;
+        }
+    }
+    dead.clear();
+}
+
+void TaskScheduler::wake(Task* task) {
+    task->waitingOn = nullptr;
+    task->state = Task::READY;
+    ready.push_back(task);
+}
+
+void TaskScheduler::wakeOne(std::deque<Task*>& waiters) {
+    while (!waiters.empty()) {
+        Task* t = waiters.front();
+        waiters.pop_front();
+        if (t->waitingOn == &waiters) {
+            wake(t);
+            return;
+        }
+    }
+}
+
+void TaskScheduler::wakeAll(std::deque<Task*>& waiters) {
+    for (Task* t : waiters) {
+        if (t->waitingOn == &waiters) wake(t);
+    }
+    waiters.clear();
+}
+
+// for a task run without being woken: the main program, when a task that
+// ends has nothing else to hand over to
+void TaskScheduler::unqueue(Task* task) {
+    if (!task->waitingOn) return;
+    std::deque<Task*>& q = *task->waitingOn;
+    q.erase(std::remove(q.begin(), q.end(), task), q.end());
+    task->waitingOn = nullptr;
+}
+
+// readable, at its end or broken: a read will not wait in any case
+static bool readable(int fd, int timeoutMs) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    while (true) {
+        int n = poll(&p, 1, timeoutMs);
+        if (n >= 0) return n > 0;
+        if (errno != EINTR) return true; // the read reports it
+    }
+}
+
+void TaskScheduler::pollInput(bool block) {
+    if (readable(inputFd, block ? -1 : 0)) wakeAll(inputWaiters);
+}
+
+// null when every task waits on a channel. Waiting for input only
+// blocks the thread when nothing else can run.
+Task* TaskScheduler::nextReady() {
+    while (!ready.empty() && ready.front()->state != Task::READY) ready.pop_front();
+    if (!inputWaiters.empty()) pollInput(ready.empty());
+
+    while (!ready.empty()) {
+        Task* t = ready.front();
+        ready.pop_front();
+        if (t->state == Task::READY) return t;
+    }
+    return nullptr;
+}
+
+// a task in `on` wakes the running one; the caller looks again after,
+// since another task may have got there first
+void TaskScheduler::wait(std::deque<Task*>& on) {
+    on.push_back(running);
+    running->waitingOn = &on;
+    running->state = Task::WAITING;
+
+    Task* next = nextReady();
+    if (!next) {
+        unqueue(running);
+        running->state = Task::RUNNING;
+        throw std::runtime_error(DEADLOCK);
+    }
+    if (next == running) running->state = Task::RUNNING; // its input came first
+    else switchTo(next);
+}
+
+void TaskScheduler::finish() {
+    std::deque<Task*> nobody; // the last task to end hands over to the main program
+    while (!tasks.empty()) wait(nobody);
+}
+
+void TaskScheduler::reset() {
+    failure = nullptr;
+    cancelling = true;
+    while (!tasks.empty()) {
+        Task* t = tasks.back().get();
+        if (t->started) {
+            switchTo(t); // it unwinds and takes itself off the list
+        } else {
+            tasks.pop_back();
+        }
+    }
+    cancelling = false;
+
+    freeDead();
+    ready.clear();
+    inputWaiters.clear();
+    channels.clear();
+}
+
+// ===== channels =====
+
+Channel& TaskScheduler::channel(const std::string& fn, int handle) {
+    if (handle < 1 || static_cast<size_t>(handle) > channels.size()) {
+        throw std::runtime_error(fn + ": not a channel: " + std::to_string(handle));
+    }
+    return *channels[static_cast<size_t>(handle) - 1];
+}
+
+int TaskScheduler::makeChannel(int capacity) {
+    if (capacity < 1) throw std::runtime_error("chan: capacity must be at least 1");
+    auto c = std::make_unique<Channel>();
+    c->capacity = static_cast<size_t>(capacity);
+    channels.push_back(std::move(c));
+    return static_cast<int>(channels.size());
+}
+
+void TaskScheduler::send(int handle, Value value) {
+    Channel& c = channel("send", handle);
+    while (!c.closed && c.values.size() >= c.capacity) wait(c.senders);
+    if (c.closed) throw std::runtime_error("send: channel " + std::to_string(handle) + " is closed");
+
+    c.values.push_back(std::move(value));
+    wakeOne(c.receivers);
+}
+
+Value TaskScheduler::receive(int handle) {
+    Channel& c = channel("receive", handle);
+    while (!c.closed && c.values.empty()) wait(c.receivers);
+    if (c.values.empty()) {
+        throw std::runtime_error("receive: channel " + std::to_string(handle) + " is closed and empty");
+    }
+
+    Value v = std::move(c.values.front());
+    c.values.pop_front();
+    wakeOne(c.senders);
+    return v;
+}
+
+bool TaskScheduler::hasValue(int handle) {
+    Channel& c = channel("hasValue", handle);
+    while (!c.closed && c.values.empty()) wait(c.receivers);
+    // it may have been woken for this value without taking it
+    if (!c.values.empty()) wakeOne(c.receivers);
+    return !c.values.empty();
+}
+
+void TaskScheduler::close(int handle) {
+    Channel& c = channel("closeChan", handle);
+    if (c.closed) throw std::runtime_error("closeChan: channel " + std::to_string(handle) + " is already closed");
+    c.closed = true;
+    wakeAll(c.receivers);
+    wakeAll(c.senders);
+}
+
+// ===== input =====
+
+void TaskScheduler::waitReadable(int fd, std::streambuf& buffer) {
+    // -1 means at the end, which does not wait either
+    while (buffer.in_avail() == 0 && !readable(fd, 0)) {
+        inputFd = fd;
+        wait(inputWaiters);
+    }
+}
+
+// ===== profiler frames =====
+
+void TaskScheduler::savePosition(Task* task) {
+    if (!position) return;
+    task->current = position->current.load(std::memory_order_relaxed);
+    task->depth = position->depth.load(std::memory_order_relaxed);
+    std::copy(position->frames, position->frames + std::min(task->depth, ExecPosition::MAX_DEPTH),
+              task->frames);
+}
+
+void TaskScheduler::loadPosition(const Task* task) {
+    if (!position) return;
+    // the handler sees no frames while they change
+    position->depth.store(0, std::memory_order_release);
+    std::copy(task->frames, task->frames + std::min(task->depth, ExecPosition::MAX_DEPTH),
+              position->frames);
+    position->current.store(task->current, std::memory_order_relaxed);
+    position->depth.store(task->depth, std::memory_order_release);
+}
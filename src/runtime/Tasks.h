@@ -0,0 +1,148 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <ucontext.h>
+
+#include "../parser/AST.h"
+#include "SampleProfiler.h"
+
+// spawn { ... } and channels. Tasks are coroutines on the thread that
+// runs the interpreter: each one has a stack of its own and runs until it
+// waits on a channel, on in() / input() with no line ready, or ends; then
+// the next task that can go on runs. Only one runs at a time, so the
+// interpreter needs no locks and a switch is one swapcontext(). Nothing
+// is preempted: a task that never waits keeps the others waiting.
+//
+// The main program is a task too and runs on the thread's own stack.
+// Variables are shared by every task; channels hand values from one task
+// to another in order.
+
+struct Task;
+
+// A bounded queue of values. Handles are small positive ints, like file
+// handles, so they fit in a script variable.
+struct Channel {
+    std::deque<Value> values;
+    size_t capacity = 1;
+    bool closed = false;
+    // tasks waiting for a value (or the close) and for room; each value
+    // or room wakes the first, the close all of them
+    std::deque<Task*> receivers;
+    std::deque<Task*> senders;
+};
+
+struct Task {
+    enum State { READY, RUNNING, WAITING, DONE };
+    State state = READY;
+    bool started = false;
+    size_t slot = 0;                        // in TaskScheduler::tasks
+    std::deque<Task*>* waitingOn = nullptr; // the queue it is in while WAITING
+
+    ucontext_t context;
+    void* stack = nullptr; // mmap'd with a guard page below; null for the main program
+    size_t mapped = 0;
+    uintptr_t stackGuard = 0; // {see StackGuard.h} while it is switched out
+    std::function<void()> body;
+
+    // the ExecPosition of this task while another one runs
+    const Stmt* current = nullptr;
+    size_t depth = 0;
+    const Stmt* frames[ExecPosition::MAX_DEPTH] = {};
+
+    Task() = default;
+    ~Task(); // unmaps the stack
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+};
+
+class TaskScheduler {
+public:
+    TaskScheduler();
+    ~TaskScheduler(); // unwinds the tasks that have not finished
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // queues `body`, which starts the next time the running task waits.
+    // An error in it stops the main program with that error. `where` is
+    // the outermost frame the profiler sees for it.
+    void spawn(std::function<void()> body, const Stmt* where);
+
+    // spawned tasks that have not finished
+    size_t live() const { return tasks.size(); }
+
+    // ===== channels =====
+    int makeChannel(int capacity);
+    // waits while the channel is full; an error once it is closed
+    void send(int handle, Value value);
+    // waits while it is empty; an error when it is closed and empty
+    Value receive(int handle);
+    // waits until there is a value (1) or the channel is closed and empty (0)
+    bool hasValue(int handle);
+    void close(int handle);
+
+    // in() / input() on standard input: the other tasks run until `buffer`
+    // holds something or fd can be read
+    void waitReadable(int fd, std::streambuf& buffer);
+
+    // the main program at its end: runs the others until all have finished
+    void finish();
+
+    // unwinds the tasks that have not finished and forgets every channel;
+    // only the main program calls this
+    void reset();
+
+    // --sample-profile: each task keeps its own frames
+    void publishPosition(ExecPosition* pos) { position = pos; }
+
+    // address space for a task's stack; only the pages it touches use memory
+    static const size_t STACK_BYTES = 1024 * 1024;
+    static const size_t SPARE_STACKS = 64;
+
+private:
+    Task mainTask;
+    Task* running = &mainTask;
+    std::vector<std::unique_ptr<Task>> tasks; // the ones not finished
+    std::vector<std::unique_ptr<Task>> dead;  // finished, their stacks freed by the next task to run
+    std::vector<void*> spareStacks;           // kept from finished tasks for the next spawns
+    std::deque<Task*> ready;
+
+    std::vector<std::unique_ptr<Channel>> channels; // handle - 1
+
+    std::deque<Task*> inputWaiters;
+    int inputFd = -1;
+
+    std::exception_ptr failure; // from a task, rethrown in the main program
+    bool cancelling = false;
+    ExecPosition* position = nullptr;
+
+    Channel& channel(const std::string& fn, int handle);
+
+    void wake(Task* task);
+    void wakeOne(std::deque<Task*>& waiters);
+    void wakeAll(std::deque<Task*>& waiters);
+    void unqueue(Task* task);
+    void pollInput(bool block);
+    Task* nextReady();
+
+    // the running task waits until something wakes it
+    void wait(std::deque<Task*>& on);
+    void switchTo(Task* next);
+    void resumed();
+    void freeDead();
+
+    void savePosition(Task* task);
+    void loadPosition(const Task* task);
+
+    static void entry(uint32_t high, uint32_t low);
+    void runTask();
+};
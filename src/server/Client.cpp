@@ -0,0 +1,159 @@
+#include "Client.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Server.h"
+
+static int connectTo(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof addr.sun_path) {
+        throw std::runtime_error("--connect: socket path must be 1 to " +
+                                 std::to_string(sizeof addr.sun_path - 1) + " bytes");
+    }
+    std::memcpy(addr.sun_path, path.data(), path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error("--connect: cannot create a socket: " + std::string(std::strerror(errno)));
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        std::string why = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("--connect: cannot reach " + path + ": " + why);
+    }
+    return fd;
+}
+
+// one request and its reply; throws when the server hangs up
+static void roundTrip(int fd, const ServeRequest& req, ServeReply& reply) {
+    if (!writeRequest(fd, req) || !readReply(fd, reply)) {
+        throw std::runtime_error("--connect: the server closed the connection");
+    }
+}
+
+int runRemote(const std::string& socketPath, const std::string& script, const std::string& input) {
+    int fd = connectTo(socketPath);
+    ServeRequest req;
+    req.script = script;
+    req.input = input;
+    ServeReply reply;
+    try {
+        roundTrip(fd, req, reply);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    std::cout << reply.output;
+    std::cout.flush();
+    if (reply.status == SERVE_LIMIT) std::cerr << "Limit exceeded: " << reply.error << "\n";
+    else if (reply.status != SERVE_OK) std::cerr << "Error: " << reply.error << "\n";
+    return reply.status == SERVE_UNKNOWN_ID ? 1 : reply.status;
+}
+
+// ===== load generator =====
+
+using Clock = std::chrono::steady_clock;
+
+struct ConnectionResult {
+    std::vector<double> latencies; // seconds, one per request
+    unsigned long long failed = 0; // replies that were not SERVE_OK
+    std::string firstError;
+    std::string problem; // set when the connection itself broke
+};
+
+static void drive(const LoadOptions& options, const std::string& script, const std::string& input,
+                  unsigned long long requests, ConnectionResult& result) {
+    result.latencies.reserve(static_cast<size_t>(requests));
+    int fd = -1;
+    try {
+        fd = connectTo(options.socketPath);
+        ServeRequest req;
+        req.input = input;
+        ServeReply reply;
+        bool haveId = false;
+
+        for (unsigned long long i = 0; i < requests; i++) {
+            req.byId = haveId;
+            if (!haveId) req.script = script;
+
+            auto sent = Clock::now();
+            roundTrip(fd, req, reply);
+            // dropped from the server's cache: send the text again
+            if (reply.status == SERVE_UNKNOWN_ID) {
+                req.byId = false;
+                req.script = script;
+                roundTrip(fd, req, reply);
+            }
+            result.latencies.push_back(std::chrono::duration<double>(Clock::now() - sent).count());
+
+            req.id = reply.id;
+            haveId = true;
+            if (reply.status != SERVE_OK) {
+                if (result.failed == 0) result.firstError = reply.error;
+                result.failed++;
+            }
+        }
+    } catch (const std::exception& e) {
+        result.problem = e.what();
+    }
+    if (fd >= 0) ::close(fd);
+}
+
+static double percentile(const std::vector<double>& sorted, unsigned p) {
+    size_t i = sorted.size() * p / 100;
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int runLoad(const LoadOptions& options, const std::string& script, const std::string& input) {
+    if (options.connections == 0) throw std::runtime_error("--connections must be at least 1");
+    if (options.requests == 0) throw std::runtime_error("--requests must be at least 1");
+
+    unsigned connections = static_cast<unsigned>(
+        std::min<unsigned long long>(options.connections, options.requests));
+    std::vector<ConnectionResult> results(connections);
+    std::vector<std::thread> threads;
+
+    auto started = Clock::now();
+    for (unsigned c = 0; c < connections; c++) {
+        // the first connections take the remainder
+        unsigned long long share = options.requests / connections + (c < options.requests % connections ? 1 : 0);
+        threads.emplace_back(drive, std::cref(options), std::cref(script), std::cref(input), share,
+                             std::ref(results[c]));
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+
+    std::vector<double> all;
+    unsigned long long failed = 0;
+    std::string firstError;
+    for (const auto& r : results) {
+        if (!r.problem.empty()) throw std::runtime_error(r.problem);
+        all.insert(all.end(), r.latencies.begin(), r.latencies.end());
+        if (failed == 0) firstError = r.firstError;
+        failed += r.failed;
+    }
+    std::sort(all.begin(), all.end());
+
+    std::cerr << "requests:     " << all.size() << " over " << connections << " connections in "
+              << seconds * 1000 << " ms\n";
+    std::cerr << "requests/sec: " << all.size() / seconds << "\n";
+    std::cerr << "latency p50:  " << percentile(all, 50) * 1000 << " ms\n";
+    std::cerr << "latency p99:  " << percentile(all, 99) * 1000 << " ms\n";
+    std::cerr << "latency max:  " << all.back() * 1000 << " ms\n";
+    if (failed != 0) {
+        std::cerr << "failed:       " << failed << " (first: " << firstError << ")\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+
+// The other end of `kash --serve` {see Server.h}.
+
+// --connect=SOCK: runs script on the server with input as what in()
+// reads, prints its output and error like a local run would and returns
+// the same exit code
+int runRemote(const std::string& socketPath, const std::string& script, const std::string& input);
+
+struct LoadOptions {
+    std::string socketPath;
+    unsigned long long requests = 10000; // in total
+    unsigned connections = 4;            // each on its own thread
+};
+
+// --connect=SOCK --requests=N: sends the script over and over, the first
+// request on each connection with its text and the rest by id, and prints
+// requests per second and latency percentiles on stderr
+int runLoad(const LoadOptions& options, const std::string& script, const std::string& input);
@@ -0,0 +1,475 @@
+#include "Server.h"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../interpreter/Interpreter.h"
+#include "../lexer/Lexer.h"
+#include "../optimizer/Superinstructions.h"
+#include "../optimizer/TypeInference.h"
+#include "../parser/Parser.h"
+
+// ===== wire format =====
+
+static bool readFull(int fd, void* data, size_t n) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t got = ::read(fd, p, n);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        n -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// MSG_NOSIGNAL: a client that went away is a failed write, not a SIGPIPE
+static bool writeFull(int fd, const std::string& data) {
+    const char* p = data.data();
+    size_t n = data.size();
+    while (n > 0) {
+        ssize_t put = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+        p += put;
+        n -= static_cast<size_t>(put);
+    }
+    return true;
+}
+
+static void putNumber(std::string& out, uint64_t n) {
+    out.append(reinterpret_cast<const char*>(&n), sizeof n);
+}
+
+static void putBytes(std::string& out, const std::string& s) {
+    putNumber(out, s.size());
+    out += s;
+}
+
+static bool getBytes(int fd, std::string& s) {
+    uint64_t n = 0;
+    if (!readFull(fd, &n, sizeof n) || n > SERVE_MAX_BYTES) return false;
+    s.resize(static_cast<size_t>(n));
+    return readFull(fd, &s[0], s.size());
+}
+
+bool readRequest(int fd, ServeRequest& req) {
+    char kind = 0;
+    if (!readFull(fd, &kind, 1)) return false;
+    if (kind == 'S') {
+        req.byId = false;
+        if (!getBytes(fd, req.script)) return false;
+    } else if (kind == 'I') {
+        req.byId = true;
+        if (!readFull(fd, &req.id, sizeof req.id)) return false;
+    } else {
+        return false;
+    }
+    return getBytes(fd, req.input);
+}
+
+bool writeRequest(int fd, const ServeRequest& req) {
+    std::string out;
+    out.reserve(1 + 2 * sizeof(uint64_t) + req.script.size() + req.input.size());
+    if (req.byId) {
+        out += 'I';
+        putNumber(out, req.id);
+    } else {
+        out += 'S';
+        putBytes(out, req.script);
+    }
+    putBytes(out, req.input);
+    return writeFull(fd, out);
+}
+
+bool readReply(int fd, ServeReply& reply) {
+    return readFull(fd, &reply.status, 1) && readFull(fd, &reply.id, sizeof reply.id) &&
+           getBytes(fd, reply.output) && getBytes(fd, reply.error);
+}
+
+bool writeReply(int fd, const ServeReply& reply) {
+    std::string out;
+    out.reserve(1 + 3 * sizeof(uint64_t) + reply.output.size() + reply.error.size());
+    out += static_cast<char>(reply.status);
+    putNumber(out, reply.id);
+    putBytes(out, reply.output);
+    putBytes(out, reply.error);
+    return writeFull(fd, out);
+}
+
+uint64_t scriptId(const std::string& script) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : script) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// ===== compiled scripts =====
+
+// what main does before interpreting, kept so it is done once per script
+struct CompiledScript {
+    std::string source; // snapshot() saves it
+    std::vector<std::unique_ptr<Stmt>> program;
+    TypeReport types;
+};
+
+class ScriptCache {
+public:
+    ScriptCache(const ServeOptions& options) : options(options) {}
+
+    std::shared_ptr<const CompiledScript> find(uint64_t id) {
+        std::lock_guard<std::mutex> hold(lock);
+        auto it = byId.find(id);
+        return it == byId.end() ? nullptr : it->second;
+    }
+
+    // the cached copy when the text matches, else compiles and keeps it
+    std::shared_ptr<const CompiledScript> get(uint64_t id, std::string source) {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            auto it = byId.find(id);
+            if (it != byId.end() && it->second->source == source) return it->second;
+        }
+
+        // compiled outside the lock so a big script does not hold up the rest
+        std::shared_ptr<const CompiledScript> script = compile(std::move(source));
+
+        std::lock_guard<std::mutex> hold(lock);
+        auto it = byId.find(id);
+        if (it != byId.end()) {
+            // another worker got there first; on a hash collision the
+            // first text keeps the id and this one runs uncached
+            if (it->second->source == script->source) return it->second;
+            return script;
+        }
+        if (options.cachedScripts == 0) return script;
+        if (order.size() >= options.cachedScripts) {
+            byId.erase(order.front()); // workers running it hold their own reference
+            order.pop_front();
+        }
+        byId.emplace(id, script);
+        order.push_back(id);
+        return script;
+    }
+
+private:
+    const ServeOptions& options;
+    std::mutex lock;
+    std::unordered_map<uint64_t, std::shared_ptr<const CompiledScript>> byId;
+    std::deque<uint64_t> order; // oldest first
+
+    std::shared_ptr<const CompiledScript> compile(std::string source) const {
+        auto script = std::make_shared<CompiledScript>();
+        script->source = std::move(source);
+
+        Lexer lexer(script->source);
+        auto tokens = lexer.tokenize();
+        Parser parser(tokens);
+        script->program = parser.parse();
+        parser.arrangePhases(script->program, false);
+        optimizeIr(script->program, options.ir);
+
+        // same order as main: types first, fused nodes only match what is still boxed
+        if (options.specialize) script->types = specializeTypes(script->program);
+        if (options.fuse) fuseSuperinstructions(script->program);
+        return script;
+    }
+};
+
+// ===== connections =====
+
+// Connections live in one poll() set while they have no request pending;
+// a worker takes a connection only when it turns readable, serves one
+// request and hands it back. An idle connection holds no worker.
+class ConnectionQueue {
+public:
+    ConnectionQueue() {
+        if (::pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+            throw std::runtime_error("--serve: cannot create a pipe: " + std::string(std::strerror(errno)));
+        }
+    }
+
+    ~ConnectionQueue() {
+        ::close(wake[0]);
+        ::close(wake[1]);
+    }
+
+    // a connection with a request to read, for the next free worker
+    void push(int fd) {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            waiting.push_back(fd);
+        }
+        ready.notify_one();
+    }
+
+    // false once the server is stopping
+    bool pop(int& fd) {
+        std::unique_lock<std::mutex> hold(lock);
+        ready.wait(hold, [this]() { return closed || !waiting.empty(); });
+        if (closed) return false;
+        fd = waiting.front();
+        waiting.pop_front();
+        serving.insert(fd);
+        return true;
+    }
+
+    // no connection is waiting for a worker
+    bool idle() {
+        std::lock_guard<std::mutex> hold(lock);
+        return waiting.empty();
+    }
+
+    // served; back to the poll() set until its next request
+    void giveBack(int fd) {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            serving.erase(fd);
+            if (closed) {
+                ::close(fd);
+                return;
+            }
+            returned.push_back(fd);
+        }
+        char c = 0;
+        (void)!::write(wake[1], &c, 1); // a full pipe has woken poll() already
+    }
+
+    void done(int fd) {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            serving.erase(fd);
+        }
+        ::close(fd);
+    }
+
+    // readable when giveBack() has something for the poll() set
+    int wakeFd() const { return wake[0]; }
+
+    void takeReturned(std::vector<int>& into) {
+        char drain[64];
+        while (::read(wake[0], drain, sizeof drain) > 0) {}
+        std::lock_guard<std::mutex> hold(lock);
+        into.insert(into.end(), returned.begin(), returned.end());
+        returned.clear();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            closed = true;
+            for (int fd : waiting) ::close(fd);
+            waiting.clear();
+            for (int fd : returned) ::close(fd);
+            returned.clear();
+            for (int fd : serving) ::shutdown(fd, SHUT_RDWR);
+        }
+        ready.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<int> waiting;
+    std::unordered_set<int> serving;
+    std::vector<int> returned;
+    int wake[2];
+    bool closed = false;
+};
+
+// ===== workers =====
+
+static void runRequest(Interpreter& interpreter, ScriptCache& cache, ServeRequest& req,
+                       std::ostringstream& output, ServeReply& reply) {
+    reply.status = SERVE_OK;
+    reply.output.clear();
+    reply.error.clear();
+
+    std::shared_ptr<const CompiledScript> script;
+    if (req.byId) {
+        reply.id = req.id;
+        script = cache.find(req.id);
+        if (!script) {
+            reply.status = SERVE_UNKNOWN_ID;
+            reply.error = "no script with this id, send the script itself";
+            return;
+        }
+    } else {
+        reply.id = scriptId(req.script);
+        try {
+            script = cache.get(reply.id, std::move(req.script));
+        } catch (const std::exception& e) {
+            reply.status = SERVE_ERROR;
+            reply.error = e.what();
+            return;
+        }
+    }
+
+    output.str(std::string());
+    output.clear();
+    std::istringstream input(req.input);
+    interpreter.useStreams(input, output);
+    interpreter.useSlots(script->types);
+    interpreter.keepSource(&script->source);
+
+    try {
+        interpreter.interpret(script->program);
+    } catch (const LimitExceeded& e) {
+        reply.status = SERVE_LIMIT;
+        reply.error = e.what();
+    } catch (const std::exception& e) {
+        reply.status = SERVE_ERROR;
+        reply.error = e.what();
+    }
+    // flushes the script's files and drops its variables before replying
+    interpreter.reset();
+    reply.output = output.str();
+}
+
+static std::atomic<unsigned long long> served{0};
+
+static bool readable(int fd) {
+    pollfd p{ fd, POLLIN, 0 };
+    return ::poll(&p, 1, 0) > 0;
+}
+
+static void work(ConnectionQueue& queue, ScriptCache& cache, const Limits& limits) {
+    // one interpreter per worker for the life of the server
+    Interpreter interpreter(limits);
+    std::ostringstream output;
+    ServeRequest req;
+    ServeReply reply;
+
+    int fd = -1;
+    while (queue.pop(fd)) {
+        bool open;
+        // while the next request is here already and nobody else waits,
+        // there is no need to go through poll() for it
+        do {
+            open = readRequest(fd, req);
+            if (!open) break;
+            runRequest(interpreter, cache, req, output, reply);
+            served.fetch_add(1, std::memory_order_relaxed);
+            open = writeReply(fd, reply);
+        } while (open && queue.idle() && readable(fd));
+
+        if (open) queue.giveBack(fd);
+        else queue.done(fd);
+    }
+}
+
+// ===== listening =====
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int) {
+    stopRequested = 1;
+}
+
+static int listenOn(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof addr.sun_path) {
+        throw std::runtime_error("--serve: socket path must be 1 to " +
+                                 std::to_string(sizeof addr.sun_path - 1) + " bytes");
+    }
+    std::memcpy(addr.sun_path, path.data(), path.size());
+
+    // a socket left behind by a server that was killed; anything else is kept
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) ::unlink(path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error("--serve: cannot create a socket: " + std::string(std::strerror(errno)));
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || ::listen(fd, 128) != 0) {
+        std::string why = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("--serve: cannot listen on " + path + ": " + why);
+    }
+    return fd;
+}
+
+int serve(const ServeOptions& options) {
+    if (options.workers == 0) throw std::runtime_error("--workers must be at least 1");
+
+    int listenFd = listenOn(options.socketPath);
+
+    struct sigaction stop{};
+    stop.sa_handler = onStopSignal;
+    sigemptyset(&stop.sa_mask);
+    ::sigaction(SIGINT, &stop, nullptr);
+    ::sigaction(SIGTERM, &stop, nullptr);
+
+    ScriptCache cache(options);
+    ConnectionQueue queue;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < options.workers; i++) {
+        workers.emplace_back(work, std::ref(queue), std::ref(cache), std::cref(options.limits));
+    }
+    std::cerr << "serving on " << options.socketPath << " with " << options.workers << " workers\n";
+
+    // connections with no request pending; the timeout only bounds how
+    // long a stop signal waits to be noticed, anything else wakes poll()
+    // straight away
+    std::vector<int> idle;
+    std::vector<pollfd> polled;
+    while (!stopRequested) {
+        polled.clear();
+        polled.push_back({ queue.wakeFd(), POLLIN, 0 });
+        polled.push_back({ listenFd, POLLIN, 0 });
+        for (int fd : idle) polled.push_back({ fd, POLLIN, 0 });
+        int n = ::poll(polled.data(), polled.size(), 200);
+        if (n <= 0) continue;
+
+        // a request (or a hang-up, which the worker sees as one) goes to a worker
+        std::vector<int> still;
+        for (size_t i = 2; i < polled.size(); i++) {
+            if (polled[i].revents != 0) queue.push(polled[i].fd);
+            else still.push_back(polled[i].fd);
+        }
+        idle.swap(still);
+
+        if (polled[0].revents != 0) queue.takeReturned(idle);
+        if (polled[1].revents != 0) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) { // else EINTR, or the client gave up already
+                // a request that stops halfway, or a reply nobody reads,
+                // gives its worker up after a while
+                timeval limit{ REQUEST_TIMEOUT_SECONDS, 0 };
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof limit);
+                ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof limit);
+                idle.push_back(fd);
+            }
+        }
+    }
+
+    ::close(listenFd);
+    ::unlink(options.socketPath.c_str());
+    for (int fd : idle) ::close(fd);
+    queue.close();
+    for (auto& t : workers) t.join();
+    std::cerr << "served " << served.load() << " requests\n";
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../optimizer/IrPasses.h"
+#include "../runtime/Limits.h"
+
+// `kash --serve=/path/sock --workers=N` keeps the interpreter running and
+// takes scripts over a Unix domain socket, so a caller pays for starting
+// a process once instead of on every run.
+//
+// Each request carries the script (or the id of one sent before) and the
+// text in() / input() read; the reply carries what out() wrote and the
+// error, if any. Scripts are lexed, parsed, optimized, typed and fused once and kept
+// by a hash of their text; the compiled tree is never written to while
+// running, so every worker runs the same copy. Each worker has its own
+// Interpreter that is reset between requests instead of built again.
+// Limits given to the server ({see Limits.h}) apply to every request.
+//
+// A connection can send any number of requests, one after the other. It
+// only holds a worker while one of its requests is being read, run and
+// answered; between requests it waits in the server's poll() set.
+// Everything is in the sender's byte order, the socket is local.
+//
+//   request:  u8 kind ('S' script follows, 'I' id follows)
+//             'S': u64 length, script   'I': u64 id
+//             u64 length, input
+//   reply:    u8 status (SERVE_OK, SERVE_ERROR, SERVE_LIMIT or SERVE_UNKNOWN_ID)
+//             u64 id of the script, for the next 'I' request
+//             u64 length, output
+//             u64 length, error message (empty when status is SERVE_OK)
+
+// the same numbers kash exits with; unknown id means send the script again
+enum : uint8_t { SERVE_OK = 0, SERVE_ERROR = 1, SERVE_LIMIT = 3, SERVE_UNKNOWN_ID = 4 };
+
+// any longer length on the wire closes the connection
+static const uint64_t SERVE_MAX_BYTES = 256ull * 1024 * 1024;
+
+// a connection that stops halfway through a request (or stops reading its
+// reply) for this long is closed
+static const int REQUEST_TIMEOUT_SECONDS = 10;
+
+struct ServeRequest {
+    bool byId = false;
+    uint64_t id = 0;
+    std::string script;
+    std::string input;
+};
+
+struct ServeReply {
+    uint8_t status = SERVE_OK;
+    uint64_t id = 0;
+    std::string output;
+    std::string error;
+};
+
+// false when the other side closed the connection or sent garbage;
+// the writes retry short writes and EINTR
+bool readRequest(int fd, ServeRequest& req);
+bool writeRequest(int fd, const ServeRequest& req);
+bool readReply(int fd, ServeReply& reply);
+bool writeReply(int fd, const ServeReply& reply);
+
+// the id a script is cached under (64-bit FNV-1a of its text)
+uint64_t scriptId(const std::string& script);
+
+struct ServeOptions {
+    std::string socketPath;
+    unsigned workers = 1;
+    size_t cachedScripts = 256; // oldest compiled script is dropped past this
+    Limits limits;
+    bool fuse = true;
+    bool specialize = true;
+    IrOptions ir;
+};
+
+// listens until SIGINT or SIGTERM, then removes the socket; returns the
+// exit code
+int serve(const ServeOptions& options);